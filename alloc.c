@@ -0,0 +1,223 @@
+#include "alloc.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/video/video.h>
+
+typedef struct ElementStats {
+    AllocStats* stats;
+    gchar* name; // the element may be gone by the time the stats are printed
+
+    guint64 allocated;
+    guint64 allocated_bytes;
+    guint64 pooled;
+    guint64 passed;
+
+    gint64 live_bytes; // unpooled buffers that are not freed yet
+    gint64 pool_bytes; // every distinct pool buffer seen
+    gint64 peak_bytes;
+    GHashTable* pool_buffers; // GstBuffer* seen from pools
+
+    gint64 first_time; // of the first and last buffer, g_get_monotonic_time
+    gint64 last_time;
+} ElementStats;
+
+struct AllocStats {
+    GMutex lock; // probes run in every streaming thread
+    GPtrArray* elements; // of ElementStats, in the order they were tracked
+};
+
+#define ELEMENT_STATS_KEY "alloc-stats"
+
+static GQuark mark_quark = 0;
+
+AllocStats* alloc_stats_new(void) {
+    mark_quark = g_quark_from_static_string("alloc-stats-mark");
+    AllocStats* stats = g_new0(AllocStats, 1);
+    g_mutex_init(&stats->lock);
+    stats->elements = g_ptr_array_new();
+    return stats;
+}
+
+static void element_stats_free(ElementStats* element) {
+    g_hash_table_destroy(element->pool_buffers);
+    g_free(element->name);
+    g_free(element);
+}
+
+void alloc_stats_free(AllocStats* stats) {
+    if (!stats) {
+        return;
+    }
+    g_ptr_array_foreach(stats->elements, (GFunc)element_stats_free, NULL);
+    g_ptr_array_free(stats->elements, TRUE);
+    g_mutex_clear(&stats->lock);
+    g_free(stats);
+}
+
+// Called while the buffer is finalized, its memory is still attached
+static void buffer_freed(gpointer data, GstMiniObject* object) {
+    ElementStats* element = data;
+    g_mutex_lock(&element->stats->lock);
+    element->live_bytes -= gst_buffer_get_size(GST_BUFFER_CAST(object));
+    g_mutex_unlock(&element->stats->lock);
+}
+
+static void account_buffer(ElementStats* element, GstBuffer* buffer) {
+    // A buffer forwarded unchanged still carries the mark of the element that made it. Pool
+    // buffers are recycled with the old mark, but then with another timestamp.
+    gpointer mark = GSIZE_TO_POINTER(GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) + 2 : 1);
+    if (gst_mini_object_get_qdata(GST_MINI_OBJECT_CAST(buffer), mark_quark) == mark) {
+        element->passed++;
+        return;
+    }
+    gst_mini_object_set_qdata(GST_MINI_OBJECT_CAST(buffer), mark_quark, mark, NULL);
+
+    gsize size = gst_buffer_get_size(buffer);
+    element->allocated++;
+    element->allocated_bytes += size;
+    if (buffer->pool) {
+        element->pooled++;
+        if (!g_hash_table_contains(element->pool_buffers, buffer)) {
+            g_hash_table_add(element->pool_buffers, buffer);
+            element->pool_bytes += size;
+        }
+    } else {
+        element->live_bytes += size;
+        gst_mini_object_weak_ref(GST_MINI_OBJECT_CAST(buffer), buffer_freed, element);
+    }
+    element->peak_bytes = MAX(element->peak_bytes, element->live_bytes + element->pool_bytes);
+}
+
+static GstPadProbeReturn buffer_probe(GstPad* pad, GstPadProbeInfo* info, ElementStats* element) {
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&element->stats->lock);
+    if (!element->first_time) {
+        element->first_time = now;
+    }
+    element->last_time = now;
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        account_buffer(element, GST_PAD_PROBE_INFO_BUFFER(info));
+    } else {
+        GstBufferList* list = GST_PAD_PROBE_INFO_BUFFER_LIST(info);
+        for (guint i = 0; i < gst_buffer_list_length(list); ++i) {
+            account_buffer(element, gst_buffer_list_get(list, i));
+        }
+    }
+    g_mutex_unlock(&element->stats->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+static void track_pad(GstPad* pad, ElementStats* element) {
+    if (GST_PAD_IS_SRC(pad)) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_BUFFER_LIST,
+                          (GstPadProbeCallback)buffer_probe, element, NULL);
+    }
+}
+
+static gboolean track_existing_pad(GstElement* self, GstPad* pad, gpointer user_data) {
+    track_pad(pad, user_data);
+    return TRUE;
+}
+
+static void pad_added_signal(GstElement* self, GstPad* pad, ElementStats* element) {
+    track_pad(pad, element);
+}
+
+static void track_element(AllocStats* stats, GstElement* element) {
+    // Ghost pads of bins only proxy their children
+    if (GST_IS_BIN(element) || g_object_get_data(G_OBJECT(element), ELEMENT_STATS_KEY)) {
+        return;
+    }
+
+    ElementStats* element_stats = g_new0(ElementStats, 1);
+    element_stats->stats = stats;
+    element_stats->name = gst_object_get_name(GST_OBJECT(element));
+    element_stats->pool_buffers = g_hash_table_new(NULL, NULL);
+    g_object_set_data(G_OBJECT(element), ELEMENT_STATS_KEY, element_stats);
+
+    g_mutex_lock(&stats->lock);
+    g_ptr_array_add(stats->elements, element_stats);
+    g_mutex_unlock(&stats->lock);
+
+    gst_element_foreach_src_pad(element, track_existing_pad, element_stats);
+    g_signal_connect(element, "pad-added", G_CALLBACK(pad_added_signal), element_stats);
+}
+
+static void deep_element_added_signal(GstBin* bin, GstBin* sub_bin, GstElement* element, AllocStats* stats) {
+    track_element(stats, element);
+}
+
+static void track_child(const GValue* value, gpointer user_data) {
+    track_element(user_data, g_value_get_object(value));
+}
+
+void alloc_stats_track_bin(AllocStats* stats, GstBin* bin) {
+    if (!stats) {
+        return;
+    }
+    GstIterator* it = gst_bin_iterate_recurse(bin);
+    gst_iterator_foreach(it, track_child, stats);
+    gst_iterator_free(it);
+    g_signal_connect(bin, "deep-element-added", G_CALLBACK(deep_element_added_signal), stats);
+}
+
+void alloc_stats_print(AllocStats* stats) {
+    if (!stats) {
+        return;
+    }
+    g_mutex_lock(&stats->lock);
+    g_print("Allocations, rates over the time each element pushed buffers:\n");
+    g_print("%-28s %10s %10s %10s %9s %9s %10s %9s\n", "ELEMENT", "ALLOCS", "ALLOCS/S", "MB", "MB/S", "POOL HIT", "PASSED", "PEAK MB");
+    for (guint i = 0; i < stats->elements->len; ++i) {
+        ElementStats* element = g_ptr_array_index(stats->elements, i);
+        if (!element->allocated && !element->passed) {
+            continue;
+        }
+        double seconds = (element->last_time - element->first_time) / (double)G_USEC_PER_SEC;
+        double megabytes = element->allocated_bytes / (1024.0 * 1024.0);
+        // Each distinct pool buffer had to be allocated once, every further use of it is a hit
+        guint64 distinct = g_hash_table_size(element->pool_buffers);
+        double hit_rate = element->pooled ? 100.0 * (element->pooled - distinct) / element->pooled : 0.0;
+        g_print("%-28s %10" G_GUINT64_FORMAT " %10.1f %10.1f %9.2f %8.1f%% %10" G_GUINT64_FORMAT " %9.2f\n",
+                element->name, element->allocated, seconds > 0 ? element->allocated / seconds : 0.0,
+                megabytes, seconds > 0 ? megabytes / seconds : 0.0, hit_rate, element->passed,
+                element->peak_bytes / (1024.0 * 1024.0));
+    }
+    g_mutex_unlock(&stats->lock);
+}
+
+static GstPadProbeReturn allocation_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    GstQuery* query = GST_PAD_PROBE_INFO_QUERY(info);
+    if (GST_QUERY_TYPE(query) != GST_QUERY_ALLOCATION || gst_query_get_n_allocation_pools(query) > 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstCaps* caps = NULL;
+    gst_query_parse_allocation(query, &caps, NULL);
+    GstVideoInfo video_info;
+    if (!caps || !gst_video_info_from_caps(&video_info, caps)) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    // Default strides, so the frames are fine for a sink that ignores GstVideoMeta
+    GstBufferPool* pool = gst_video_buffer_pool_new();
+    GstStructure* config = gst_buffer_pool_get_config(pool);
+    guint size = GST_VIDEO_INFO_SIZE(&video_info);
+    gst_buffer_pool_config_set_params(config, caps, size, ALLOC_VIDEO_POOL_MIN, ALLOC_VIDEO_POOL_MAX);
+    if (gst_buffer_pool_set_config(pool, config)) {
+        gst_query_add_allocation_pool(query, pool, size, ALLOC_VIDEO_POOL_MIN, ALLOC_VIDEO_POOL_MAX);
+    }
+    gst_object_unref(pool);
+    return GST_PAD_PROBE_OK;
+}
+
+void alloc_provide_video_pool(GstElement* sink) {
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    if (!pad) {
+        return;
+    }
+    // PULL: after the sink answered, so its own pool wins
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_QUERY_DOWNSTREAM | GST_PAD_PROBE_TYPE_PULL, allocation_probe, NULL, NULL);
+    gst_object_unref(pad);
+}
@@ -0,0 +1,34 @@
+#ifndef __ALLOC_H
+#define __ALLOC_H
+
+#include "gst/gstbin.h"
+#include "gst/gstelement.h"
+
+// Buffer allocation accounting. A probe on every src pad of every element (including the ones
+// decodebin plugs later) sorts the buffers an element pushes into:
+//   allocated  new buffers, told apart from forwarded ones by the timestamp they were first seen with
+//   pooled     allocated buffers that came from a GstBufferPool. The pool hit rate is the share
+//              of them that reused a buffer seen before, (pooled - distinct buffers) / pooled
+//   passed     buffers an element forwarded unchanged (in place or passthrough)
+// Peak resident memory is the most an element had alive at once: unpooled buffers until they
+// are freed, plus every distinct buffer of its pools, since those stay allocated.
+typedef struct AllocStats AllocStats;
+
+AllocStats* alloc_stats_new(void);
+// Must outlive the pipeline, buffers report back when they are freed
+void alloc_stats_free(AllocStats* stats);
+
+// Every element in bin now and later, call before the pipeline starts streaming
+void alloc_stats_track_bin(AllocStats* stats, GstBin* bin);
+
+void alloc_stats_print(AllocStats* stats);
+
+// Buffers of a pool for the video chain, the most that can exist at once
+#define ALLOC_VIDEO_POOL_MIN 2
+#define ALLOC_VIDEO_POOL_MAX 8
+
+// Answers allocation queries that reach sink without a pool with a video pool of the exact frame
+// size, so the converters in front reuse a bounded set of frames instead of allocating each one
+void alloc_provide_video_pool(GstElement* sink);
+
+#endif
@@ -0,0 +1,580 @@
+#include "analysis.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/audio/gstaudiofilter.h>
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+// AVX kernels are built whatever the compiler flags and picked at class init when the cpu has AVX
+#define ANALYSIS_AVX __attribute__((target("avx")))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define ANALYSIS_MAX_CHANNELS 8
+#define ANALYSIS_MAX_BANDS 64
+#define ANALYSIS_MIN_FFT_SIZE 64
+#define ANALYSIS_MAX_FFT_SIZE 16384
+#define ANALYSIS_FLOOR_DB -120.0
+
+typedef struct AudioAnalysis {
+    GstAudioFilter parent;
+
+    // Properties, guarded by the object lock
+    guint fft_size;
+    GstClockTime interval;
+    guint bands;
+    gboolean is_dirty; // fft tables or interval need to be recomputed
+
+    // Streaming thread only
+    guint channels;
+    guint rate;
+    guint interval_frames;
+    guint span_frames; // frames measured since the last message
+    double sum_squares[ANALYSIS_MAX_CHANNELS];
+    float peak[ANALYSIS_MAX_CHANNELS];
+
+    guint fft_length; // fft_size in use, 0 until the tables exist
+    guint band_count;
+    guint band_start[ANALYSIS_MAX_BANDS + 1]; // first bin of each band, the last entry ends the last band
+    float* history; // mono downmix of the last fft_length frames, oldest at history_write
+    guint history_write;
+    float* window; // hann
+    double window_norm; // bin power of a full scale sine, for 0 dBFS
+    float* fft_re;
+    float* fft_im;
+    float* twiddle_re; // all stages back to back, the stage with half size h starts at h - 1
+    float* twiddle_im;
+    guint* bit_reverse;
+} AudioAnalysis;
+
+typedef struct AudioAnalysisClass {
+    GstAudioFilterClass parent_class;
+} AudioAnalysisClass;
+
+enum {
+    PROP_0,
+    PROP_FFT_SIZE,
+    PROP_INTERVAL,
+    PROP_BANDS,
+};
+
+#define AUDIO_ANALYSIS(obj) ((AudioAnalysis*)(obj))
+
+G_DEFINE_TYPE(AudioAnalysis, audio_analysis, GST_TYPE_AUDIO_FILTER)
+
+// ---------------------------------------------------------------------------
+// Kernels
+// ---------------------------------------------------------------------------
+
+#if defined(ANALYSIS_AVX)
+static gboolean has_avx = FALSE;
+
+// Whole vectors of kernel_level, returns the samples done
+ANALYSIS_AVX static guint level_avx(const float* samples, guint count, guint channels, double* sum_squares, float* peak) {
+    guint i = 0;
+    if (8 % channels == 0) {
+        __m256 sums = _mm256_setzero_ps();
+        __m256 peaks = _mm256_setzero_ps();
+        __m256 sign = _mm256_set1_ps(-0.0f);
+        for (; i + 8 <= count; i += 8) {
+            __m256 x = _mm256_loadu_ps(samples + i);
+            sums = _mm256_add_ps(sums, _mm256_mul_ps(x, x));
+            peaks = _mm256_max_ps(peaks, _mm256_andnot_ps(sign, x));
+        }
+        float lane_sums[8];
+        float lane_peaks[8];
+        _mm256_storeu_ps(lane_sums, sums);
+        _mm256_storeu_ps(lane_peaks, peaks);
+        for (guint l = 0; l < 8; ++l) {
+            sum_squares[l % channels] += lane_sums[l];
+            peak[l % channels] = MAX(peak[l % channels], lane_peaks[l]);
+        }
+    }
+    return i;
+}
+
+// Whole vectors of kernel_butterflies, returns the butterflies done
+ANALYSIS_AVX static guint butterflies_avx(float* ar, float* ai, float* br, float* bi, const float* wr, const float* wi, guint count) {
+    guint k = 0;
+    for (; k + 8 <= count; k += 8) {
+        __m256 xr = _mm256_loadu_ps(br + k);
+        __m256 xi = _mm256_loadu_ps(bi + k);
+        __m256 cr = _mm256_loadu_ps(wr + k);
+        __m256 ci = _mm256_loadu_ps(wi + k);
+        __m256 tr = _mm256_sub_ps(_mm256_mul_ps(xr, cr), _mm256_mul_ps(xi, ci));
+        __m256 ti = _mm256_add_ps(_mm256_mul_ps(xr, ci), _mm256_mul_ps(xi, cr));
+        __m256 yr = _mm256_loadu_ps(ar + k);
+        __m256 yi = _mm256_loadu_ps(ai + k);
+        _mm256_storeu_ps(ar + k, _mm256_add_ps(yr, tr));
+        _mm256_storeu_ps(ai + k, _mm256_add_ps(yi, ti));
+        _mm256_storeu_ps(br + k, _mm256_sub_ps(yr, tr));
+        _mm256_storeu_ps(bi + k, _mm256_sub_ps(yi, ti));
+    }
+    return k;
+}
+#endif
+
+// Adds squares and keeps max |x| per channel, count is a multiple of channels.
+// Vector lanes map to fixed channels whenever the lane count is a multiple of channels.
+static void kernel_level(const float* samples, guint count, guint channels, double* sum_squares, float* peak) {
+    guint i = 0;
+#if defined(ANALYSIS_AVX)
+    if (has_avx) {
+        i = level_avx(samples, count, channels, sum_squares, peak);
+    }
+#endif
+#if defined(__SSE__)
+    if (4 % channels == 0) {
+        __m128 sums = _mm_setzero_ps();
+        __m128 peaks = _mm_setzero_ps();
+        __m128 sign = _mm_set1_ps(-0.0f);
+        for (; i + 4 <= count; i += 4) {
+            __m128 x = _mm_loadu_ps(samples + i);
+            sums = _mm_add_ps(sums, _mm_mul_ps(x, x));
+            peaks = _mm_max_ps(peaks, _mm_andnot_ps(sign, x));
+        }
+        float lane_sums[4];
+        float lane_peaks[4];
+        _mm_storeu_ps(lane_sums, sums);
+        _mm_storeu_ps(lane_peaks, peaks);
+        for (guint l = 0; l < 4; ++l) {
+            sum_squares[l % channels] += lane_sums[l];
+            peak[l % channels] = MAX(peak[l % channels], lane_peaks[l]);
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (4 % channels == 0) {
+        float32x4_t sums = vdupq_n_f32(0.0f);
+        float32x4_t peaks = vdupq_n_f32(0.0f);
+        for (; i + 4 <= count; i += 4) {
+            float32x4_t x = vld1q_f32(samples + i);
+            sums = vmlaq_f32(sums, x, x);
+            peaks = vmaxq_f32(peaks, vabsq_f32(x));
+        }
+        float lane_sums[4];
+        float lane_peaks[4];
+        vst1q_f32(lane_sums, sums);
+        vst1q_f32(lane_peaks, peaks);
+        for (guint l = 0; l < 4; ++l) {
+            sum_squares[l % channels] += lane_sums[l];
+            peak[l % channels] = MAX(peak[l % channels], lane_peaks[l]);
+        }
+    }
+#endif
+    // Vector loops stop on a frame boundary, so i % channels is still the channel here
+    for (; i < count; ++i) {
+        float x = samples[i];
+        sum_squares[i % channels] += x * x;
+        peak[i % channels] = MAX(peak[i % channels], fabsf(x));
+    }
+}
+
+// Radix-2 butterflies over split complex arrays: t = w * b, a = a + t, b = a - t
+static void kernel_butterflies(float* ar, float* ai, float* br, float* bi, const float* wr, const float* wi, guint count) {
+    guint k = 0;
+#if defined(ANALYSIS_AVX)
+    if (has_avx) {
+        k = butterflies_avx(ar, ai, br, bi, wr, wi, count);
+    }
+#endif
+#if defined(__SSE__)
+    for (; k + 4 <= count; k += 4) {
+        __m128 xr = _mm_loadu_ps(br + k);
+        __m128 xi = _mm_loadu_ps(bi + k);
+        __m128 cr = _mm_loadu_ps(wr + k);
+        __m128 ci = _mm_loadu_ps(wi + k);
+        __m128 tr = _mm_sub_ps(_mm_mul_ps(xr, cr), _mm_mul_ps(xi, ci));
+        __m128 ti = _mm_add_ps(_mm_mul_ps(xr, ci), _mm_mul_ps(xi, cr));
+        __m128 yr = _mm_loadu_ps(ar + k);
+        __m128 yi = _mm_loadu_ps(ai + k);
+        _mm_storeu_ps(ar + k, _mm_add_ps(yr, tr));
+        _mm_storeu_ps(ai + k, _mm_add_ps(yi, ti));
+        _mm_storeu_ps(br + k, _mm_sub_ps(yr, tr));
+        _mm_storeu_ps(bi + k, _mm_sub_ps(yi, ti));
+    }
+#elif defined(__ARM_NEON)
+    for (; k + 4 <= count; k += 4) {
+        float32x4_t xr = vld1q_f32(br + k);
+        float32x4_t xi = vld1q_f32(bi + k);
+        float32x4_t cr = vld1q_f32(wr + k);
+        float32x4_t ci = vld1q_f32(wi + k);
+        float32x4_t tr = vmlsq_f32(vmulq_f32(xr, cr), xi, ci);
+        float32x4_t ti = vmlaq_f32(vmulq_f32(xr, ci), xi, cr);
+        float32x4_t yr = vld1q_f32(ar + k);
+        float32x4_t yi = vld1q_f32(ai + k);
+        vst1q_f32(ar + k, vaddq_f32(yr, tr));
+        vst1q_f32(ai + k, vaddq_f32(yi, ti));
+        vst1q_f32(br + k, vsubq_f32(yr, tr));
+        vst1q_f32(bi + k, vsubq_f32(yi, ti));
+    }
+#endif
+    for (; k < count; ++k) {
+        float tr = br[k] * wr[k] - bi[k] * wi[k];
+        float ti = br[k] * wi[k] + bi[k] * wr[k];
+        float yr = ar[k];
+        float yi = ai[k];
+        ar[k] = yr + tr;
+        ai[k] = yi + ti;
+        br[k] = yr - tr;
+        bi[k] = yi - ti;
+    }
+}
+
+// Windowed history into bit reversed order, then the iterative radix-2 stages
+static void compute_fft(AudioAnalysis* self) {
+    guint n = self->fft_length;
+    for (guint i = 0; i < n; ++i) {
+        guint j = self->bit_reverse[i];
+        self->fft_re[j] = self->history[(self->history_write + i) & (n - 1)] * self->window[i];
+        self->fft_im[j] = 0.0f;
+    }
+
+    for (guint half = 1; half < n; half <<= 1) {
+        const float* wr = self->twiddle_re + half - 1;
+        const float* wi = self->twiddle_im + half - 1;
+        for (guint start = 0; start < n; start += 2 * half) {
+            kernel_butterflies(self->fft_re + start, self->fft_im + start,
+                               self->fft_re + start + half, self->fft_im + start + half, wr, wi, half);
+        }
+    }
+}
+
+// Only the last fft_length frames can end up in the spectrum, older ones are skipped
+static void push_history(AudioAnalysis* self, const float* samples, guint frames) {
+    guint channels = self->channels;
+    guint skip = frames > self->fft_length ? frames - self->fft_length : 0;
+    float scale = 1.0f / channels;
+    for (guint f = skip; f < frames; ++f) {
+        const float* frame = samples + f * channels;
+        float sum = 0.0f;
+        for (guint c = 0; c < channels; ++c) {
+            sum += frame[c];
+        }
+        self->history[self->history_write] = sum * scale;
+        self->history_write = (self->history_write + 1) & (self->fft_length - 1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Tables and messages
+// ---------------------------------------------------------------------------
+
+static void free_tables(AudioAnalysis* self) {
+    g_clear_pointer(&self->history, g_free);
+    g_clear_pointer(&self->window, g_free);
+    g_clear_pointer(&self->fft_re, g_free);
+    g_clear_pointer(&self->fft_im, g_free);
+    g_clear_pointer(&self->twiddle_re, g_free);
+    g_clear_pointer(&self->twiddle_im, g_free);
+    g_clear_pointer(&self->bit_reverse, g_free);
+    self->fft_length = 0;
+}
+
+// Called with the object lock held, whenever the properties or the rate changed
+static void update_tables(AudioAnalysis* self) {
+    if (self->fft_length != self->fft_size) {
+        free_tables(self);
+        guint n = self->fft_size;
+        self->fft_length = n;
+        self->history = g_new0(float, n);
+        self->history_write = 0;
+        self->window = g_new(float, n);
+        self->fft_re = g_new(float, n);
+        self->fft_im = g_new(float, n);
+        self->twiddle_re = g_new(float, n - 1);
+        self->twiddle_im = g_new(float, n - 1);
+        self->bit_reverse = g_new(guint, n);
+
+        double window_sum = 0.0;
+        for (guint i = 0; i < n; ++i) {
+            self->window[i] = 0.5 - 0.5 * cos(2.0 * G_PI * i / n);
+            window_sum += self->window[i];
+        }
+        // A sine of amplitude 1 shows up in its bin with magnitude sum(window) / 2
+        self->window_norm = (window_sum / 2.0) * (window_sum / 2.0);
+
+        for (guint half = 1; half < n; half <<= 1) {
+            for (guint k = 0; k < half; ++k) {
+                self->twiddle_re[half - 1 + k] = cos(-G_PI * k / half);
+                self->twiddle_im[half - 1 + k] = sin(-G_PI * k / half);
+            }
+        }
+
+        guint bits = g_bit_storage(n) - 1;
+        for (guint i = 0; i < n; ++i) {
+            guint reversed = 0;
+            for (guint b = 0; b < bits; ++b) {
+                reversed |= ((i >> b) & 1) << (bits - 1 - b);
+            }
+            self->bit_reverse[i] = reversed;
+        }
+    }
+
+    // Log-spaced bands from ANALYSIS_MIN_FREQUENCY to nyquist, each at least one bin wide
+    guint last_bin = self->fft_length / 2;
+    double nyquist = self->rate / 2.0;
+    self->band_count = self->bands;
+    self->band_start[0] = MAX(1, (guint)(ANALYSIS_MIN_FREQUENCY * self->fft_length / self->rate));
+    for (guint b = 1; b <= self->band_count; ++b) {
+        double frequency = ANALYSIS_MIN_FREQUENCY * pow(nyquist / ANALYSIS_MIN_FREQUENCY, (double)b / self->band_count);
+        guint bin = (guint)ceil(frequency * self->fft_length / self->rate);
+        bin = MAX(bin, self->band_start[b - 1] + 1);
+        self->band_start[b] = MIN(bin, last_bin + 1);
+    }
+
+    self->interval_frames = MAX(1, gst_util_uint64_scale(self->interval, self->rate, GST_SECOND));
+    self->is_dirty = FALSE;
+}
+
+static double power_to_db(double power) {
+    return power > 0.0 ? MAX(10.0 * log10(power), ANALYSIS_FLOOR_DB) : ANALYSIS_FLOOR_DB;
+}
+
+static void set_double_array(GstStructure* structure, const char* field, const double* values, guint count) {
+    GValue array = G_VALUE_INIT;
+    GValue value = G_VALUE_INIT;
+    g_value_init(&array, GST_TYPE_ARRAY);
+    g_value_init(&value, G_TYPE_DOUBLE);
+    for (guint i = 0; i < count; ++i) {
+        g_value_set_double(&value, values[i]);
+        gst_value_array_append_value(&array, &value);
+    }
+    g_value_unset(&value);
+    gst_structure_take_value(structure, field, &array);
+}
+
+// gst_element_post_message only queues the message on the bus, the streaming thread never waits on the reader
+static void post_analysis(AudioAnalysis* self, GstClockTime timestamp) {
+    double rms[ANALYSIS_MAX_CHANNELS];
+    double peak[ANALYSIS_MAX_CHANNELS];
+    for (guint c = 0; c < self->channels; ++c) {
+        rms[c] = power_to_db(self->sum_squares[c] / self->span_frames);
+        peak[c] = power_to_db((double)self->peak[c] * self->peak[c]);
+    }
+
+    compute_fft(self);
+    double spectrum[ANALYSIS_MAX_BANDS];
+    for (guint b = 0; b < self->band_count; ++b) {
+        double band_power = 0.0;
+        guint end = MAX(self->band_start[b + 1], self->band_start[b] + 1);
+        for (guint k = self->band_start[b]; k < end && k <= self->fft_length / 2; ++k) {
+            double power = (double)self->fft_re[k] * self->fft_re[k] + (double)self->fft_im[k] * self->fft_im[k];
+            band_power = MAX(band_power, power);
+        }
+        spectrum[b] = power_to_db(band_power / self->window_norm);
+    }
+
+    GstStructure* structure = gst_structure_new(ANALYSIS_MESSAGE, "timestamp", G_TYPE_UINT64, timestamp, NULL);
+    set_double_array(structure, "rms", rms, self->channels);
+    set_double_array(structure, "peak", peak, self->channels);
+    set_double_array(structure, "spectrum", spectrum, self->band_count);
+    gst_element_post_message(GST_ELEMENT(self), gst_message_new_element(GST_OBJECT(self), structure));
+
+    memset(self->sum_squares, 0, sizeof(self->sum_squares));
+    memset(self->peak, 0, sizeof(self->peak));
+    self->span_frames = 0;
+}
+
+// ---------------------------------------------------------------------------
+// GstBaseTransform / GstAudioFilter
+// ---------------------------------------------------------------------------
+
+static gboolean audio_analysis_setup(GstAudioFilter* filter, const GstAudioInfo* info) {
+    AudioAnalysis* self = AUDIO_ANALYSIS(filter);
+
+    GST_OBJECT_LOCK(self);
+    self->channels = GST_AUDIO_INFO_CHANNELS(info);
+    self->rate = GST_AUDIO_INFO_RATE(info);
+    self->span_frames = 0;
+    memset(self->sum_squares, 0, sizeof(self->sum_squares));
+    memset(self->peak, 0, sizeof(self->peak));
+    update_tables(self);
+    GST_OBJECT_UNLOCK(self);
+    return TRUE;
+}
+
+static GstFlowReturn audio_analysis_transform_ip(GstBaseTransform* base, GstBuffer* buffer) {
+    AudioAnalysis* self = AUDIO_ANALYSIS(base);
+
+    GST_OBJECT_LOCK(self);
+    if (self->is_dirty) {
+        update_tables(self);
+    }
+    GST_OBJECT_UNLOCK(self);
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return GST_FLOW_ERROR;
+    }
+
+    const float* samples = (const float*)map.data;
+    guint frames = map.size / (sizeof(float) * self->channels);
+    GstClockTime pts = GST_BUFFER_PTS(buffer);
+
+    // A buffer may span several intervals, each one gets its own message
+    for (guint done = 0; done < frames;) {
+        guint n = MIN(frames - done, self->interval_frames - self->span_frames);
+        const float* chunk = samples + done * self->channels;
+        kernel_level(chunk, n * self->channels, self->channels, self->sum_squares, self->peak);
+        push_history(self, chunk, n);
+        self->span_frames += n;
+        done += n;
+
+        if (self->span_frames >= self->interval_frames) {
+            GstClockTime timestamp = GST_CLOCK_TIME_NONE;
+            if (GST_CLOCK_TIME_IS_VALID(pts)) {
+                timestamp = pts + gst_util_uint64_scale(done, GST_SECOND, self->rate);
+                timestamp = gst_segment_to_stream_time(&base->segment, GST_FORMAT_TIME, timestamp);
+            }
+            post_analysis(self, timestamp);
+        }
+    }
+
+    gst_buffer_unmap(buffer, &map);
+    return GST_FLOW_OK;
+}
+
+static gboolean audio_analysis_stop(GstBaseTransform* base) {
+    AudioAnalysis* self = AUDIO_ANALYSIS(base);
+    GST_OBJECT_LOCK(self);
+    free_tables(self);
+    self->is_dirty = TRUE;
+    GST_OBJECT_UNLOCK(self);
+    return TRUE;
+}
+
+static void audio_analysis_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
+    AudioAnalysis* self = AUDIO_ANALYSIS(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        // Rounded down to a power of two for the radix-2 transform
+        case PROP_FFT_SIZE: self->fft_size = 1u << (g_bit_storage(g_value_get_uint(value)) - 1); break;
+        case PROP_INTERVAL: self->interval = g_value_get_uint64(value); break;
+        case PROP_BANDS: self->bands = g_value_get_uint(value); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    self->is_dirty = TRUE;
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void audio_analysis_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec) {
+    AudioAnalysis* self = AUDIO_ANALYSIS(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_FFT_SIZE: g_value_set_uint(value, self->fft_size); break;
+        case PROP_INTERVAL: g_value_set_uint64(value, self->interval); break;
+        case PROP_BANDS: g_value_set_uint(value, self->bands); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void audio_analysis_finalize(GObject* object) {
+    free_tables(AUDIO_ANALYSIS(object));
+    G_OBJECT_CLASS(audio_analysis_parent_class)->finalize(object);
+}
+
+static void audio_analysis_class_init(AudioAnalysisClass* klass) {
+    GObjectClass* gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass* element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass* transform_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstAudioFilterClass* filter_class = GST_AUDIO_FILTER_CLASS(klass);
+
+    gobject_class->set_property = audio_analysis_set_property;
+    gobject_class->get_property = audio_analysis_get_property;
+    gobject_class->finalize = audio_analysis_finalize;
+
+    GParamFlags flags = G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS;
+    g_object_class_install_property(gobject_class, PROP_FFT_SIZE,
+        g_param_spec_uint("fft-size", "FFT size", "Samples per spectrum, rounded down to a power of two",
+                          ANALYSIS_MIN_FFT_SIZE, ANALYSIS_MAX_FFT_SIZE, 2048, flags));
+    g_object_class_install_property(gobject_class, PROP_INTERVAL,
+        g_param_spec_uint64("interval", "Interval", "Time between messages in nanoseconds",
+                            GST_MSECOND, G_MAXUINT64, 100 * GST_MSECOND, flags));
+    g_object_class_install_property(gobject_class, PROP_BANDS,
+        g_param_spec_uint("bands", "Bands", "Log-spaced spectrum bands", 1, ANALYSIS_MAX_BANDS, 16, flags));
+
+    gst_element_class_set_static_metadata(element_class, "Audio analysis", "Filter/Analyzer/Audio",
+        "RMS, peak and spectrum posted as element messages", "media-player-gst");
+
+    GstCaps* caps = gst_caps_from_string("audio/x-raw, format=(string)" GST_AUDIO_NE(F32) ", layout=(string)interleaved, "
+                                         "rate=(int)[1, MAX], channels=(int)[1, 8]");
+    gst_audio_filter_class_add_pad_templates(filter_class, caps);
+    gst_caps_unref(caps);
+
+    transform_class->transform_ip = audio_analysis_transform_ip;
+    // The element never changes the data, it only reads it on the way through
+    transform_class->transform_ip_on_passthrough = TRUE;
+    transform_class->stop = audio_analysis_stop;
+    filter_class->setup = audio_analysis_setup;
+
+#if defined(ANALYSIS_AVX)
+    __builtin_cpu_init();
+    has_avx = __builtin_cpu_supports("avx");
+#endif
+}
+
+static void audio_analysis_init(AudioAnalysis* self) {
+    self->fft_size = 2048;
+    self->interval = 100 * GST_MSECOND;
+    self->bands = 16;
+    self->is_dirty = TRUE;
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(self), TRUE);
+}
+
+void audio_analysis_register(void) {
+    static gsize is_registered = 0;
+    if (g_once_init_enter(&is_registered)) {
+        gst_element_register(NULL, ANALYSIS_FACTORY, GST_RANK_NONE, audio_analysis_get_type());
+        g_once_init_leave(&is_registered, 1);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Printing
+// ---------------------------------------------------------------------------
+
+static void append_db_values(GString* line, const GstStructure* structure, const char* field) {
+    const GValue* array = gst_structure_get_value(structure, field);
+    for (guint i = 0; array && i < gst_value_array_get_size(array); ++i) {
+        g_string_append_printf(line, " %6.1f", g_value_get_double(gst_value_array_get_value(array, i)));
+    }
+}
+
+gboolean audio_analysis_print_message(GstMessage* message) {
+    if (GST_MESSAGE_TYPE(message) != GST_MESSAGE_ELEMENT) {
+        return FALSE;
+    }
+    const GstStructure* structure = gst_message_get_structure(message);
+    if (!structure || !gst_structure_has_name(structure, ANALYSIS_MESSAGE)) {
+        return FALSE;
+    }
+
+    // One character per band, -90 dBFS and below is blank
+    static const char levels[] = " .:-=+*#%@";
+    guint64 timestamp = GST_CLOCK_TIME_NONE;
+    gst_structure_get_uint64(structure, "timestamp", &timestamp);
+
+    GString* line = g_string_new(NULL);
+    g_string_append_printf(line, "%" GST_TIME_FORMAT " rms", GST_TIME_ARGS(timestamp));
+    append_db_values(line, structure, "rms");
+    g_string_append(line, " peak");
+    append_db_values(line, structure, "peak");
+    g_string_append(line, " dB |");
+    const GValue* spectrum = gst_structure_get_value(structure, "spectrum");
+    for (guint i = 0; spectrum && i < gst_value_array_get_size(spectrum); ++i) {
+        double db = g_value_get_double(gst_value_array_get_value(spectrum, i));
+        int level = (int)((db + 90.0) / 90.0 * (sizeof(levels) - 2) + 0.5);
+        g_string_append_c(line, levels[CLAMP(level, 0, (int)sizeof(levels) - 2)]);
+    }
+    g_string_append_c(line, '|');
+
+    g_print("%s\n", line->str);
+    g_string_free(line, TRUE);
+    return TRUE;
+}
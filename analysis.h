@@ -0,0 +1,25 @@
+#ifndef __ANALYSIS_H
+#define __ANALYSIS_H
+
+#include "gst/gstelement.h"
+#include "gst/gstmessage.h"
+
+// In-tree passthrough element measuring RMS/peak per channel and a coarse spectrum of interleaved
+// F32 audio. Every "interval" it posts an element message named ANALYSIS_MESSAGE with the fields
+//   "timestamp"  GstClockTime, stream time at the end of the measured span
+//   "rms"        GstValueArray of gdouble, dBFS per channel
+//   "peak"       GstValueArray of gdouble, dBFS per channel
+//   "spectrum"   GstValueArray of gdouble, dBFS per band, log-spaced from ANALYSIS_MIN_FREQUENCY to nyquist
+#define ANALYSIS_FACTORY "audioanalysis"
+#define ANALYSIS_MESSAGE "audio-analysis"
+#define ANALYSIS_MIN_FREQUENCY 20.0
+
+GType audio_analysis_get_type(void);
+
+// Registers ANALYSIS_FACTORY with the registry, safe to call more than once and from any thread
+void audio_analysis_register(void);
+
+// Prints an analysis message as a single status line, FALSE if the message is not one
+gboolean audio_analysis_print_message(GstMessage* message);
+
+#endif
@@ -0,0 +1,348 @@
+#include "batch.h"
+#include "glib.h"
+#include "gst/gstbus.h"
+#include "gst/gstelement.h"
+#include "gst/gstmessage.h"
+#include "state.h"
+#include "cache.h"
+#include "loudness.h"
+#include "extract.h"
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct BatchJob {
+    const char* path;
+    gchar* output_path; // render mode only, unique among the jobs
+    Settings* settings; // shared between all jobs, read only
+    Cache* cache; // shared between all jobs, null when disabled
+
+    gboolean is_ok;
+    char* error_message; // g_free'd, null if ok
+    gint64 media_duration; // -1 if unknown
+    gint64 wall_time; // in microseconds
+    gint64 bytes_written;
+    Loudness loudness; // --loudness-scan only
+    gboolean is_loudness_cached;
+} BatchJob;
+
+static const char* extension_for_muxer(const char* muxer) {
+    static const char* extensions[][2] = {
+        {"matroskamux", "mkv"}, {"webmmux", "webm"}, {"oggmux", "ogg"},
+        {"mp4mux", "mp4"}, {"qtmux", "mov"}, {"avimux", "avi"}, {"flvmux", "flv"}
+    };
+
+    for (int i = 0; i < ARRAY_SIZE(extensions); ++i) {
+        if (!strcmp(extensions[i][0], muxer)) {
+            return extensions[i][1];
+        }
+    }
+    return "out";
+}
+
+// In batch mode --output is a directory, every input gets <dir>/<basename>.<muxer extension>.
+// Inputs whose name is taken already, by the same basename in another directory or with another
+// extension, get <basename>-2, -3, ... in input order. used holds the paths handed out so far.
+static gchar* make_output_path(Settings* settings, const char* input, GHashTable* used) {
+    gchar* base = g_path_get_basename(input);
+    char* dot = strrchr(base, '.');
+    if (dot && dot != base) {
+        *dot = '\0';
+    }
+
+    const char* muxer = settings->muxer ? settings->muxer : DEFAULT_MUXER;
+    const char* extension = extension_for_muxer(muxer);
+    gchar* path = NULL;
+    for (guint n = 1; !path || g_hash_table_contains(used, path); ++n) {
+        g_free(path);
+        gchar* name = n == 1 ? g_strdup_printf("%s.%s", base, extension) : g_strdup_printf("%s-%u.%s", base, n, extension);
+        path = g_build_filename(settings->output_path, name, NULL);
+        g_free(name);
+    }
+    g_hash_table_add(used, path);
+
+    g_free(base);
+    return path;
+}
+
+// Only the decode-only measurement, the result lands in the loudness cache
+static void run_loudness_job(BatchJob* job, char* uri) {
+    gint64 start_time = g_get_monotonic_time();
+    gchar* default_dir = loudness_default_dir();
+    const char* dir = job->settings->loudness_dir ? job->settings->loudness_dir : default_dir;
+    job->is_ok = loudness_get(uri, dir, &job->loudness, &job->is_loudness_cached);
+    if (job->is_ok) {
+        job->media_duration = job->loudness.duration;
+    } else {
+        job->error_message = g_strdup("not a local file with audio");
+    }
+    job->wall_time = g_get_monotonic_time() - start_time;
+    g_free(default_dir);
+}
+
+// Thumbnails and peaks only, bytes_written stays 0 for files whose outputs are up to date
+static void run_extract_job(BatchJob* job, char* uri) {
+    gint64 start_time = g_get_monotonic_time();
+    ExtractResult result;
+    job->is_ok = extract_media(job->settings, uri, &result, &job->error_message);
+    job->media_duration = result.duration;
+    job->bytes_written = result.bytes_written;
+    job->wall_time = g_get_monotonic_time() - start_time;
+}
+
+// A branch that never gets data keeps the pipeline from prerolling and from ever reaching EOS,
+// so a job gets this long to preroll, and then this many times the media duration on top
+#define BATCH_PREROLL_TIMEOUT (30 * GST_SECOND)
+#define BATCH_DURATION_FACTOR 4
+
+// Error or EOS message of pipeline, null if it ran out of time. Media of unknown duration only
+// has the preroll deadline.
+static GstMessage* wait_for_end(GstElement* pipeline, GstBus* bus) {
+    GstClockTime deadline = gst_util_get_timestamp() + BATCH_PREROLL_TIMEOUT;
+    gboolean is_prerolled = FALSE;
+
+    for (;;) {
+        GstClockTime timeout = GST_CLOCK_TIME_NONE;
+        if (deadline != GST_CLOCK_TIME_NONE) {
+            GstClockTime now = gst_util_get_timestamp();
+            timeout = deadline > now ? deadline - now : 0;
+        }
+
+        GstMessage* message = gst_bus_timed_pop_filtered(bus, timeout, GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_ASYNC_DONE);
+        if (!message || GST_MESSAGE_TYPE(message) != GST_MESSAGE_ASYNC_DONE) {
+            return message;
+        }
+
+        if (!is_prerolled && GST_MESSAGE_SRC(message) == GST_OBJECT(pipeline)) {
+            is_prerolled = TRUE;
+            gint64 duration;
+            if (gst_element_query_duration(pipeline, GST_FORMAT_TIME, &duration) && duration > 0) {
+                deadline = gst_util_get_timestamp() + duration * BATCH_DURATION_FACTOR + BATCH_PREROLL_TIMEOUT;
+            } else {
+                deadline = GST_CLOCK_TIME_NONE;
+            }
+        }
+        gst_message_unref(message);
+    }
+}
+
+static void run_job(BatchJob* job, gpointer user_data) {
+    // Every pipeline gets the same filter chain, only the input and output differ
+    Settings settings = *job->settings;
+    settings.filepath = (char*)job->path;
+    if (!settings.is_media_forced) {
+        settings.is_audio_only = settings_detect_audio_only(job->path);
+    }
+
+    const char* output_path = job->output_path;
+    if (output_path) {
+        settings.output_path = (char*)output_path;
+    }
+
+    State state = {0};
+    state.cache = job->cache;
+    GstBus* bus = NULL;
+    gint64 start_time = g_get_monotonic_time();
+
+    char* uri = settings_get_file_uri(&settings);
+    if (!uri) {
+        job->error_message = g_strdup("could not resolve uri");
+        goto exit;
+    }
+    if (settings.is_loudness_scan) {
+        run_loudness_job(job, uri);
+        free(uri);
+        return;
+    }
+    if (settings.extract_dir) {
+        run_extract_job(job, uri);
+        free(uri);
+        return;
+    }
+    loudness_normalize(&settings, uri);
+
+    if (!state_build_pipeline(&state, &settings, uri)) {
+        job->error_message = g_strdup("could not build pipeline");
+        goto exit;
+    }
+
+    if (gst_element_set_state(state.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE) {
+        job->error_message = g_strdup("could not change state");
+        goto exit;
+    }
+
+    bus = gst_element_get_bus(state.pipeline);
+    GstMessage* message = wait_for_end(state.pipeline, bus);
+    if (!message) {
+        job->error_message = g_strdup("timed out, a stream never got data");
+        goto exit;
+    }
+    if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+        GError* err;
+        gchar* debug_info;
+
+        gst_message_parse_error(message, &err, &debug_info);
+        job->error_message = g_strdup_printf("%s: %s", GST_OBJECT_NAME(message->src), err->message);
+
+        g_clear_error(&err);
+        g_free(debug_info);
+    } else {
+        job->is_ok = TRUE;
+        gst_element_query_duration(state.pipeline, GST_FORMAT_TIME, &job->media_duration);
+    }
+    gst_message_unref(message);
+
+exit:
+    job->wall_time = g_get_monotonic_time() - start_time;
+    if (bus) {
+        gst_object_unref(bus);
+    }
+    if (state.pipeline) {
+        gst_element_set_state(state.pipeline, GST_STATE_NULL);
+        gst_object_unref(state.pipeline);
+    }
+
+    if (job->is_ok && output_path) {
+        GStatBuf st;
+        if (g_stat(output_path, &st) == 0) {
+            job->bytes_written = st.st_size;
+        }
+    }
+
+    free(uri);
+}
+
+static void print_loudness_summary(BatchJob* jobs, guint count, Settings* settings, gint64 total_wall_time) {
+    double total_media_seconds = 0.0;
+    guint failed = 0;
+
+    g_print("%-6s %10s %10s %10s %12s %10s  %s\n", "STATUS", "LUFS", "PEAK DBTP", "GAIN DB", "DURATION", "SPEED", "FILE");
+    for (guint i = 0; i < count; ++i) {
+        BatchJob* job = &jobs[i];
+        if (!job->is_ok) {
+            failed++;
+            g_print("%-6s %10s %10s %10s %12s %10s  %s (%s)\n", "FAILED", "-", "-", "-", "-", "-", job->path, job->error_message);
+            continue;
+        }
+
+        double media_seconds = job->media_duration / (double)GST_SECOND;
+        double wall_seconds = job->wall_time / (double)G_USEC_PER_SEC;
+        total_media_seconds += media_seconds;
+        gchar* speed = job->is_loudness_cached ? g_strdup("cached") : g_strdup_printf("%.1fx", wall_seconds > 0 ? media_seconds / wall_seconds : 0.0);
+        if (job->loudness.integrated <= LOUDNESS_SILENCE) {
+            g_print("%-6s %10s %10.1f %10s %11.3fs %10s  %s\n", "OK", "silent", job->loudness.true_peak, "-", media_seconds, speed, job->path);
+        } else {
+            g_print("%-6s %10.1f %10.1f %+10.1f %11.3fs %10s  %s\n", "OK", job->loudness.integrated, job->loudness.true_peak,
+                    loudness_gain(&job->loudness, settings->loudness_target), media_seconds, speed, job->path);
+        }
+        g_free(speed);
+    }
+
+    double total_seconds = total_wall_time / (double)G_USEC_PER_SEC;
+    g_print("%u files, %u failed, %u jobs, %.3f s wall-clock", count, failed, settings->jobs, total_seconds);
+    if (total_seconds > 0) {
+        g_print(", %.2fx realtime overall", total_media_seconds / total_seconds);
+    }
+    g_print("\n");
+}
+
+static void print_summary(BatchJob* jobs, guint count, Settings* settings, gint64 total_wall_time) {
+    double total_media_seconds = 0.0;
+    guint failed = 0;
+
+    g_print("%-6s %12s %10s %10s %14s  %s\n", "STATUS", "DURATION", "WALL", "SPEED", "BYTES", "FILE");
+    for (guint i = 0; i < count; ++i) {
+        BatchJob* job = &jobs[i];
+        double wall_seconds = job->wall_time / (double)G_USEC_PER_SEC;
+
+        if (!job->is_ok) {
+            failed++;
+            g_print("%-6s %12s %9.3fs %10s %14s  %s (%s)\n", "FAILED", "-", wall_seconds, "-", "-", job->path, job->error_message);
+            continue;
+        }
+
+        if (job->media_duration > 0 && wall_seconds > 0) {
+            double media_seconds = job->media_duration / (double)GST_SECOND;
+            total_media_seconds += media_seconds;
+            g_print("%-6s %11.3fs %9.3fs %9.2fx %14" G_GINT64_FORMAT "  %s\n", "OK", media_seconds, wall_seconds, media_seconds / wall_seconds, job->bytes_written, job->path);
+        } else {
+            g_print("%-6s %12s %9.3fs %10s %14" G_GINT64_FORMAT "  %s\n", "OK", "-", wall_seconds, "-", job->bytes_written, job->path);
+        }
+    }
+
+    double total_seconds = total_wall_time / (double)G_USEC_PER_SEC;
+    g_print("%u files, %u failed, %u jobs, %.3f s wall-clock", count, failed, settings->jobs, total_seconds);
+    if (total_seconds > 0) {
+        g_print(", %.2fx realtime overall", total_media_seconds / total_seconds);
+    }
+    g_print("\n");
+}
+
+int batch_run(Settings* settings) {
+    guint count = settings->inputs->len;
+    if (count == 0) {
+        g_printerr("Batch mode needs input files (positional arguments or --manifest)\n");
+        return -1;
+    }
+
+    // Playing many files at once to the speakers makes no sense, without --output the results are discarded
+    if (settings->output_mode == OutputPlayback) {
+        settings->output_mode = OutputNull;
+    }
+    if (settings->output_mode == OutputRender && g_mkdir_with_parents(settings->output_path, 0755) != 0) {
+        g_printerr("Could not create output directory %s\n", settings->output_path);
+        return -1;
+    }
+
+    GError* err = NULL;
+    GThreadPool* pool = g_thread_pool_new((GFunc)run_job, NULL, settings->jobs, TRUE, &err);
+    if (!pool) {
+        g_printerr("Could not create worker pool: %s\n", err->message);
+        g_error_free(err);
+        return -1;
+    }
+
+    Cache* cache = settings->cache_dir ? cache_open(settings->cache_dir, settings->cache_max_bytes) : NULL;
+    BatchJob* jobs = g_new0(BatchJob, count);
+    // Output names are settled before any job starts, so no two jobs write the same file
+    GHashTable* used_paths = g_hash_table_new(g_str_hash, g_str_equal);
+    for (guint i = 0; i < count; ++i) {
+        jobs[i].path = g_ptr_array_index(settings->inputs, i);
+        if (settings->output_mode == OutputRender) {
+            jobs[i].output_path = make_output_path(settings, jobs[i].path, used_paths);
+        }
+    }
+    g_hash_table_destroy(used_paths);
+
+    gint64 start_time = g_get_monotonic_time();
+    for (guint i = 0; i < count; ++i) {
+        jobs[i].settings = settings;
+        jobs[i].cache = cache;
+        jobs[i].media_duration = -1;
+        g_thread_pool_push(pool, &jobs[i], NULL);
+    }
+
+    // Waits until every queued job is done
+    g_thread_pool_free(pool, FALSE, TRUE);
+    gint64 total_wall_time = g_get_monotonic_time() - start_time;
+
+    cache_close(cache);
+    if (settings->is_loudness_scan) {
+        print_loudness_summary(jobs, count, settings, total_wall_time);
+    } else {
+        print_summary(jobs, count, settings, total_wall_time);
+    }
+
+    int result = 0;
+    for (guint i = 0; i < count; ++i) {
+        if (!jobs[i].is_ok) {
+            result = -1;
+        }
+        g_free(jobs[i].error_message);
+        g_free(jobs[i].output_path);
+    }
+    g_free(jobs);
+    return result;
+}
@@ -0,0 +1,10 @@
+#ifndef __BATCH_H
+#define __BATCH_H
+
+#include "settings.h"
+
+// Runs every settings->inputs entry through its own pipeline, settings->jobs at a time,
+// prints a per-file summary and returns 0 if all of them succeeded
+int batch_run(Settings* settings);
+
+#endif
@@ -0,0 +1,579 @@
+#include "glib.h"
+#include "gst/gstbin.h"
+#include "gst/gstbus.h"
+#include "gst/gstelement.h"
+#include "gst/gstelementfactory.h"
+#include "gst/gstmessage.h"
+#include "gst/gstpad.h"
+#include "gst/gstparse.h"
+#include <gst/gst.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "settings.h"
+#include "state.h"
+#include "mmapsrc.h"
+
+// Filter chain throughput benchmark.
+// Every combination of the filters State supports is built with the regular state_* functions,
+// fed from audiotestsrc/videotestsrc and drained by fakesink sync=false. Results are printed as JSON.
+//
+// With --source-file the filters are skipped and filesrc and mmapsrc read the given file into
+// fakesink instead, with the page cache dropped for the file (cold) and right after a read (warm).
+
+#define BENCH_RATE 48000
+#define BENCH_CHANNELS 2
+
+typedef struct BenchConfig {
+    guint64 audio_buffers;
+    guint64 samples_per_buffer;
+    guint64 video_frames;
+    guint64 width;
+    guint64 height;
+    gboolean single_only; // baseline + one filter at a time instead of every combination
+    char* output_path; // stdout if null
+    char* source_file; // compare the file sources on it instead of the filters, null if not given
+    guint64 source_runs; // of each source and cache state
+} BenchConfig;
+
+typedef struct BenchFilter {
+    const char* name;
+    const char* factory;
+    void (*enable)(Settings* settings);
+} BenchFilter;
+
+typedef struct BenchResult {
+    guint mask;
+    gboolean is_fused; // volume/balance/pass/echo ran as the single fused element
+    gboolean is_ok;
+    double wall_seconds;
+    double cpu_seconds;
+    double audio_seconds; // until eos reached the audio sink
+    double video_seconds; // until eos reached the video sink
+} BenchResult;
+
+typedef struct SourceResult {
+    const char* factory;
+    gboolean is_cold;
+    gboolean is_ok;
+    double wall_seconds;
+    double cpu_seconds;
+    guint64 bytes;
+    guint64 checksum; // the same for every run, or a source read something else
+} SourceResult;
+
+typedef struct BenchRun {
+    gint64 start_time;
+    gint64 audio_eos_time;
+    gint64 video_eos_time;
+} BenchRun;
+
+static void enable_volume(Settings* settings) {
+    settings->has_volume = TRUE;
+    settings->volume = 0.5;
+}
+
+static void enable_panorama(Settings* settings) {
+    settings->has_panorama = TRUE;
+    settings->balance = 0.3f;
+}
+
+static void enable_pass_filter(Settings* settings) {
+    settings->pass_type = PassLow;
+    settings->pass_cutoff = 1000.0f;
+}
+
+static void enable_echo(Settings* settings) {
+    settings->has_echo = TRUE;
+    settings->echo_delay = 50 * GST_MSECOND;
+    settings->echo_feedback = 0.3f;
+    settings->echo_intensity = 0.5f;
+}
+
+static void enable_pitch(Settings* settings) {
+    settings->has_pitch = TRUE;
+    settings->pitch_pitch = 1.2f;
+}
+
+static void enable_noise_reduction(Settings* settings) {
+    settings->has_noise_reduction = TRUE;
+    settings->noise_reduction = 0.5f;
+}
+
+static void enable_videobalance(Settings* settings) {
+    settings->has_videobalance = TRUE;
+    settings->video_saturation = 0.5;
+}
+
+static const BenchFilter filters[] = {
+    {"volume", "volume", enable_volume},
+    {"audiopanorama", "audiopanorama", enable_panorama},
+    {"audiocheblimit", "audiocheblimit", enable_pass_filter},
+    {"audioecho", "audioecho", enable_echo},
+    {"pitch", "pitch", enable_pitch},
+    {"audiornnoise", "audiornnoise", enable_noise_reduction},
+    {"videobalance", "videobalance", enable_videobalance},
+};
+
+// Filters of the table above that the fused element can replace: volume, audiopanorama, audiocheblimit, audioecho
+#define BENCH_FUSABLE_MASK 0xFu
+
+static gboolean is_fusable_combination(guint mask) {
+    guint fusable = mask & BENCH_FUSABLE_MASK;
+    return fusable & (fusable - 1); // at least two of them
+}
+
+static double cpu_time_seconds(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1e6;
+}
+
+static GstPadProbeReturn eos_probe(GstPad* pad, GstPadProbeInfo* info, gint64* eos_time) {
+    if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_EOS) {
+        *eos_time = g_get_monotonic_time();
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void watch_eos(GstElement* sink, gint64* eos_time) {
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback)eos_probe, eos_time, NULL);
+    gst_object_unref(pad);
+}
+
+static GstElement* make_test_source(const char* description, const char* name) {
+    GError* err = NULL;
+    GstElement* bin = gst_parse_bin_from_description(description, TRUE, &err);
+    if (err) {
+        g_printerr("Could not create test source \"%s\": %s\n", description, err->message);
+        g_clear_error(&err);
+        return NULL;
+    }
+    gst_object_set_name(GST_OBJECT(bin), name);
+    return bin;
+}
+
+static gboolean run_combination(BenchConfig* config, guint mask, gboolean is_fused, BenchResult* result) {
+    result->mask = mask;
+    result->is_fused = is_fused;
+    result->is_ok = FALSE;
+
+    Settings settings;
+    settings_set_default(&settings);
+    settings.output_mode = OutputNull;
+    settings.is_fusion_enabled = is_fused;
+    for (int i = 0; i < ARRAY_SIZE(filters); ++i) {
+        if (mask & (1u << i)) {
+            filters[i].enable(&settings);
+        }
+    }
+
+    State state = {0};
+    state.is_audio_only = FALSE;
+    if (!state_create_all_elements(&state, &settings)) {
+        state_release_unadded_elements(&state);
+        settings_free(&settings);
+        return FALSE;
+    }
+
+    // uridecodebin is replaced by the test sources, it was never added anywhere
+    gst_object_ref_sink(state.source);
+    gst_object_unref(state.source);
+
+    // Both sources cover the same stream duration
+    guint64 audio_samples = config->audio_buffers * config->samples_per_buffer;
+    GstClockTime duration = gst_util_uint64_scale(audio_samples, GST_SECOND, BENCH_RATE);
+    guint64 video_frames = config->video_frames ? config->video_frames : gst_util_uint64_scale(duration, 30, GST_SECOND);
+
+    gchar* audio_description = g_strdup_printf("audiotestsrc num-buffers=%" G_GUINT64_FORMAT " samplesperbuffer=%" G_GUINT64_FORMAT " wave=pink-noise ! audio/x-raw,format=F32LE,rate=%d,channels=%d",
+                                               config->audio_buffers, config->samples_per_buffer, BENCH_RATE, BENCH_CHANNELS);
+    gchar* video_description = g_strdup_printf("videotestsrc num-buffers=%" G_GUINT64_FORMAT " pattern=smpte ! video/x-raw,format=I420,width=%" G_GUINT64_FORMAT ",height=%" G_GUINT64_FORMAT ",framerate=30/1",
+                                               video_frames, config->width, config->height);
+    state.source = make_test_source(audio_description, "audio-test-source");
+    GstElement* video_source = make_test_source(video_description, "video-test-source");
+    g_free(audio_description);
+    g_free(video_description);
+    if (!state.source || !video_source) {
+        if (video_source) {
+            gst_object_ref_sink(video_source);
+            gst_object_unref(video_source);
+        }
+        state_release_unadded_elements(&state);
+        settings_free(&settings);
+        return FALSE;
+    }
+
+    state.pipeline = gst_pipeline_new("bench-pipeline");
+    state_setup_filter_values_from_settings(&state, &settings);
+    state_add_elements(&state, &settings);
+    gst_bin_add(GST_BIN(state.pipeline), video_source);
+
+    gboolean is_ok = state_link_elements(&state, &settings)
+        && gst_element_link(state.source, state_audio_head(&state))
+        && gst_element_link(video_source, state_video_head(&state));
+
+    BenchRun run = {0};
+    if (is_ok) {
+        watch_eos(state.audio_sink, &run.audio_eos_time);
+        watch_eos(state.video_sink, &run.video_eos_time);
+
+        double cpu_start = cpu_time_seconds();
+        run.start_time = g_get_monotonic_time();
+        gst_element_set_state(state.pipeline, GST_STATE_PLAYING);
+
+        GstBus* bus = gst_element_get_bus(state.pipeline);
+        GstMessage* message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+        if (GST_MESSAGE_TYPE(message) == GST_MESSAGE_ERROR) {
+            GError* err;
+            gst_message_parse_error(message, &err, NULL);
+            g_printerr("Error from %s: Message: %s\n", GST_OBJECT_NAME(message->src), err->message);
+            g_clear_error(&err);
+            is_ok = FALSE;
+        }
+        gst_message_unref(message);
+        gst_object_unref(bus);
+
+        gint64 end_time = g_get_monotonic_time();
+        result->cpu_seconds = cpu_time_seconds() - cpu_start;
+        result->wall_seconds = (end_time - run.start_time) / (double)G_USEC_PER_SEC;
+        result->audio_seconds = ((run.audio_eos_time ? run.audio_eos_time : end_time) - run.start_time) / (double)G_USEC_PER_SEC;
+        result->video_seconds = ((run.video_eos_time ? run.video_eos_time : end_time) - run.start_time) / (double)G_USEC_PER_SEC;
+    } else {
+        g_printerr("Could not link benchmark pipeline for mask 0x%x\n", mask);
+    }
+
+    gst_element_set_state(state.pipeline, GST_STATE_NULL);
+    gst_object_unref(state.pipeline);
+    settings_free(&settings);
+
+    result->is_ok = is_ok;
+    return is_ok;
+}
+
+// Sums every byte the way a demuxer would read them, fakesink alone never touches mapped pages
+static GstPadProbeReturn consume_probe(GstPad* pad, GstPadProbeInfo* info, SourceResult* result) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        guint64 sum = 0;
+        gsize i = 0;
+        for (; i + sizeof(guint64) <= map.size; i += sizeof(guint64)) {
+            guint64 word;
+            memcpy(&word, map.data + i, sizeof(word));
+            sum += word;
+        }
+        for (; i < map.size; ++i) {
+            sum += map.data[i];
+        }
+        result->checksum += sum;
+        result->bytes += map.size;
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Clean pages of the file leave the page cache without root rights
+static void drop_page_cache(const char* path) {
+    int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        fdatasync(fd);
+        posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+    }
+}
+
+static gboolean run_source(BenchConfig* config, const char* factory, gboolean is_cold, SourceResult* result) {
+    result->factory = factory;
+    result->is_cold = is_cold;
+    result->is_ok = FALSE;
+
+    GstElement* pipeline = gst_pipeline_new("source-bench-pipeline");
+    GstElement* source = gst_element_factory_make(factory, NULL);
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    if (!source || !sink) {
+        g_printerr("Could not create %s\n", factory);
+        gst_object_unref(pipeline);
+        return FALSE;
+    }
+    // filesrc defaults to 4 KB reads, both sources push the same buffer size so only the way
+    // the bytes get there differs
+    g_object_set(source, "location", config->source_file, "blocksize", MMAP_SRC_BLOCKSIZE, NULL);
+    g_object_set(sink, "sync", FALSE, NULL);
+    gst_bin_add_many(GST_BIN(pipeline), source, sink, NULL);
+    gst_element_link(source, sink);
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)consume_probe, result, NULL);
+    gst_object_unref(pad);
+
+    if (is_cold) {
+        drop_page_cache(config->source_file);
+    }
+    double cpu_start = cpu_time_seconds();
+    gint64 start_time = g_get_monotonic_time();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+
+    GstBus* bus = gst_element_get_bus(pipeline);
+    GstMessage* message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+    result->is_ok = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    if (!result->is_ok) {
+        GError* err;
+        gst_message_parse_error(message, &err, NULL);
+        g_printerr("Error from %s: Message: %s\n", GST_OBJECT_NAME(message->src), err->message);
+        g_clear_error(&err);
+    }
+    gst_message_unref(message);
+    gst_object_unref(bus);
+
+    result->wall_seconds = (g_get_monotonic_time() - start_time) / (double)G_USEC_PER_SEC;
+    result->cpu_seconds = cpu_time_seconds() - cpu_start;
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(pipeline);
+    return result->is_ok;
+}
+
+static gchar* sources_to_json(BenchConfig* config, GArray* results) {
+    GString* json = g_string_new("{\n");
+    gchar* file = g_strescape(config->source_file, NULL);
+    g_string_append_printf(json, "  \"config\": {\"file\": \"%s\", \"runs\": %" G_GUINT64_FORMAT ", \"blocksize\": %d},\n",
+                           file, config->source_runs, MMAP_SRC_BLOCKSIZE);
+    g_free(file);
+
+    g_string_append(json, "  \"runs\": [\n");
+    for (guint i = 0; i < results->len; ++i) {
+        SourceResult* result = &g_array_index(results, SourceResult, i);
+        g_string_append_printf(json, "    {\"source\": \"%s\", \"cache\": \"%s\"", result->factory, result->is_cold ? "cold" : "warm");
+        if (result->is_ok) {
+            g_string_append_printf(json, ", \"status\": \"ok\", \"bytes\": %" G_GUINT64_FORMAT ", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"megabytes_per_second\": %.1f, \"checksum\": \"%016" G_GINT64_MODIFIER "x\"}",
+                                   result->bytes, result->wall_seconds, result->cpu_seconds,
+                                   result->bytes / (1024.0 * 1024.0) / result->wall_seconds, result->checksum);
+        } else {
+            g_string_append(json, ", \"status\": \"failed\"}");
+        }
+        g_string_append(json, i + 1 < results->len ? ",\n" : "\n");
+    }
+    g_string_append(json, "  ]\n}\n");
+    return g_string_free(json, FALSE);
+}
+
+static GArray* run_sources(BenchConfig* config) {
+    static const char* factories[] = {"filesrc", MMAP_SRC_FACTORY};
+    mmap_src_register();
+
+    GArray* results = g_array_new(FALSE, TRUE, sizeof(SourceResult));
+    for (guint64 run = 0; run < config->source_runs; ++run) {
+        for (int i = 0; i < ARRAY_SIZE(factories); ++i) {
+            // The warm run reads what the cold run just brought into the page cache
+            for (int is_cold = 1; is_cold >= 0; --is_cold) {
+                SourceResult result = {0};
+                run_source(config, factories[i], is_cold, &result);
+                g_array_append_val(results, result);
+            }
+        }
+        g_printerr("Finished source run %" G_GUINT64_FORMAT "/%" G_GUINT64_FORMAT "\n", run + 1, config->source_runs);
+    }
+    return results;
+}
+
+static void append_filter_list(GString* json, guint mask) {
+    g_string_append_c(json, '[');
+    gboolean is_first = TRUE;
+    for (int i = 0; i < ARRAY_SIZE(filters); ++i) {
+        if (mask & (1u << i)) {
+            g_string_append_printf(json, "%s\"%s\"", is_first ? "" : ", ", filters[i].name);
+            is_first = FALSE;
+        }
+    }
+    g_string_append_c(json, ']');
+}
+
+static BenchResult* find_result(GArray* results, guint mask) {
+    for (guint i = 0; i < results->len; ++i) {
+        BenchResult* result = &g_array_index(results, BenchResult, i);
+        if (result->mask == mask && !result->is_fused && result->is_ok) {
+            return result;
+        }
+    }
+    return NULL;
+}
+
+static gchar* results_to_json(BenchConfig* config, GArray* results, guint unavailable) {
+    guint64 audio_samples = config->audio_buffers * config->samples_per_buffer;
+    GString* json = g_string_new("{\n");
+
+    g_string_append_printf(json, "  \"config\": {\"rate\": %d, \"channels\": %d, \"audio_samples\": %" G_GUINT64_FORMAT ", \"width\": %" G_GUINT64_FORMAT ", \"height\": %" G_GUINT64_FORMAT "},\n",
+                           BENCH_RATE, BENCH_CHANNELS, audio_samples, config->width, config->height);
+
+    g_string_append(json, "  \"unavailable\": ");
+    append_filter_list(json, unavailable);
+    g_string_append(json, ",\n  \"runs\": [\n");
+
+    guint64 video_frames = config->video_frames ? config->video_frames : gst_util_uint64_scale(audio_samples, 30, BENCH_RATE);
+    for (guint i = 0; i < results->len; ++i) {
+        BenchResult* result = &g_array_index(results, BenchResult, i);
+        g_string_append(json, "    {\"filters\": ");
+        append_filter_list(json, result->mask);
+        g_string_append_printf(json, ", \"fused\": %s", result->is_fused ? "true" : "false");
+        if (result->is_ok) {
+            g_string_append_printf(json, ", \"status\": \"ok\", \"wall_seconds\": %.6f, \"cpu_seconds\": %.6f, \"samples_per_second\": %.1f, \"frames_per_second\": %.2f}",
+                                   result->wall_seconds, result->cpu_seconds,
+                                   audio_samples / result->audio_seconds, video_frames / result->video_seconds);
+        } else {
+            g_string_append(json, ", \"status\": \"failed\"}");
+        }
+        g_string_append(json, i + 1 < results->len ? ",\n" : "\n");
+    }
+    g_string_append(json, "  ],\n");
+
+    // Marginal cost of each element: its single filter run minus the baseline run without filters
+    g_string_append(json, "  \"elements\": {\n");
+    BenchResult* baseline = find_result(results, 0);
+    gboolean is_first = TRUE;
+    for (int i = 0; i < ARRAY_SIZE(filters); ++i) {
+        BenchResult* single = find_result(results, 1u << i);
+        if (!baseline || !single) {
+            continue;
+        }
+        double cpu_seconds = single->cpu_seconds - baseline->cpu_seconds;
+        gboolean is_video = !strcmp(filters[i].name, "videobalance");
+        double units = is_video ? (double)video_frames : (double)audio_samples;
+        g_string_append_printf(json, "%s    \"%s\": {\"cpu_seconds\": %.6f, \"%s\": %.2f}",
+                               is_first ? "" : ",\n", filters[i].name, cpu_seconds,
+                               is_video ? "cpu_ns_per_frame" : "cpu_ns_per_sample", cpu_seconds * 1e9 / units);
+        is_first = FALSE;
+    }
+    g_string_append(json, "\n  }\n}\n");
+
+    return g_string_free(json, FALSE);
+}
+
+static gboolean parse_bench_cli(BenchConfig* config, int argc, char** argv) {
+    static const struct option long_options[] = {
+        {"audio-buffers", required_argument, 0, 'a'},
+        {"samples-per-buffer", required_argument, 0, 's'},
+        {"video-frames", required_argument, 0, 'f'},
+        {"width", required_argument, 0, 'w'},
+        {"height", required_argument, 0, 'h'},
+        {"single", no_argument, 0, '1'},
+        {"output", required_argument, 0, 'o'},
+        {"source-file", required_argument, 0, 'S'},
+        {"source-runs", required_argument, 0, 'r'},
+        {0, 0, 0, 0}
+    };
+
+    while (TRUE) {
+        int r = getopt_long(argc, argv, "", long_options, NULL);
+        if (r == -1) {
+            break;
+        }
+        gboolean is_ok = TRUE;
+        switch (r) {
+            case 'a': is_ok = settings_parse_ul(optarg, NULL, NULL, &config->audio_buffers); break;
+            case 's': is_ok = settings_parse_ul(optarg, NULL, NULL, &config->samples_per_buffer); break;
+            case 'f': is_ok = settings_parse_ul(optarg, NULL, NULL, &config->video_frames); break;
+            case 'w': is_ok = settings_parse_ul(optarg, NULL, NULL, &config->width); break;
+            case 'h': is_ok = settings_parse_ul(optarg, NULL, NULL, &config->height); break;
+            case '1': config->single_only = TRUE; break;
+            case 'o': config->output_path = optarg; break;
+            case 'S': config->source_file = optarg; break;
+            case 'r': is_ok = settings_parse_ul(optarg, NULL, NULL, &config->source_runs); break;
+            default: return FALSE;
+        }
+        if (!is_ok) {
+            return FALSE;
+        }
+    }
+
+    if (!config->audio_buffers || !config->samples_per_buffer || !config->width || !config->height || !config->source_runs) {
+        g_printerr("Buffer counts and sizes must be positive\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static int write_json(BenchConfig* config, const gchar* json) {
+    if (!config->output_path) {
+        g_print("%s", json);
+        return 0;
+    }
+    GError* err = NULL;
+    if (!g_file_set_contents(config->output_path, json, -1, &err)) {
+        g_printerr("Could not write %s: %s\n", config->output_path, err->message);
+        g_error_free(err);
+        return -1;
+    }
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    gst_init(&argc, &argv);
+
+    BenchConfig config = {
+        .audio_buffers = 500,
+        .samples_per_buffer = 1024,
+        .video_frames = 0, // as many as the audio duration at 30 fps
+        .width = 1280,
+        .height = 720,
+        .single_only = FALSE,
+        .output_path = NULL,
+        .source_file = NULL,
+        .source_runs = 3,
+    };
+    if (!parse_bench_cli(&config, argc, argv)) {
+        g_printerr("Usage: ./bench [--audio-buffers n] [--samples-per-buffer n] [--video-frames n] [--width n] [--height n] [--single] [--output file.json] [--source-file path [--source-runs n]]\n");
+        return -1;
+    }
+
+    if (config.source_file) {
+        GArray* source_results = run_sources(&config);
+        gchar* json = sources_to_json(&config, source_results);
+        int exit_code = write_json(&config, json);
+        g_free(json);
+        g_array_free(source_results, TRUE);
+        return exit_code;
+    }
+
+    // Filters whose plugin is missing are reported and left out of every combination
+    guint unavailable = 0;
+    for (int i = 0; i < ARRAY_SIZE(filters); ++i) {
+        GstElementFactory* factory = gst_element_factory_find(filters[i].factory);
+        if (!factory) {
+            unavailable |= 1u << i;
+            continue;
+        }
+        gst_object_unref(factory);
+    }
+
+    GArray* results = g_array_new(FALSE, TRUE, sizeof(BenchResult));
+    guint combinations = 1u << ARRAY_SIZE(filters);
+    for (guint mask = 0; mask < combinations; ++mask) {
+        if (mask & unavailable) {
+            continue;
+        }
+        if (config.single_only && (mask & (mask - 1))) {
+            continue;
+        }
+
+        BenchResult result = {0};
+        run_combination(&config, mask, FALSE, &result);
+        g_array_append_val(results, result);
+
+        // Same combination once more with the fused element, to compare against the separate chain
+        if (is_fusable_combination(mask)) {
+            BenchResult fused_result = {0};
+            run_combination(&config, mask, TRUE, &fused_result);
+            g_array_append_val(results, fused_result);
+        }
+        g_printerr("Finished combination %u/%u\n", mask + 1, combinations);
+    }
+
+    gchar* json = results_to_json(&config, results, unavailable);
+    int exit_code = write_json(&config, json);
+    g_free(json);
+    g_array_free(results, TRUE);
+    return exit_code;
+}
@@ -0,0 +1,516 @@
+#include "cache.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define CACHE_FILL_KEY "cache-fill"
+#define CACHE_GROUP "entry"
+
+struct Cache {
+    char* dir;
+    guint64 max_bytes;
+    GMutex lock;
+    GHashTable* active; // keys being filled right now, never evicted and never filled twice
+};
+
+typedef struct CacheRange {
+    guint64 start;
+    guint64 end; // exclusive
+} CacheRange;
+
+// One http source writing into one entry, lives as long as the source element
+typedef struct CacheFill {
+    Cache* cache;
+    char* key;
+    char* url;
+    int fd;
+    GMutex lock;
+    guint64 length; // content length, 0 until known
+    char* etag;
+    char* last_modified;
+    GArray* ranges; // sorted, non overlapping CacheRange
+    guint64 position; // where the next buffer goes if it has no offset
+} CacheFill;
+
+typedef struct CacheFile {
+    char* data_path;
+    char* meta_path;
+    char* key;
+    guint64 size;
+    gint64 mtime;
+} CacheFile;
+
+static char* make_key(const char* url) {
+    return g_compute_checksum_for_string(G_CHECKSUM_SHA256, url, -1);
+}
+
+static char* make_path(Cache* cache, const char* key, const char* extension) {
+    gchar* name = g_strconcat(key, extension, NULL);
+    gchar* path = g_build_filename(cache->dir, name, NULL);
+    g_free(name);
+    return path;
+}
+
+// ---------------------------------------------------------------------------
+// Ranges
+// ---------------------------------------------------------------------------
+
+static void add_range(GArray* ranges, guint64 start, guint64 end) {
+    CacheRange added = {start, end};
+    guint i = 0;
+    // Skip ranges ending before the new one starts, then swallow every range it touches
+    while (i < ranges->len && g_array_index(ranges, CacheRange, i).end < added.start) {
+        ++i;
+    }
+    while (i < ranges->len && g_array_index(ranges, CacheRange, i).start <= added.end) {
+        CacheRange* range = &g_array_index(ranges, CacheRange, i);
+        added.start = MIN(added.start, range->start);
+        added.end = MAX(added.end, range->end);
+        g_array_remove_index(ranges, i);
+    }
+    g_array_insert_val(ranges, i, added);
+}
+
+static gboolean is_complete(GArray* ranges, guint64 length) {
+    if (length == 0 || ranges->len != 1) {
+        return FALSE;
+    }
+    CacheRange* range = &g_array_index(ranges, CacheRange, 0);
+    return range->start == 0 && range->end >= length;
+}
+
+static gchar* ranges_to_string(GArray* ranges) {
+    GString* str = g_string_new(NULL);
+    for (guint i = 0; i < ranges->len; ++i) {
+        CacheRange* range = &g_array_index(ranges, CacheRange, i);
+        g_string_append_printf(str, "%s%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT, i ? "," : "", range->start, range->end);
+    }
+    return g_string_free(str, FALSE);
+}
+
+static void ranges_from_string(GArray* ranges, const char* str) {
+    gchar** parts = g_strsplit(str, ",", -1);
+    for (gchar** part = parts; *part; ++part) {
+        guint64 start, end;
+        if (sscanf(*part, "%" G_GUINT64_FORMAT "-%" G_GUINT64_FORMAT, &start, &end) == 2 && start < end) {
+            add_range(ranges, start, end);
+        }
+    }
+    g_strfreev(parts);
+}
+
+// ---------------------------------------------------------------------------
+// Entries
+// ---------------------------------------------------------------------------
+
+static void remove_entry(Cache* cache, const char* key) {
+    gchar* data_path = make_path(cache, key, ".data");
+    gchar* meta_path = make_path(cache, key, ".meta");
+    g_unlink(data_path);
+    g_unlink(meta_path);
+    g_free(data_path);
+    g_free(meta_path);
+}
+
+static void free_cache_file(CacheFile* file) {
+    g_free(file->data_path);
+    g_free(file->meta_path);
+    g_free(file->key);
+}
+
+static gint compare_mtime(gconstpointer a, gconstpointer b) {
+    const CacheFile* first = a;
+    const CacheFile* second = b;
+    return first->mtime < second->mtime ? -1 : first->mtime > second->mtime;
+}
+
+// Removes least recently used entries until the directory fits max_bytes, called with the lock held
+static void evict(Cache* cache) {
+    GDir* dir = g_dir_open(cache->dir, 0, NULL);
+    if (!dir) {
+        return;
+    }
+
+    GArray* files = g_array_new(FALSE, TRUE, sizeof(CacheFile));
+    g_array_set_clear_func(files, (GDestroyNotify)free_cache_file);
+    guint64 total = 0;
+    const char* name;
+    while ((name = g_dir_read_name(dir))) {
+        if (!g_str_has_suffix(name, ".data")) {
+            continue;
+        }
+        CacheFile file = {0};
+        file.key = g_strndup(name, strlen(name) - strlen(".data"));
+        file.data_path = g_build_filename(cache->dir, name, NULL);
+        GStatBuf st;
+        if (g_stat(file.data_path, &st) != 0) {
+            free_cache_file(&file);
+            continue;
+        }
+        file.size = st.st_size;
+        file.mtime = st.st_mtime;
+        total += file.size;
+        g_array_append_val(files, file);
+    }
+    g_dir_close(dir);
+
+    g_array_sort(files, compare_mtime);
+    for (guint i = 0; i < files->len && total > cache->max_bytes; ++i) {
+        CacheFile* file = &g_array_index(files, CacheFile, i);
+        if (g_hash_table_contains(cache->active, file->key)) {
+            continue;
+        }
+        g_print("Cache: evicted %s (%" G_GUINT64_FORMAT " bytes)\n", file->key, file->size);
+        remove_entry(cache, file->key);
+        total -= file->size;
+    }
+    g_array_free(files, TRUE);
+}
+
+static GKeyFile* load_meta(Cache* cache, const char* key, const char* url) {
+    gchar* meta_path = make_path(cache, key, ".meta");
+    GKeyFile* meta = g_key_file_new();
+    gboolean is_loaded = g_key_file_load_from_file(meta, meta_path, G_KEY_FILE_NONE, NULL);
+    g_free(meta_path);
+
+    // A hash collision or a broken file is the same as no entry
+    gchar* meta_url = is_loaded ? g_key_file_get_string(meta, CACHE_GROUP, "url", NULL) : NULL;
+    gboolean is_valid = meta_url && !strcmp(meta_url, url);
+    g_free(meta_url);
+    if (!is_valid) {
+        g_key_file_free(meta);
+        return NULL;
+    }
+    return meta;
+}
+
+// ---------------------------------------------------------------------------
+// Filling
+// ---------------------------------------------------------------------------
+
+static void save_meta(CacheFill* fill) {
+    GKeyFile* meta = g_key_file_new();
+    gchar* ranges = ranges_to_string(fill->ranges);
+    g_key_file_set_string(meta, CACHE_GROUP, "url", fill->url);
+    g_key_file_set_string(meta, CACHE_GROUP, "etag", fill->etag ? fill->etag : "");
+    g_key_file_set_string(meta, CACHE_GROUP, "last-modified", fill->last_modified ? fill->last_modified : "");
+    g_key_file_set_uint64(meta, CACHE_GROUP, "length", fill->length);
+    g_key_file_set_string(meta, CACHE_GROUP, "ranges", ranges);
+    g_key_file_set_boolean(meta, CACHE_GROUP, "complete", is_complete(fill->ranges, fill->length));
+
+    gchar* meta_path = make_path(fill->cache, fill->key, ".meta");
+    GError* err = NULL;
+    if (!g_key_file_save_to_file(meta, meta_path, &err)) {
+        g_printerr("Cache: could not write %s: %s\n", meta_path, err->message);
+        g_clear_error(&err);
+    }
+    g_free(meta_path);
+    g_free(ranges);
+    g_key_file_free(meta);
+}
+
+static CacheFill* cache_fill_new(Cache* cache, const char* url) {
+    gchar* key = make_key(url);
+
+    g_mutex_lock(&cache->lock);
+    if (g_hash_table_contains(cache->active, key)) {
+        // Another source fills this entry already, e.g. the same URL twice in a playlist
+        g_mutex_unlock(&cache->lock);
+        g_free(key);
+        return NULL;
+    }
+    g_hash_table_add(cache->active, g_strdup(key));
+    g_mutex_unlock(&cache->lock);
+
+    gchar* data_path = make_path(cache, key, ".data");
+    int fd = g_open(data_path, O_WRONLY | O_CREAT, 0644);
+    g_free(data_path);
+    if (fd < 0) {
+        g_printerr("Cache: could not open entry for %s: %s\n", url, g_strerror(errno));
+        g_mutex_lock(&cache->lock);
+        g_hash_table_remove(cache->active, key);
+        g_mutex_unlock(&cache->lock);
+        g_free(key);
+        return NULL;
+    }
+
+    CacheFill* fill = g_new0(CacheFill, 1);
+    fill->cache = cache;
+    fill->key = key;
+    fill->url = g_strdup(url);
+    fill->fd = fd;
+    g_mutex_init(&fill->lock);
+    fill->ranges = g_array_new(FALSE, FALSE, sizeof(CacheRange));
+
+    // Carry on with what earlier plays downloaded
+    GKeyFile* meta = load_meta(cache, key, url);
+    if (meta) {
+        fill->etag = g_key_file_get_string(meta, CACHE_GROUP, "etag", NULL);
+        fill->last_modified = g_key_file_get_string(meta, CACHE_GROUP, "last-modified", NULL);
+        fill->length = g_key_file_get_uint64(meta, CACHE_GROUP, "length", NULL);
+        gchar* ranges = g_key_file_get_string(meta, CACHE_GROUP, "ranges", NULL);
+        if (ranges) {
+            ranges_from_string(fill->ranges, ranges);
+        }
+        g_free(ranges);
+        g_key_file_free(meta);
+    } else if (ftruncate(fd, 0) != 0) {
+        g_printerr("Cache: could not reset entry for %s\n", url);
+    }
+    return fill;
+}
+
+static void cache_fill_free(CacheFill* fill) {
+    save_meta(fill);
+    if (is_complete(fill->ranges, fill->length)) {
+        g_print("Cache: %s is complete (%" G_GUINT64_FORMAT " bytes)\n", fill->url, fill->length);
+    }
+    close(fill->fd);
+
+    Cache* cache = fill->cache;
+    g_mutex_lock(&cache->lock);
+    g_hash_table_remove(cache->active, fill->key);
+    evict(cache);
+    g_mutex_unlock(&cache->lock);
+
+    g_mutex_clear(&fill->lock);
+    g_array_free(fill->ranges, TRUE);
+    g_free(fill->etag);
+    g_free(fill->last_modified);
+    g_free(fill->url);
+    g_free(fill->key);
+    g_free(fill);
+}
+
+// Other validators mean other content, whatever was downloaded before is useless. Called with the fill lock held
+static void update_validators(CacheFill* fill, const char* etag, const char* last_modified) {
+    gboolean is_changed = (etag && fill->etag && *fill->etag && strcmp(etag, fill->etag))
+        || (last_modified && fill->last_modified && *fill->last_modified && strcmp(last_modified, fill->last_modified));
+    if (is_changed) {
+        g_print("Cache: %s changed on the server, starting over\n", fill->url);
+        g_array_set_size(fill->ranges, 0);
+        fill->length = 0;
+        if (ftruncate(fill->fd, 0) != 0) {
+            g_printerr("Cache: could not reset entry for %s\n", fill->url);
+        }
+    }
+
+    if (etag) {
+        g_free(fill->etag);
+        fill->etag = g_strdup(etag);
+    }
+    if (last_modified) {
+        g_free(fill->last_modified);
+        fill->last_modified = g_strdup(last_modified);
+    }
+}
+
+static void write_buffer(CacheFill* fill, GstElement* source, GstBuffer* buffer) {
+    guint64 offset = GST_BUFFER_OFFSET_IS_VALID(buffer) ? GST_BUFFER_OFFSET(buffer) : fill->position;
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return;
+    }
+
+    gsize written = 0;
+    while (written < map.size) {
+        ssize_t n = pwrite(fill->fd, map.data + written, map.size - written, offset + written);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        written += n;
+    }
+    gst_buffer_unmap(buffer, &map);
+
+    g_mutex_lock(&fill->lock);
+    if (written) {
+        add_range(fill->ranges, offset, offset + written);
+    }
+    fill->position = offset + map.size;
+    if (!fill->length) {
+        gint64 length;
+        if (gst_element_query_duration(source, GST_FORMAT_BYTES, &length) && length > 0) {
+            fill->length = length;
+        }
+    }
+    g_mutex_unlock(&fill->lock);
+}
+
+static GstPadProbeReturn source_probe(GstPad* pad, GstPadProbeInfo* info, GstElement* source) {
+    CacheFill* fill = g_object_get_data(G_OBJECT(source), CACHE_FILL_KEY);
+    if (!fill) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        write_buffer(fill, source, GST_PAD_PROBE_INFO_BUFFER(info));
+    } else if (GST_EVENT_TYPE(GST_PAD_PROBE_INFO_EVENT(info)) == GST_EVENT_SEGMENT) {
+        // After a seek the source continues from the segment start
+        const GstSegment* segment;
+        gst_event_parse_segment(GST_PAD_PROBE_INFO_EVENT(info), &segment);
+        if (segment->format == GST_FORMAT_BYTES) {
+            g_mutex_lock(&fill->lock);
+            fill->position = segment->start;
+            g_mutex_unlock(&fill->lock);
+        }
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static void source_setup_signal(GstElement* uridecodebin, GstElement* source, Cache* cache) {
+    if (!g_object_class_find_property(G_OBJECT_GET_CLASS(source), "location")) {
+        return;
+    }
+    gchar* location = NULL;
+    g_object_get(source, "location", &location, NULL);
+    if (!location || !(g_str_has_prefix(location, "http://") || g_str_has_prefix(location, "https://"))) {
+        g_free(location);
+        return;
+    }
+
+    CacheFill* fill = cache_fill_new(cache, location);
+    g_free(location);
+    if (!fill) {
+        return;
+    }
+    g_object_set_data_full(G_OBJECT(source), CACHE_FILL_KEY, fill, (GDestroyNotify)cache_fill_free);
+
+    GstPad* pad = gst_element_get_static_pad(source, "src");
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM, (GstPadProbeCallback)source_probe, source, NULL);
+    gst_object_unref(pad);
+}
+
+typedef struct Validators {
+    const char* etag;
+    const char* last_modified;
+} Validators;
+
+// Header names keep the case the server sent
+static gboolean find_validator(GQuark field, const GValue* value, Validators* validators) {
+    if (!G_VALUE_HOLDS_STRING(value)) {
+        return TRUE;
+    }
+    const char* name = g_quark_to_string(field);
+    if (!g_ascii_strcasecmp(name, "ETag")) {
+        validators->etag = g_value_get_string(value);
+    } else if (!g_ascii_strcasecmp(name, "Last-Modified")) {
+        validators->last_modified = g_value_get_string(value);
+    }
+    return TRUE;
+}
+
+// Runs in the streaming thread that posted the message, before the source pushes the response body
+static void sync_message_signal(GstBus* bus, GstMessage* message, Cache* cache) {
+    const GstStructure* structure = gst_message_get_structure(message);
+    if (!structure || !gst_structure_has_name(structure, "http-headers")) {
+        return;
+    }
+    CacheFill* fill = g_object_get_data(G_OBJECT(GST_MESSAGE_SRC(message)), CACHE_FILL_KEY);
+    if (!fill) {
+        return;
+    }
+
+    GstStructure* headers = NULL;
+    if (!gst_structure_get(structure, "response-headers", GST_TYPE_STRUCTURE, &headers, NULL)) {
+        return;
+    }
+    Validators validators = {NULL, NULL};
+    gst_structure_foreach(headers, (GstStructureForeachFunc)find_validator, &validators);
+
+    g_mutex_lock(&fill->lock);
+    update_validators(fill, validators.etag, validators.last_modified);
+    g_mutex_unlock(&fill->lock);
+    gst_structure_free(headers);
+}
+
+// ---------------------------------------------------------------------------
+// Cache
+// ---------------------------------------------------------------------------
+
+Cache* cache_open(const char* dir, guint64 max_bytes) {
+    if (g_mkdir_with_parents(dir, 0755) != 0) {
+        g_printerr("Could not create cache directory %s\n", dir);
+        return NULL;
+    }
+
+    Cache* cache = g_new0(Cache, 1);
+    cache->dir = g_strdup(dir);
+    cache->max_bytes = max_bytes;
+    g_mutex_init(&cache->lock);
+    cache->active = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, NULL);
+
+    g_mutex_lock(&cache->lock);
+    evict(cache);
+    g_mutex_unlock(&cache->lock);
+    return cache;
+}
+
+void cache_close(Cache* cache) {
+    if (!cache) {
+        return;
+    }
+    g_hash_table_destroy(cache->active);
+    g_mutex_clear(&cache->lock);
+    g_free(cache->dir);
+    g_free(cache);
+}
+
+gchar* cache_resolve_uri(Cache* cache, const char* uri) {
+    if (!cache || !(g_str_has_prefix(uri, "http://") || g_str_has_prefix(uri, "https://"))) {
+        return g_strdup(uri);
+    }
+
+    gchar* key = make_key(uri);
+    gchar* data_path = make_path(cache, key, ".data");
+    gchar* resolved = NULL;
+
+    g_mutex_lock(&cache->lock);
+    GKeyFile* meta = g_hash_table_contains(cache->active, key) ? NULL : load_meta(cache, key, uri);
+    if (meta) {
+        guint64 length = g_key_file_get_uint64(meta, CACHE_GROUP, "length", NULL);
+        GStatBuf st;
+        if (g_key_file_get_boolean(meta, CACHE_GROUP, "complete", NULL)
+            && g_stat(data_path, &st) == 0 && (guint64)st.st_size == length) {
+            resolved = g_filename_to_uri(data_path, NULL, NULL);
+            // The modification time is the LRU order
+            g_utime(data_path, NULL);
+        }
+        g_key_file_free(meta);
+    }
+    g_mutex_unlock(&cache->lock);
+
+    if (resolved) {
+        g_print("Cache: playing %s from %s\n", uri, data_path);
+    }
+    g_free(data_path);
+    g_free(key);
+    return resolved ? resolved : g_strdup(uri);
+}
+
+void cache_attach_source(Cache* cache, GstElement* uridecodebin) {
+    if (!cache) {
+        return;
+    }
+    g_signal_connect(uridecodebin, "source-setup", G_CALLBACK(source_setup_signal), cache);
+}
+
+void cache_watch_bus(Cache* cache, GstElement* pipeline) {
+    if (!cache) {
+        return;
+    }
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_bus_enable_sync_message_emission(bus);
+    g_signal_connect(bus, "sync-message::element", G_CALLBACK(sync_message_signal), cache);
+    gst_object_unref(bus);
+}
@@ -0,0 +1,28 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include "gst/gstelement.h"
+
+// Size bounded on-disk cache of remote http(s) media. Entries are keyed by a hash of the URL;
+// each one is a <key>.data file written at the byte offsets the http source delivers, and a
+// <key>.meta key file with the URL, the ETag/Last-Modified validators, the content length and
+// the byte ranges downloaded so far. When the server sends different validators for the URL,
+// the entry is started over. Once every byte is on disk the entry is played from the file.
+// A partial entry is never read, its plays and seeks stream everything from the network.
+// Least recently used entries are removed when the directory grows past the size limit.
+typedef struct Cache Cache;
+
+Cache* cache_open(const char* dir, guint64 max_bytes);
+void cache_close(Cache* cache);
+
+// file:// URI of a complete entry for uri, otherwise a copy of uri, also when part of it is
+// cached. cache may be null
+gchar* cache_resolve_uri(Cache* cache, const char* uri);
+
+// Fills the cache from every http source uridecodebin creates, call before it goes to READY
+void cache_attach_source(Cache* cache, GstElement* uridecodebin);
+
+// Picks up the response validators posted by http sources in pipeline
+void cache_watch_bus(Cache* cache, GstElement* pipeline);
+
+#endif
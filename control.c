@@ -0,0 +1,458 @@
+#include "control.h"
+#include "seekindex.h"
+#include "rate.h"
+#include "livefilter.h"
+#include "qos.h"
+#include "glib.h"
+#include "gst/gstelement.h"
+#include "gst/gstevent.h"
+#include "gst/gstformat.h"
+#include <gst/gst.h>
+#include <errno.h>
+#include <poll.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define CONTROL_MAX_CLIENTS 16
+#define CONTROL_MAX_LINE 256
+
+typedef struct ControlParam {
+    const char* name; // as used in the protocol, same as the cli option
+    size_t element_offset; // offset of the GstElement* in State
+    const char* property;
+    gboolean is_fusable; // handled by State.fused_audio when that is in use
+    const char* max_property; // upper bound the element clamps or ignores the value at, null if none
+} ControlParam;
+
+static const ControlParam params[] = {
+    {"volume", offsetof(State, volume), "volume", TRUE, NULL},
+    {"balance", offsetof(State, panorama), "panorama", TRUE, NULL},
+    {"cutoff", offsetof(State, pass_filter), "cutoff", TRUE, NULL},
+    {"delay", offsetof(State, audio_echo), "delay", TRUE, "max-delay"},
+    {"feedback", offsetof(State, audio_echo), "feedback", TRUE, NULL},
+    {"intensity", offsetof(State, audio_echo), "intensity", TRUE, NULL},
+    {"pitch", offsetof(State, pitch), "pitch", FALSE, NULL},
+    {"saturation", offsetof(State, videobalance_filter), "saturation", FALSE, NULL},
+    {"noisethreshold", offsetof(State, noise_reduction), "voice-activity-threshold", FALSE, NULL},
+};
+
+typedef struct ControlClient {
+    int fd;
+    GString* buffer; // bytes received after the last complete line
+} ControlClient;
+
+struct Control {
+    State* state;
+    char* socket_path;
+    int listen_fd;
+    int wake_pipe[2]; // written by control_stop to break out of poll
+    GThread* thread;
+
+    ControlClient clients[CONTROL_MAX_CLIENTS];
+    int client_count;
+};
+
+static const ControlParam* find_param(const char* name) {
+    for (int i = 0; i < ARRAY_SIZE(params); ++i) {
+        if (!strcmp(params[i].name, name)) {
+            return &params[i];
+        }
+    }
+    return NULL;
+}
+
+// With a ref held, unref when done
+static GstElement* param_element(State* state, const ControlParam* param) {
+    if (param->is_fusable && state->fused_audio) {
+        return gst_object_ref(state->fused_audio);
+    }
+    return live_filter_ref_slot((GstElement**)((char*)state + param->element_offset));
+}
+
+// The bound is fixed once the element runs, fusedaudio clamps to it and audioecho ignores the
+// value. -1 when the element has no such property.
+static double param_max(GstElement* element, const ControlParam* param) {
+    if (!param->max_property || !g_object_class_find_property(G_OBJECT_GET_CLASS(element), param->max_property)) {
+        return -1.0;
+    }
+    guint64 max;
+    g_object_get(element, param->max_property, &max, NULL);
+    return (double)max;
+}
+
+static gchar* command_set(State* state, const char* name, const char* value_str) {
+    const ControlParam* param = find_param(name);
+    if (!param) {
+        return g_strdup_printf("ERR unknown parameter %s", name);
+    }
+    GstElement* element = param_element(state, param);
+    if (!element) {
+        return g_strdup_printf("ERR %s filter is not in the pipeline", name);
+    }
+
+    char* endptr = NULL;
+    double value = g_ascii_strtod(value_str, &endptr);
+    if (endptr == value_str || *endptr != '\0') {
+        gst_object_unref(element);
+        return g_strdup_printf("ERR invalid number %s", value_str);
+    }
+
+    // Convert to whatever type the property has and let its param spec check the range
+    GParamSpec* pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), param->property);
+    GValue number = G_VALUE_INIT;
+    GValue converted = G_VALUE_INIT;
+    g_value_init(&number, G_TYPE_DOUBLE);
+    g_value_set_double(&number, value);
+    g_value_init(&converted, pspec->value_type);
+
+    gchar* reply;
+    double max = param_max(element, param);
+    if (!g_value_transform(&number, &converted) || g_param_value_validate(pspec, &converted)) {
+        reply = g_strdup_printf("ERR %s out of range", value_str);
+    } else if (max >= 0.0 && value > max) {
+        reply = g_strdup_printf("ERR %s above %s %g", value_str, param->max_property, max);
+    } else {
+        g_object_set_property(G_OBJECT(element), param->property, &converted);
+        reply = g_strdup("OK");
+    }
+
+    g_value_unset(&number);
+    g_value_unset(&converted);
+    gst_object_unref(element);
+    return reply;
+}
+
+static gchar* command_get(State* state, const char* name) {
+    const ControlParam* param = find_param(name);
+    if (!param) {
+        return g_strdup_printf("ERR unknown parameter %s", name);
+    }
+    GstElement* element = param_element(state, param);
+    if (!element) {
+        return g_strdup_printf("ERR %s filter is not in the pipeline", name);
+    }
+
+    GParamSpec* pspec = g_object_class_find_property(G_OBJECT_GET_CLASS(element), param->property);
+    GValue value = G_VALUE_INIT;
+    GValue number = G_VALUE_INIT;
+    g_value_init(&value, pspec->value_type);
+    g_value_init(&number, G_TYPE_DOUBLE);
+    g_object_get_property(G_OBJECT(element), param->property, &value);
+    g_value_transform(&value, &number);
+
+    gchar* reply = g_strdup_printf("OK %g", g_value_get_double(&number));
+    g_value_unset(&value);
+    g_value_unset(&number);
+    gst_object_unref(element);
+    return reply;
+}
+
+static gchar* command_position(State* state) {
+    gint64 position = -1;
+    gint64 duration = -1;
+    if (!gst_element_query_position(state->pipeline, GST_FORMAT_TIME, &position)) {
+        return g_strdup("ERR position unknown");
+    }
+    gst_element_query_duration(state->pipeline, GST_FORMAT_TIME, &duration);
+    return g_strdup_printf("OK %.3f %.3f", position / (double)GST_SECOND, duration >= 0 ? duration / (double)GST_SECOND : -1.0);
+}
+
+static gchar* command_state(State* state) {
+    GstState current = GST_STATE_NULL;
+    GstState pending = GST_STATE_VOID_PENDING;
+    gst_element_get_state(state->pipeline, &current, &pending, 0);
+    return g_strdup_printf("OK %s", gst_element_state_get_name(current));
+}
+
+static gchar* command_qos(State* state) {
+    if (!state->qos) {
+        return g_strdup("ERR qos not available");
+    }
+    gchar* description = qos_describe(state->qos);
+    gchar* reply = g_strdup_printf("OK %s", description);
+    g_free(description);
+    return reply;
+}
+
+static gchar* command_set_state(State* state, GstState new_state) {
+    if (gst_element_set_state(state->pipeline, new_state) == GST_STATE_CHANGE_FAILURE) {
+        return g_strdup("ERR state change failed");
+    }
+    return g_strdup("OK");
+}
+
+static gchar* command_seek(State* state, const char* position_str, const char* mode_str) {
+    char* endptr = NULL;
+    double seconds = g_ascii_strtod(position_str, &endptr);
+    if (endptr == position_str || *endptr != '\0' || seconds < 0.0) {
+        return g_strdup_printf("ERR invalid position %s", position_str);
+    }
+    SeekMode mode = state->seek_mode;
+    if (mode_str && !settings_parse_seek_mode(mode_str, &mode)) {
+        return g_strdup_printf("ERR unknown seek mode %s", mode_str);
+    }
+    if (!seek_index_seek(state->seek_index, state->pipeline, seconds * GST_SECOND, mode)) {
+        return g_strdup("ERR seek failed");
+    }
+    return g_strdup("OK");
+}
+
+static gchar* command_speed(State* state, const char* rate_str) {
+    char* endptr = NULL;
+    double rate = g_ascii_strtod(rate_str, &endptr);
+    if (endptr == rate_str || *endptr != '\0' || rate == 0.0) {
+        return g_strdup_printf("ERR invalid rate %s", rate_str);
+    }
+    if (!state->rate_control || !rate_control_set(state->rate_control, rate, FALSE)) {
+        return g_strdup("ERR rate change failed");
+    }
+    return g_strdup("OK");
+}
+
+static gchar* command_filter(State* state, const char* name, gboolean is_enabled) {
+    const char* error = live_filter_set_enabled(state, name, is_enabled);
+    if (error) {
+        return g_strdup_printf("ERR %s", error);
+    }
+    return g_strdup("OK");
+}
+
+static gchar* handle_command(Control* control, const char* line) {
+    gchar** args = g_strsplit_set(line, " \t", 3);
+    guint argc = g_strv_length(args);
+    gchar* reply;
+
+    if (argc == 3 && !strcmp(args[0], "set")) {
+        reply = command_set(control->state, args[1], g_strstrip(args[2]));
+    } else if (argc == 2 && !strcmp(args[0], "get")) {
+        reply = command_get(control->state, args[1]);
+    } else if (argc >= 2 && !strcmp(args[0], "seek")) {
+        reply = command_seek(control->state, g_strstrip(args[1]), argc == 3 ? g_strstrip(args[2]) : NULL);
+    } else if (argc == 2 && !strcmp(args[0], "speed")) {
+        reply = command_speed(control->state, g_strstrip(args[1]));
+    } else if (argc == 2 && !strcmp(args[0], "enable")) {
+        reply = command_filter(control->state, g_strstrip(args[1]), TRUE);
+    } else if (argc == 2 && !strcmp(args[0], "disable")) {
+        reply = command_filter(control->state, g_strstrip(args[1]), FALSE);
+    } else if (argc == 1 && !strcmp(args[0], "position")) {
+        reply = command_position(control->state);
+    } else if (argc == 1 && !strcmp(args[0], "state")) {
+        reply = command_state(control->state);
+    } else if (argc == 1 && !strcmp(args[0], "qos")) {
+        reply = command_qos(control->state);
+    } else if (argc == 1 && !strcmp(args[0], "play")) {
+        reply = command_set_state(control->state, GST_STATE_PLAYING);
+    } else if (argc == 1 && !strcmp(args[0], "pause")) {
+        reply = command_set_state(control->state, GST_STATE_PAUSED);
+    } else if (argc == 1 && !strcmp(args[0], "quit")) {
+        // Ends like the media did, so the main loop and render mode finish normally
+        gst_element_send_event(control->state->pipeline, gst_event_new_eos());
+        reply = g_strdup("OK");
+    } else {
+        reply = g_strdup_printf("ERR unknown command %s", line);
+    }
+
+    g_strfreev(args);
+    return reply;
+}
+
+static void remove_client(Control* control, int index) {
+    close(control->clients[index].fd);
+    g_string_free(control->clients[index].buffer, TRUE);
+    control->clients[index] = control->clients[--control->client_count];
+}
+
+// A reply can take several writes once the socket buffer is full. MSG_NOSIGNAL keeps a client
+// that hung up from raising SIGPIPE.
+static gboolean write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+// Returns FALSE when the client is gone
+static gboolean read_client(Control* control, ControlClient* client) {
+    char chunk[CONTROL_MAX_LINE];
+    ssize_t n = read(client->fd, chunk, sizeof(chunk));
+    if (n <= 0) {
+        return n < 0 && errno == EINTR;
+    }
+    g_string_append_len(client->buffer, chunk, n);
+
+    char* newline;
+    while ((newline = memchr(client->buffer->str, '\n', client->buffer->len))) {
+        *newline = '\0';
+        gchar* line = g_strstrip(client->buffer->str);
+        if (*line != '\0') {
+            gchar* reply = handle_command(control, line);
+            gchar* out = g_strconcat(reply, "\n", NULL);
+            if (!write_all(client->fd, out, strlen(out))) {
+                g_free(out);
+                g_free(reply);
+                return FALSE;
+            }
+            g_free(out);
+            g_free(reply);
+        }
+        g_string_erase(client->buffer, 0, newline - client->buffer->str + 1);
+    }
+
+    if (client->buffer->len > CONTROL_MAX_LINE) {
+        return FALSE; // no sane command is that long
+    }
+    return TRUE;
+}
+
+static gpointer control_thread(Control* control) {
+    struct pollfd fds[CONTROL_MAX_CLIENTS + 2];
+
+    while (TRUE) {
+        fds[0].fd = control->wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = control->listen_fd;
+        fds[1].events = POLLIN;
+        for (int i = 0; i < control->client_count; ++i) {
+            fds[i + 2].fd = control->clients[i].fd;
+            fds[i + 2].events = POLLIN;
+        }
+
+        int nfds = control->client_count + 2;
+        if (poll(fds, nfds, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            g_printerr("Control socket poll failed: %s\n", g_strerror(errno));
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+
+        // Walk backwards, remove_client moves the last client into the freed slot
+        for (int i = control->client_count - 1; i >= 0; --i) {
+            if (fds[i + 2].revents && !read_client(control, &control->clients[i])) {
+                remove_client(control, i);
+            }
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int fd = accept(control->listen_fd, NULL, NULL);
+            if (fd < 0) {
+                continue;
+            }
+            if (control->client_count == CONTROL_MAX_CLIENTS) {
+                close(fd);
+                continue;
+            }
+            control->clients[control->client_count].fd = fd;
+            control->clients[control->client_count].buffer = g_string_new(NULL);
+            control->client_count++;
+        }
+    }
+
+    return NULL;
+}
+
+// errno of connecting to addr, 0 if something accepted the connection
+static int connect_error(const struct sockaddr_un* addr) {
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return errno;
+    }
+    int error = connect(fd, (const struct sockaddr*)addr, sizeof(*addr)) < 0 ? errno : 0;
+    close(fd);
+    return error;
+}
+
+Control* control_start(const char* socket_path, State* state) {
+    struct sockaddr_un addr = {0};
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        g_printerr("Control socket path is too long\n");
+        return NULL;
+    }
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, socket_path);
+
+    // A stale socket file from a previous run would make bind fail, anything else at the path is
+    // not ours to remove. A socket someone still listens on belongs to a running player.
+    struct stat st;
+    if (lstat(socket_path, &st) == 0) {
+        if (!S_ISSOCK(st.st_mode)) {
+            g_printerr("%s exists and is not a socket\n", socket_path);
+            return NULL;
+        }
+        int error = connect_error(&addr);
+        if (error == 0) {
+            g_printerr("%s is already in use by another instance\n", socket_path);
+            return NULL;
+        }
+        if (error != ECONNREFUSED && error != ENOENT) {
+            g_printerr("Could not check %s: %s\n", socket_path, g_strerror(error));
+            return NULL;
+        }
+        unlink(socket_path);
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        g_printerr("Could not create control socket: %s\n", g_strerror(errno));
+        return NULL;
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, CONTROL_MAX_CLIENTS) < 0) {
+        g_printerr("Could not listen on %s: %s\n", socket_path, g_strerror(errno));
+        close(fd);
+        return NULL;
+    }
+
+    Control* control = g_new0(Control, 1);
+    control->state = state;
+    control->socket_path = g_strdup(socket_path);
+    control->listen_fd = fd;
+    if (pipe(control->wake_pipe) < 0) {
+        g_printerr("Could not create control wake pipe\n");
+        close(fd);
+        g_free(control->socket_path);
+        g_free(control);
+        return NULL;
+    }
+
+    control->thread = g_thread_new("control", (GThreadFunc)control_thread, control);
+    return control;
+}
+
+void control_stop(Control* control) {
+    if (!control) {
+        return;
+    }
+
+    char byte = 0;
+    if (write(control->wake_pipe[1], &byte, 1) < 0) {
+        g_printerr("Could not wake control thread\n");
+    }
+    g_thread_join(control->thread);
+
+    while (control->client_count > 0) {
+        remove_client(control, control->client_count - 1);
+    }
+    close(control->listen_fd);
+    close(control->wake_pipe[0]);
+    close(control->wake_pipe[1]);
+    unlink(control->socket_path);
+    g_free(control->socket_path);
+    g_free(control);
+}
@@ -0,0 +1,24 @@
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include "state.h"
+
+// Unix-domain control socket with a line protocol, served from its own thread.
+// Every request is one line, every reply is one line starting with OK or ERR:
+//   set <param> <value>   change a live filter parameter (volume, balance, cutoff, ...)
+//   get <param>           current value of a filter parameter
+//   seek <seconds> [mode] accurate, keyframe or fast, the --seek-mode if not given
+//   speed <rate>          playback rate, instant when the pipeline supports it
+//   enable <filter>       put echo, pass, noise or videobalance into the running chain
+//   disable <filter>      take it out again, its parameters are kept for the next enable
+//   position              OK <position seconds> <duration seconds>
+//   state                 OK <PLAYING|PAUSED|...>
+//   qos                   OK level <n> processed <frames> dropped <frames> late <count>
+//   play | pause          change pipeline state
+//   quit                  send EOS, the player exits like at the end of the media
+typedef struct Control Control;
+
+Control* control_start(const char* socket_path, State* state);
+void control_stop(Control* control);
+
+#endif
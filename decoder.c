@@ -0,0 +1,111 @@
+#include "decoder.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <string.h>
+
+typedef struct DecoderSetup {
+    gint threads; // -1 keeps the decoder default
+    gchar* skip_frame; // null keeps the decoder default
+    gboolean is_low_latency;
+} DecoderSetup;
+
+#define DECODER_SETUP_KEY "decoder-setup"
+
+// Thread count properties, the first one a decoder has is used
+static const char* thread_properties[] = {"max-threads", "n-threads", "threads"};
+
+typedef struct PropertyValue {
+    const char* property;
+    const char* value;
+} PropertyValue;
+
+// Frame threading holds back as many frames as there are threads, all of these that exist are set
+static const PropertyValue low_latency_values[] = {
+    {"thread-type", "slice"},
+    {"max-frame-delay", "1"},
+    {"low-latency", "true"},
+};
+
+static void decoder_setup_free(DecoderSetup* setup) {
+    g_free(setup->skip_frame);
+    g_free(setup);
+}
+
+static gboolean has_property(GstElement* element, const char* name) {
+    return g_object_class_find_property(G_OBJECT_GET_CLASS(element), name) != NULL;
+}
+
+static void set_logged(GstElement* element, const char* property, const char* value, GString* log) {
+    gst_util_set_object_arg(G_OBJECT(element), property, value);
+    g_string_append_printf(log, " %s=%s", property, value);
+}
+
+static void configure_decoder(GstElement* decoder, const gchar* klass, DecoderSetup* setup) {
+    GString* log = g_string_new(NULL);
+
+    if (setup->threads >= 0) {
+        for (int i = 0; i < ARRAY_SIZE(thread_properties); ++i) {
+            if (has_property(decoder, thread_properties[i])) {
+                gchar* value = g_strdup_printf("%d", setup->threads);
+                set_logged(decoder, thread_properties[i], value, log);
+                g_free(value);
+                break;
+            }
+        }
+    }
+    if (setup->skip_frame && has_property(decoder, "skip-frame")) {
+        set_logged(decoder, "skip-frame", setup->skip_frame, log);
+    }
+    if (setup->is_low_latency) {
+        for (int i = 0; i < ARRAY_SIZE(low_latency_values); ++i) {
+            if (has_property(decoder, low_latency_values[i].property)) {
+                set_logged(decoder, low_latency_values[i].property, low_latency_values[i].value, log);
+            }
+        }
+    }
+
+    GstElementFactory* factory = gst_element_get_factory(decoder);
+    g_print("Decoder %s (%s)%s%s\n", GST_OBJECT_NAME(factory), klass, log->len ? ":" : "", log->str);
+    g_string_free(log, TRUE);
+}
+
+// Streaming thread of the demuxer or typefinder, before the decoder changes state
+static void deep_element_added_signal(GstBin* bin, GstBin* sub_bin, GstElement* element, DecoderSetup* setup) {
+    GstElementFactory* factory = gst_element_get_factory(element);
+    const gchar* klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+    if (klass && strstr(klass, "Decoder")) {
+        configure_decoder(element, klass, setup);
+    }
+}
+
+static void attach(GstElement* uridecodebin, DecoderSetup* setup) {
+    g_object_set_data_full(G_OBJECT(uridecodebin), DECODER_SETUP_KEY, setup, (GDestroyNotify)decoder_setup_free);
+    g_signal_connect(uridecodebin, "deep-element-added", G_CALLBACK(deep_element_added_signal), setup);
+}
+
+void decoder_setup_attach(GstElement* uridecodebin, Settings* settings) {
+    DecoderSetup* setup = g_new0(DecoderSetup, 1);
+    setup->threads = settings->decoder_threads;
+    setup->skip_frame = g_strdup(settings->decoder_skip_frame);
+    setup->is_low_latency = settings->is_decoder_low_latency;
+    attach(uridecodebin, setup);
+}
+
+void decoder_setup_attach_like(GstElement* uridecodebin, GstElement* configured) {
+    DecoderSetup* configured_setup = g_object_get_data(G_OBJECT(configured), DECODER_SETUP_KEY);
+    if (!configured_setup) {
+        return;
+    }
+    DecoderSetup* setup = g_new0(DecoderSetup, 1);
+    setup->threads = configured_setup->threads;
+    setup->skip_frame = g_strdup(configured_setup->skip_frame);
+    setup->is_low_latency = configured_setup->is_low_latency;
+    attach(uridecodebin, setup);
+}
+
+void decoder_setup_converter(GstElement* converter, Settings* settings) {
+    // n-threads is there since GStreamer 1.14
+    if (converter && settings->convert_threads >= 0 && has_property(converter, "n-threads")) {
+        g_object_set(converter, "n-threads", (guint)settings->convert_threads, NULL);
+    }
+}
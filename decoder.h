@@ -0,0 +1,23 @@
+#ifndef __DECODER_H
+#define __DECODER_H
+
+#include "gst/gstelement.h"
+#include "settings.h"
+
+// Threading and latency of the decoders uridecodebin plugs. Every decoder that gets added to it
+// (through decodebin, at any depth) is logged and gets whatever of these it has a property for:
+//   threads       max-threads (avdec_*), n-threads (dav1ddec) or threads (vpxdec, ...)
+//   skip-frame    passed as given, e.g. "1" or "bidir" for avdec_* to skip B-frames
+//   low latency   slice instead of frame threading (avdec_*), one frame of delay (dav1ddec),
+//                 or low-latency where a decoder has it
+// Options the decoder does not have are left out of the log line.
+
+// Call once on the uridecodebin, before it gets its uri. Copies what it needs from settings.
+void decoder_setup_attach(GstElement* uridecodebin, Settings* settings);
+// Same setup as configured, for later sources of a playlist
+void decoder_setup_attach_like(GstElement* uridecodebin, GstElement* configured);
+
+// n-threads on a videoconvert or videoscale, from settings->convert_threads
+void decoder_setup_converter(GstElement* converter, Settings* settings);
+
+#endif
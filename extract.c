@@ -0,0 +1,317 @@
+#include "extract.h"
+#include "state.h"
+#include "waveform.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/video/video.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define EXTRACT_STATE_TIMEOUT (10 * GST_SECOND) // for preroll and every seek
+#define EXTRACT_ENCODE_TIMEOUT (10 * GST_SECOND)
+#define EXTRACT_KEY_LENGTH 16 // hex digits of the path checksum in output names
+#define EXTRACT_SHEET_GROUP "sheet"
+
+typedef struct ThumbnailSheet {
+    GstVideoInfo tile; // of the first thumbnail, the others are scaled the same
+    guint count;
+    guint capacity;
+    guint8* pixels; // RGB, capacity tiles laid out in EXTRACT_SHEET_COLUMNS columns
+    gsize stride;
+} ThumbnailSheet;
+
+// ---------------------------------------------------------------------------
+// Thumbnails
+// ---------------------------------------------------------------------------
+
+static void pad_added_signal(GstElement* source, GstPad* pad, GstElement* head) {
+    GstPad* head_pad = gst_element_get_static_pad(head, "sink");
+    if (!gst_pad_is_linked(head_pad)) {
+        gst_pad_link(pad, head_pad);
+    }
+    gst_object_unref(head_pad);
+}
+
+// ASYNC_DONE after preroll or a flushing seek, FALSE on an error or when nothing prerolled in time
+static gboolean wait_async_done(GstBus* bus) {
+    GstMessage* message = gst_bus_timed_pop_filtered(bus, EXTRACT_STATE_TIMEOUT, GST_MESSAGE_ASYNC_DONE | GST_MESSAGE_ERROR);
+    gboolean is_done = message && GST_MESSAGE_TYPE(message) == GST_MESSAGE_ASYNC_DONE;
+    if (message) {
+        gst_message_unref(message);
+    }
+    return is_done;
+}
+
+static void add_tile(ThumbnailSheet* sheet, GstSample* sample) {
+    GstVideoInfo info;
+    if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample))) {
+        return;
+    }
+    if (sheet->count == 0) {
+        sheet->tile = info;
+        sheet->stride = GST_ROUND_UP_4(EXTRACT_SHEET_COLUMNS * GST_VIDEO_INFO_WIDTH(&info) * 3);
+    } else if (GST_VIDEO_INFO_WIDTH(&info) != GST_VIDEO_INFO_WIDTH(&sheet->tile)
+               || GST_VIDEO_INFO_HEIGHT(&info) != GST_VIDEO_INFO_HEIGHT(&sheet->tile)) {
+        return; // the stream changed its size on the way, such a tile would not fit
+    }
+
+    GstVideoFrame frame;
+    if (!gst_video_frame_map(&frame, &info, gst_sample_get_buffer(sample), GST_MAP_READ)) {
+        return;
+    }
+    guint width = GST_VIDEO_INFO_WIDTH(&info);
+    guint height = GST_VIDEO_INFO_HEIGHT(&info);
+    guint column = sheet->count % EXTRACT_SHEET_COLUMNS;
+    guint row = sheet->count / EXTRACT_SHEET_COLUMNS;
+    for (guint y = 0; y < height; ++y) {
+        const guint8* line = (const guint8*)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0) + y * GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0);
+        guint8* target = sheet->pixels + (row * height + y) * sheet->stride + column * width * 3;
+        memcpy(target, line, width * 3);
+    }
+    gst_video_frame_unmap(&frame);
+    sheet->count++;
+}
+
+static gsize write_sheet(ThumbnailSheet* sheet, const char* path) {
+    guint width = GST_VIDEO_INFO_WIDTH(&sheet->tile);
+    guint height = GST_VIDEO_INFO_HEIGHT(&sheet->tile);
+    guint rows = (sheet->count + EXTRACT_SHEET_COLUMNS - 1) / EXTRACT_SHEET_COLUMNS;
+    gsize size = rows * height * sheet->stride;
+
+    // Full rows keep their stride, a last row with fewer tiles stays black on the right
+    GstBuffer* buffer = gst_buffer_new_allocate(NULL, size, NULL);
+    gst_buffer_fill(buffer, 0, sheet->pixels, size);
+    GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB",
+                                        "width", G_TYPE_INT, EXTRACT_SHEET_COLUMNS * width, "height", G_TYPE_INT, rows * height,
+                                        "framerate", GST_TYPE_FRACTION, 0, 1, NULL);
+    GstSample* sample = gst_sample_new(buffer, caps, NULL, NULL);
+    GstCaps* jpeg_caps = gst_caps_new_empty_simple("image/jpeg");
+    GError* err = NULL;
+    GstSample* jpeg = gst_video_convert_sample(sample, jpeg_caps, EXTRACT_ENCODE_TIMEOUT, &err);
+    gst_caps_unref(jpeg_caps);
+    gst_sample_unref(sample);
+    gst_caps_unref(caps);
+    gst_buffer_unref(buffer);
+    if (!jpeg) {
+        g_printerr("Could not encode thumbnails: %s\n", err ? err->message : "timeout");
+        g_clear_error(&err);
+        return 0;
+    }
+
+    gsize written = 0;
+    GstMapInfo map;
+    GstBuffer* jpeg_buffer = gst_sample_get_buffer(jpeg);
+    if (gst_buffer_map(jpeg_buffer, &map, GST_MAP_READ)) {
+        if (g_file_set_contents(path, (const gchar*)map.data, map.size, &err)) {
+            written = map.size;
+        } else {
+            g_printerr("Could not write %s: %s\n", path, err->message);
+            g_clear_error(&err);
+        }
+        gst_buffer_unmap(jpeg_buffer, &map);
+    }
+    gst_sample_unref(jpeg);
+    return written;
+}
+
+static guint extract_thumbnails(Settings* settings, const char* uri, const char* path, gint64* duration, gsize* written) {
+    GstElement* pipeline = gst_pipeline_new("thumbnail-pipeline");
+    GstElement* source = gst_element_factory_make("uridecodebin", NULL);
+    GstElement* converter = gst_element_factory_make("videoconvert", NULL);
+    GstElement* scale = gst_element_factory_make("videoscale", NULL);
+    GstElement* size_filter = gst_element_factory_make("capsfilter", NULL);
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    if (!source || !converter || !scale || !size_filter || !sink) {
+        g_printerr("Could not create thumbnail elements\n");
+        gst_object_unref(pipeline);
+        return 0;
+    }
+
+    // Square pixels at the tile width, videoscale picks the height from the display aspect ratio
+    GstCaps* caps = gst_caps_new_simple("video/x-raw", "format", G_TYPE_STRING, "RGB", "width", G_TYPE_INT, settings->thumbnail_width,
+                                        "pixel-aspect-ratio", GST_TYPE_FRACTION, 1, 1, NULL);
+    g_object_set(size_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    g_object_set(sink, "sync", FALSE, "enable-last-sample", TRUE, NULL);
+    g_object_set(source, "uri", uri, NULL);
+    state_restrict_to_video(source);
+    gst_bin_add_many(GST_BIN(pipeline), source, converter, scale, size_filter, sink, NULL);
+    gst_element_link_many(converter, scale, size_filter, sink, NULL);
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_signal), converter);
+
+    guint count = 0;
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_element_set_state(pipeline, GST_STATE_PAUSED);
+    // Audio only media never prerolls the video sink
+    GstPad* converter_pad = gst_element_get_static_pad(converter, "sink");
+    gboolean has_video = wait_async_done(bus) && gst_pad_is_linked(converter_pad);
+    gst_object_unref(converter_pad);
+    if (has_video && gst_element_query_duration(pipeline, GST_FORMAT_TIME, duration) && *duration > 0) {
+        GstClockTime interval = settings->thumbnail_interval;
+        ThumbnailSheet sheet = {0};
+        sheet.capacity = (*duration + interval - 1) / interval;
+
+        for (GstClockTime position = 0; position < (GstClockTime)*duration; position += interval) {
+            // Decoders that honor TRICKMODE_KEY_UNITS drop every frame but the keyframe seeked to
+            GstSeekFlags flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE
+                | GST_SEEK_FLAG_TRICKMODE | GST_SEEK_FLAG_TRICKMODE_KEY_UNITS;
+            if (!gst_element_seek_simple(pipeline, GST_FORMAT_TIME, flags, position) || !wait_async_done(bus)) {
+                break;
+            }
+            GstSample* sample = NULL;
+            g_object_get(sink, "last-sample", &sample, NULL);
+            if (!sample) {
+                break;
+            }
+            if (!sheet.pixels) {
+                GstVideoInfo info;
+                if (!gst_video_info_from_caps(&info, gst_sample_get_caps(sample))) {
+                    gst_sample_unref(sample);
+                    break;
+                }
+                gsize stride = GST_ROUND_UP_4(EXTRACT_SHEET_COLUMNS * GST_VIDEO_INFO_WIDTH(&info) * 3);
+                guint rows = (sheet.capacity + EXTRACT_SHEET_COLUMNS - 1) / EXTRACT_SHEET_COLUMNS;
+                sheet.pixels = g_malloc0(rows * GST_VIDEO_INFO_HEIGHT(&info) * stride);
+            }
+            if (sheet.count < sheet.capacity) {
+                add_tile(&sheet, sample);
+            }
+            gst_sample_unref(sample);
+        }
+
+        if (sheet.count) {
+            *written = write_sheet(&sheet, path);
+            count = *written ? sheet.count : 0;
+        }
+        g_free(sheet.pixels);
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+    return count;
+}
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+// <dir>/<name>-<key>, the key tells files with the same name in different directories apart
+static gchar* make_output_base(const char* dir, const char* media_path) {
+    gchar* name = g_path_get_basename(media_path);
+    char* dot = strrchr(name, '.');
+    if (dot && dot != name) {
+        *dot = '\0';
+    }
+    gchar* key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, media_path, -1);
+    key[EXTRACT_KEY_LENGTH] = '\0';
+    gchar* file_name = g_strconcat(name, "-", key, NULL);
+    gchar* base = g_build_filename(dir, file_name, NULL);
+    g_free(file_name);
+    g_free(key);
+    g_free(name);
+    return base;
+}
+
+// The sheet is kept while its info file still names the media's size and modification time and
+// the thumbnail settings it was made with
+static gboolean is_sheet_up_to_date(Settings* settings, const char* sheet_path, const char* info_path, const char* media_path) {
+    GStatBuf media;
+    if (!g_file_test(sheet_path, G_FILE_TEST_IS_REGULAR) || g_stat(media_path, &media) != 0) {
+        return FALSE;
+    }
+    GKeyFile* file = g_key_file_new();
+    GError* err = NULL;
+    gboolean is_ok = g_key_file_load_from_file(file, info_path, G_KEY_FILE_NONE, NULL);
+    if (is_ok) {
+        gint64 size = g_key_file_get_int64(file, EXTRACT_SHEET_GROUP, "size", &err);
+        gint64 mtime = err ? 0 : g_key_file_get_int64(file, EXTRACT_SHEET_GROUP, "mtime", &err);
+        gint64 interval = err ? 0 : g_key_file_get_int64(file, EXTRACT_SHEET_GROUP, "interval", &err);
+        gint64 width = err ? 0 : g_key_file_get_int64(file, EXTRACT_SHEET_GROUP, "width", &err);
+        is_ok = err == NULL && size == (gint64)media.st_size && mtime == (gint64)media.st_mtime
+            && interval == (gint64)settings->thumbnail_interval && width == (gint64)settings->thumbnail_width;
+        g_clear_error(&err);
+    }
+    g_key_file_free(file);
+    return is_ok;
+}
+
+// media is taken before the thumbnails, so a file that changed meanwhile gets extracted again
+static void save_sheet_info(Settings* settings, const char* info_path, const GStatBuf* media) {
+    GKeyFile* file = g_key_file_new();
+    g_key_file_set_int64(file, EXTRACT_SHEET_GROUP, "size", media->st_size);
+    g_key_file_set_int64(file, EXTRACT_SHEET_GROUP, "mtime", media->st_mtime);
+    g_key_file_set_int64(file, EXTRACT_SHEET_GROUP, "interval", settings->thumbnail_interval);
+    g_key_file_set_int64(file, EXTRACT_SHEET_GROUP, "width", settings->thumbnail_width);
+    GError* err = NULL;
+    if (!g_key_file_save_to_file(file, info_path, &err)) {
+        g_printerr("Could not write %s: %s\n", info_path, err->message);
+        g_clear_error(&err);
+    }
+    g_key_file_free(file);
+}
+
+gboolean extract_media(Settings* settings, const char* uri, ExtractResult* result, gchar** error) {
+    memset(result, 0, sizeof(*result));
+    result->duration = -1;
+    gchar* media_path = g_filename_from_uri(uri, NULL, NULL);
+    if (!media_path) {
+        *error = g_strdup("not a local file");
+        return FALSE;
+    }
+    if (g_mkdir_with_parents(settings->extract_dir, 0755) != 0) {
+        *error = g_strdup_printf("could not create %s", settings->extract_dir);
+        g_free(media_path);
+        return FALSE;
+    }
+
+    gchar* base = make_output_base(settings->extract_dir, media_path);
+    gchar* sheet_path = g_strconcat(base, ".jpg", NULL);
+    gchar* info_path = g_strconcat(base, ".jpg.info", NULL);
+    gchar* peaks_path = g_strconcat(base, ".peaks", NULL);
+
+    WaveformPeaks* peaks = waveform_peaks_open(peaks_path, media_path);
+    if (peaks) {
+        // Reused as is, only mapped to check that it fits
+        result->has_waveform = TRUE;
+        guint32 samples_per_bin;
+        guint32 bin_count;
+        waveform_peaks_level(peaks, 0, &samples_per_bin, &bin_count);
+        result->duration = gst_util_uint64_scale((guint64)samples_per_bin * bin_count, GST_SECOND, waveform_peaks_rate(peaks));
+        waveform_peaks_free(peaks);
+    } else if (waveform_build(uri, peaks_path, &result->duration)) {
+        result->has_waveform = TRUE;
+        GStatBuf st;
+        if (g_stat(peaks_path, &st) == 0) {
+            result->bytes_written += st.st_size;
+        }
+    }
+
+    if (!is_sheet_up_to_date(settings, sheet_path, info_path, media_path)) {
+        GStatBuf media;
+        gboolean has_stat = g_stat(media_path, &media) == 0;
+        gint64 video_duration = -1;
+        gsize written = 0;
+        result->thumbnails = extract_thumbnails(settings, uri, sheet_path, &video_duration, &written);
+        result->has_thumbnails = result->thumbnails > 0;
+        if (result->has_thumbnails && has_stat) {
+            save_sheet_info(settings, info_path, &media);
+        }
+        result->bytes_written += written;
+        if (result->duration < 0) {
+            result->duration = video_duration;
+        }
+    } else {
+        result->has_thumbnails = TRUE;
+    }
+
+    gboolean is_ok = result->has_waveform || result->has_thumbnails;
+    if (!is_ok) {
+        *error = g_strdup("no audio or video could be extracted");
+    }
+    g_free(peaks_path);
+    g_free(info_path);
+    g_free(sheet_path);
+    g_free(base);
+    g_free(media_path);
+    return is_ok;
+}
@@ -0,0 +1,31 @@
+#ifndef __EXTRACT_H
+#define __EXTRACT_H
+
+#include "settings.h"
+
+// Extraction mode (--extract <dir>): instead of playing, a local file gets
+//   <dir>/<name>-<key>.jpg       thumbnail sheet, EXTRACT_SHEET_COLUMNS tiles per row, tile i
+//                                shows the keyframe at or before i * settings->thumbnail_interval
+//   <dir>/<name>-<key>.jpg.info  size and mtime of the file and the thumbnail settings of the sheet
+//   <dir>/<name>-<key>.peaks     waveform peaks, see waveform.h
+// where <name> is the file name without its extension and <key> the start of the SHA256 of its
+// absolute path, so clip.mp4 and clip.mkv, or clip.mp4 in two directories, get their own
+// outputs. Outputs that still match the file are kept, so a library can be extracted again and
+// only new or changed files get decoded. Every output is written to a temporary file and renamed.
+//
+// Thumbnails come from a paused video-only pipeline that seeks from keyframe to keyframe with
+// TRICKMODE_KEY_UNITS, so decoders that support it decode nothing but the keyframes.
+#define EXTRACT_SHEET_COLUMNS 10
+
+typedef struct ExtractResult {
+    gint64 duration; // -1 if unknown
+    gint64 bytes_written; // 0 when everything was up to date
+    guint thumbnails; // made by this run, 0 when the sheet was kept
+    gboolean has_thumbnails;
+    gboolean has_waveform;
+} ExtractResult;
+
+// FALSE with error set (g_free it) when neither output could be made
+gboolean extract_media(Settings* settings, const char* uri, ExtractResult* result, gchar** error);
+
+#endif
@@ -0,0 +1,464 @@
+#include "fusedaudio.h"
+#include "glib.h"
+#include "settings.h"
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <gst/audio/gstaudiofilter.h>
+#include <math.h>
+#include <string.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+// AVX kernels are built whatever the compiler flags and picked at class init when the cpu has AVX
+#define FUSED_AVX __attribute__((target("avx")))
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#define FUSED_MAX_CHANNELS 8
+#define FUSED_BLOCK_FRAMES 256 // a block of 8 channels stays in L1 while all stages run over it
+#define FUSED_BIQUAD_STAGES 2 // two cascaded biquads, 24 dB/octave like audiocheblimit with 4 poles
+
+typedef struct Biquad {
+    float b0, b1, b2, a1, a2;
+} Biquad;
+
+typedef struct FusedAudio {
+    GstAudioFilter parent;
+
+    // Properties, guarded by the object lock
+    double volume;
+    float panorama;
+    gint mode; // PassType
+    float cutoff;
+    guint64 delay;
+    guint64 max_delay;
+    float feedback;
+    float intensity;
+    gboolean is_dirty; // gains or coefficients need to be recomputed
+
+    // Streaming thread only
+    guint channels;
+    guint rate;
+    float gains[FUSED_MAX_CHANNELS];
+    Biquad biquads[FUSED_BIQUAD_STAGES];
+    float biquad_state[FUSED_MAX_CHANNELS][FUSED_BIQUAD_STAGES][2];
+    float* echo_ring; // interleaved history, echo_length samples
+    guint echo_length;
+    guint echo_write;
+    guint echo_delay; // in samples
+    float echo_feedback;
+    float echo_intensity;
+    gint pass_mode;
+} FusedAudio;
+
+typedef struct FusedAudioClass {
+    GstAudioFilterClass parent_class;
+} FusedAudioClass;
+
+enum {
+    PROP_0,
+    PROP_VOLUME,
+    PROP_PANORAMA,
+    PROP_MODE,
+    PROP_CUTOFF,
+    PROP_DELAY,
+    PROP_MAX_DELAY,
+    PROP_FEEDBACK,
+    PROP_INTENSITY,
+};
+
+#define FUSED_AUDIO(obj) ((FusedAudio*)(obj))
+
+G_DEFINE_TYPE(FusedAudio, fused_audio, GST_TYPE_AUDIO_FILTER)
+
+// ---------------------------------------------------------------------------
+// Kernels
+// ---------------------------------------------------------------------------
+
+#if defined(FUSED_AVX)
+static gboolean has_avx = FALSE;
+
+// Whole vectors of kernel_gain, returns the samples done
+FUSED_AVX static guint gain_avx(float* samples, guint count, const float* gains, guint channels) {
+    guint i = 0;
+    if (8 % channels == 0) {
+        __m256 g = _mm256_setr_ps(gains[0], gains[1 % channels], gains[2 % channels], gains[3 % channels],
+                                  gains[4 % channels], gains[5 % channels], gains[6 % channels], gains[7 % channels]);
+        for (; i + 8 <= count; i += 8) {
+            _mm256_storeu_ps(samples + i, _mm256_mul_ps(_mm256_loadu_ps(samples + i), g));
+        }
+    }
+    return i;
+}
+
+// Whole vectors of kernel_echo, returns the samples done
+FUSED_AVX static guint echo_avx(float* samples, const float* echo, float* history, guint count, float intensity, float feedback) {
+    guint i = 0;
+    __m256 vi = _mm256_set1_ps(intensity);
+    __m256 vf = _mm256_set1_ps(feedback);
+    for (; i + 8 <= count; i += 8) {
+        __m256 in = _mm256_loadu_ps(samples + i);
+        __m256 e = _mm256_loadu_ps(echo + i);
+        _mm256_storeu_ps(samples + i, _mm256_add_ps(in, _mm256_mul_ps(vi, e)));
+        _mm256_storeu_ps(history + i, _mm256_add_ps(in, _mm256_mul_ps(vf, e)));
+    }
+    return i;
+}
+#endif
+
+// samples *= gains[i % channels], count is a multiple of channels
+static void kernel_gain(float* samples, guint count, const float* gains, guint channels) {
+    guint i = 0;
+#if defined(FUSED_AVX)
+    if (has_avx) {
+        i = gain_avx(samples, count, gains, channels);
+    }
+#endif
+#if defined(__SSE__)
+    if (4 % channels == 0) {
+        __m128 g = _mm_setr_ps(gains[0], gains[1 % channels], gains[2 % channels], gains[3 % channels]);
+        for (; i + 4 <= count; i += 4) {
+            _mm_storeu_ps(samples + i, _mm_mul_ps(_mm_loadu_ps(samples + i), g));
+        }
+    }
+#elif defined(__ARM_NEON)
+    if (4 % channels == 0) {
+        float pattern[4] = {gains[0], gains[1 % channels], gains[2 % channels], gains[3 % channels]};
+        float32x4_t g = vld1q_f32(pattern);
+        for (; i + 4 <= count; i += 4) {
+            vst1q_f32(samples + i, vmulq_f32(vld1q_f32(samples + i), g));
+        }
+    }
+#endif
+    // Vector loops stop on a frame boundary, so i % channels is still the channel here
+    for (; i < count; ++i) {
+        samples[i] *= gains[i % channels];
+    }
+}
+
+// out = in + intensity * echo, history = in + feedback * echo; history never overlaps echo
+static void kernel_echo(float* samples, const float* echo, float* history, guint count, float intensity, float feedback) {
+    guint i = 0;
+#if defined(FUSED_AVX)
+    if (has_avx) {
+        i = echo_avx(samples, echo, history, count, intensity, feedback);
+    }
+#endif
+#if defined(__SSE__)
+    __m128 vi = _mm_set1_ps(intensity);
+    __m128 vf = _mm_set1_ps(feedback);
+    for (; i + 4 <= count; i += 4) {
+        __m128 in = _mm_loadu_ps(samples + i);
+        __m128 e = _mm_loadu_ps(echo + i);
+        _mm_storeu_ps(samples + i, _mm_add_ps(in, _mm_mul_ps(vi, e)));
+        _mm_storeu_ps(history + i, _mm_add_ps(in, _mm_mul_ps(vf, e)));
+    }
+#elif defined(__ARM_NEON)
+    float32x4_t vi = vdupq_n_f32(intensity);
+    float32x4_t vf = vdupq_n_f32(feedback);
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t in = vld1q_f32(samples + i);
+        float32x4_t e = vld1q_f32(echo + i);
+        vst1q_f32(samples + i, vmlaq_f32(in, vi, e));
+        vst1q_f32(history + i, vmlaq_f32(in, vf, e));
+    }
+#endif
+    for (; i < count; ++i) {
+        float in = samples[i];
+        float e = echo[i];
+        samples[i] = in + intensity * e;
+        history[i] = in + feedback * e;
+    }
+}
+
+// The biquads are recursive in time, so they run per frame with all channels of the frame together
+static void kernel_biquads(FusedAudio* self, float* samples, guint frames) {
+    guint channels = self->channels;
+    for (guint f = 0; f < frames; ++f) {
+        float* frame = samples + f * channels;
+        for (guint c = 0; c < channels; ++c) {
+            float x = frame[c];
+            for (int s = 0; s < FUSED_BIQUAD_STAGES; ++s) {
+                const Biquad* q = &self->biquads[s];
+                float* z = self->biquad_state[c][s];
+                // transposed direct form II
+                float y = q->b0 * x + z[0];
+                z[0] = q->b1 * x - q->a1 * y + z[1];
+                z[1] = q->b2 * x - q->a2 * y;
+                x = y;
+            }
+            frame[c] = x;
+        }
+    }
+}
+
+static void process_echo(FusedAudio* self, float* samples, guint count) {
+    while (count > 0) {
+        guint read = (self->echo_write + self->echo_length - self->echo_delay) % self->echo_length;
+        // Largest run where neither index wraps and the written samples are not read again in the same run
+        guint n = MIN(count, self->echo_length - self->echo_write);
+        n = MIN(n, self->echo_length - read);
+        n = MIN(n, self->echo_delay);
+
+        kernel_echo(samples, self->echo_ring + read, self->echo_ring + self->echo_write, n, self->echo_intensity, self->echo_feedback);
+
+        samples += n;
+        count -= n;
+        self->echo_write = (self->echo_write + n) % self->echo_length;
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Parameters
+// ---------------------------------------------------------------------------
+
+static void compute_biquads(FusedAudio* self, gint mode, float cutoff) {
+    // Butterworth Q values of a 4th order filter split into two biquads
+    static const double q_values[FUSED_BIQUAD_STAGES] = {0.54119610, 1.30656296};
+    double frequency = CLAMP(cutoff, 10.0, self->rate * 0.49);
+    double w0 = 2.0 * G_PI * frequency / self->rate;
+    double cosw = cos(w0);
+
+    for (int s = 0; s < FUSED_BIQUAD_STAGES; ++s) {
+        double alpha = sin(w0) / (2.0 * q_values[s]);
+        double a0 = 1.0 + alpha;
+        double b0, b1;
+        if (mode == PassLow) {
+            b0 = (1.0 - cosw) / 2.0;
+            b1 = 1.0 - cosw;
+        } else {
+            b0 = (1.0 + cosw) / 2.0;
+            b1 = -(1.0 + cosw);
+        }
+        self->biquads[s].b0 = b0 / a0;
+        self->biquads[s].b1 = b1 / a0;
+        self->biquads[s].b2 = b0 / a0;
+        self->biquads[s].a1 = -2.0 * cosw / a0;
+        self->biquads[s].a2 = (1.0 - alpha) / a0;
+    }
+}
+
+// Copies the properties into the streaming state, called with the object lock held
+static void update_parameters(FusedAudio* self) {
+    for (guint c = 0; c < self->channels; ++c) {
+        self->gains[c] = self->volume;
+    }
+    // Balance attenuates the opposite side like audiopanorama's simple method, stereo only
+    if (self->channels == 2) {
+        if (self->panorama > 0.0f) {
+            self->gains[0] *= 1.0f - self->panorama;
+        } else {
+            self->gains[1] *= 1.0f + self->panorama;
+        }
+    }
+
+    guint64 delay = MIN(self->delay, self->max_delay);
+    self->echo_delay = MAX(1, gst_util_uint64_scale(delay, self->rate, GST_SECOND)) * self->channels;
+    self->echo_delay = MIN(self->echo_delay, self->echo_length);
+    self->echo_feedback = self->feedback;
+    self->echo_intensity = self->intensity;
+
+    if (self->mode != self->pass_mode) {
+        memset(self->biquad_state, 0, sizeof(self->biquad_state));
+    }
+    self->pass_mode = self->mode;
+    if (self->pass_mode != PassNone) {
+        compute_biquads(self, self->pass_mode, self->cutoff);
+    }
+
+    self->is_dirty = FALSE;
+}
+
+static void update_passthrough(FusedAudio* self) {
+    gboolean is_identity = self->volume == 1.0 && self->panorama == 0.0f && self->mode == PassNone && self->intensity == 0.0f;
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(self), is_identity);
+}
+
+// ---------------------------------------------------------------------------
+// GstBaseTransform / GstAudioFilter
+// ---------------------------------------------------------------------------
+
+static gboolean fused_audio_setup(GstAudioFilter* filter, const GstAudioInfo* info) {
+    FusedAudio* self = FUSED_AUDIO(filter);
+
+    GST_OBJECT_LOCK(self);
+    self->channels = GST_AUDIO_INFO_CHANNELS(info);
+    self->rate = GST_AUDIO_INFO_RATE(info);
+
+    // The history covers max-delay, like audioecho the delay can't grow past it while running
+    g_free(self->echo_ring);
+    guint64 max_delay = MAX(self->max_delay, self->delay);
+    self->max_delay = max_delay;
+    self->echo_length = (gst_util_uint64_scale(max_delay, self->rate, GST_SECOND) + 1) * self->channels;
+    self->echo_ring = g_new0(float, self->echo_length);
+    self->echo_write = 0;
+    memset(self->biquad_state, 0, sizeof(self->biquad_state));
+    self->pass_mode = PassNone;
+    update_parameters(self);
+    GST_OBJECT_UNLOCK(self);
+    return TRUE;
+}
+
+static GstFlowReturn fused_audio_transform_ip(GstBaseTransform* base, GstBuffer* buffer) {
+    FusedAudio* self = FUSED_AUDIO(base);
+
+    GST_OBJECT_LOCK(self);
+    if (self->is_dirty) {
+        update_parameters(self);
+    }
+    GST_OBJECT_UNLOCK(self);
+
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READWRITE)) {
+        return GST_FLOW_ERROR;
+    }
+
+    float* samples = (float*)map.data;
+    guint frames = map.size / (sizeof(float) * self->channels);
+    gboolean has_gain = FALSE;
+    for (guint c = 0; c < self->channels; ++c) {
+        has_gain |= self->gains[c] != 1.0f;
+    }
+    gboolean has_echo = self->echo_intensity != 0.0f || self->echo_feedback != 0.0f;
+
+    // All stages run over one small block before moving on, instead of one element per stage walking the whole buffer
+    for (guint start = 0; start < frames; start += FUSED_BLOCK_FRAMES) {
+        guint block_frames = MIN(FUSED_BLOCK_FRAMES, frames - start);
+        float* block = samples + start * self->channels;
+        guint count = block_frames * self->channels;
+
+        if (has_gain) {
+            kernel_gain(block, count, self->gains, self->channels);
+        }
+        if (has_echo) {
+            process_echo(self, block, count);
+        }
+        if (self->pass_mode != PassNone) {
+            kernel_biquads(self, block, block_frames);
+        }
+    }
+
+    gst_buffer_unmap(buffer, &map);
+    return GST_FLOW_OK;
+}
+
+static gboolean fused_audio_stop(GstBaseTransform* base) {
+    FusedAudio* self = FUSED_AUDIO(base);
+    g_clear_pointer(&self->echo_ring, g_free);
+    self->echo_length = 0;
+    return TRUE;
+}
+
+static void fused_audio_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
+    FusedAudio* self = FUSED_AUDIO(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_VOLUME: self->volume = g_value_get_double(value); break;
+        case PROP_PANORAMA: self->panorama = g_value_get_float(value); break;
+        case PROP_MODE: self->mode = g_value_get_int(value); break;
+        case PROP_CUTOFF: self->cutoff = g_value_get_float(value); break;
+        case PROP_DELAY: self->delay = g_value_get_uint64(value); break;
+        case PROP_MAX_DELAY: self->max_delay = g_value_get_uint64(value); break;
+        case PROP_FEEDBACK: self->feedback = g_value_get_float(value); break;
+        case PROP_INTENSITY: self->intensity = g_value_get_float(value); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    self->is_dirty = TRUE;
+    GST_OBJECT_UNLOCK(self);
+
+    update_passthrough(self);
+}
+
+static void fused_audio_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec) {
+    FusedAudio* self = FUSED_AUDIO(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_VOLUME: g_value_set_double(value, self->volume); break;
+        case PROP_PANORAMA: g_value_set_float(value, self->panorama); break;
+        case PROP_MODE: g_value_set_int(value, self->mode); break;
+        case PROP_CUTOFF: g_value_set_float(value, self->cutoff); break;
+        case PROP_DELAY: g_value_set_uint64(value, self->delay); break;
+        case PROP_MAX_DELAY: g_value_set_uint64(value, self->max_delay); break;
+        case PROP_FEEDBACK: g_value_set_float(value, self->feedback); break;
+        case PROP_INTENSITY: g_value_set_float(value, self->intensity); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static void fused_audio_finalize(GObject* object) {
+    g_free(FUSED_AUDIO(object)->echo_ring);
+    G_OBJECT_CLASS(fused_audio_parent_class)->finalize(object);
+}
+
+static void fused_audio_class_init(FusedAudioClass* klass) {
+    GObjectClass* gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass* element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseTransformClass* transform_class = GST_BASE_TRANSFORM_CLASS(klass);
+    GstAudioFilterClass* filter_class = GST_AUDIO_FILTER_CLASS(klass);
+
+    gobject_class->set_property = fused_audio_set_property;
+    gobject_class->get_property = fused_audio_get_property;
+    gobject_class->finalize = fused_audio_finalize;
+
+    GParamFlags flags = G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_CONTROLLABLE;
+    g_object_class_install_property(gobject_class, PROP_VOLUME,
+        g_param_spec_double("volume", "Volume", "Volume factor", 0.0, 10.0, 1.0, flags));
+    g_object_class_install_property(gobject_class, PROP_PANORAMA,
+        g_param_spec_float("panorama", "Panorama", "Balance, -1 is left only, 1 is right only", -1.0f, 1.0f, 0.0f, flags));
+    g_object_class_install_property(gobject_class, PROP_MODE,
+        g_param_spec_int("mode", "Mode", "0 low-pass, 1 high-pass, 2 off", PassLow, PassNone, PassNone, flags));
+    g_object_class_install_property(gobject_class, PROP_CUTOFF,
+        g_param_spec_float("cutoff", "Cutoff", "Cut off frequency in Hz", 0.0f, 100000.0f, 0.0f, flags));
+    g_object_class_install_property(gobject_class, PROP_DELAY,
+        g_param_spec_uint64("delay", "Delay", "Echo delay in nanoseconds", 1, G_MAXUINT64, 1, flags));
+    g_object_class_install_property(gobject_class, PROP_MAX_DELAY,
+        g_param_spec_uint64("max-delay", "Maximum delay", "Longest echo delay in nanoseconds, fixed once streaming", 1, G_MAXUINT64, 1, flags));
+    g_object_class_install_property(gobject_class, PROP_FEEDBACK,
+        g_param_spec_float("feedback", "Feedback", "Echo feedback", 0.0f, 1.0f, 0.0f, flags));
+    g_object_class_install_property(gobject_class, PROP_INTENSITY,
+        g_param_spec_float("intensity", "Intensity", "Echo intensity", 0.0f, 1.0f, 0.0f, flags));
+
+    gst_element_class_set_static_metadata(element_class, "Fused audio effects", "Filter/Effect/Audio",
+        "Volume, balance, echo and low/high-pass in a single pass", "media-player-gst");
+
+    GstCaps* caps = gst_caps_from_string("audio/x-raw, format=(string)" GST_AUDIO_NE(F32) ", layout=(string)interleaved, "
+                                         "rate=(int)[1, MAX], channels=(int)[1, 8]");
+    gst_audio_filter_class_add_pad_templates(filter_class, caps);
+    gst_caps_unref(caps);
+
+    transform_class->transform_ip = fused_audio_transform_ip;
+    // In passthrough the buffer may not be writable, and there is nothing to do anyway
+    transform_class->transform_ip_on_passthrough = FALSE;
+    transform_class->stop = fused_audio_stop;
+    filter_class->setup = fused_audio_setup;
+
+#if defined(FUSED_AVX)
+    __builtin_cpu_init();
+    has_avx = __builtin_cpu_supports("avx");
+#endif
+}
+
+static void fused_audio_init(FusedAudio* self) {
+    self->volume = 1.0;
+    self->panorama = 0.0f;
+    self->mode = PassNone;
+    self->cutoff = 0.0f;
+    self->delay = 1;
+    self->max_delay = 1;
+    self->feedback = 0.0f;
+    self->intensity = 0.0f;
+    self->pass_mode = PassNone;
+    self->is_dirty = TRUE;
+    gst_base_transform_set_passthrough(GST_BASE_TRANSFORM(self), TRUE);
+}
+
+void fused_audio_register(void) {
+    static gsize is_registered = 0;
+    if (g_once_init_enter(&is_registered)) {
+        gst_element_register(NULL, FUSED_AUDIO_FACTORY, GST_RANK_NONE, fused_audio_get_type());
+        g_once_init_leave(&is_registered, 1);
+    }
+}
@@ -0,0 +1,16 @@
+#ifndef __FUSED_AUDIO_H
+#define __FUSED_AUDIO_H
+
+#include "gst/gstelement.h"
+
+// In-tree element doing volume, balance, echo and a low/high-pass in one in-place pass over
+// interleaved F32 samples. Property names match volume, audiopanorama, audioecho and
+// audiocheblimit, so the same g_object_set calls work on it.
+#define FUSED_AUDIO_FACTORY "fusedaudio"
+
+GType fused_audio_get_type(void);
+
+// Registers FUSED_AUDIO_FACTORY with the registry, safe to call more than once and from any thread
+void fused_audio_register(void);
+
+#endif
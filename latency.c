@@ -0,0 +1,442 @@
+#include "latency.h"
+#include "state.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <math.h>
+
+#define LATENCY_RATE 48000
+#define LATENCY_CHANNELS 2
+#define LATENCY_BURST_FRAMES (LATENCY_RATE / 1000)
+#define LATENCY_STATE_TIMEOUT (5 * GST_SECOND)
+// Bounds the error of the playout time on top of the sink's segment size
+#define LATENCY_POLL_INTERVAL (1 * GST_MSECOND)
+
+typedef struct SinkTimes {
+    gint64 buffer_time; // nanoseconds, -1 keeps the sink default
+    gint64 latency_time;
+} SinkTimes;
+
+typedef struct Measurement {
+    GMutex lock;
+    gboolean is_started; // impulses only start once the pipeline is PLAYING
+    GstAudioBaseSink* sink; // NULL for fakesink and render mode, only the arrival is measured then
+    GstClockTime next_impulse; // running time of the next burst
+    gboolean is_waiting; // a burst is on its way, later samples above the threshold are echoes
+    GstClockTime impulse_time; // running time of the first sample of the burst
+    gint64 impulse_mono; // monotonic time of the first sample of the burst
+    guint64 play_sample; // ring buffer sample of the burst, -1 until it reached the sink
+    guint count;
+    double chain_ms[LATENCY_IMPULSES]; // until the burst reached the sink
+    double total_ms[LATENCY_IMPULSES]; // until the ring buffer played it out, -1 if unknown
+} Measurement;
+
+// ---------------------------------------------------------------------------
+// Configuration
+// ---------------------------------------------------------------------------
+
+// Both properties are in microseconds
+static void configure_audio_base_sink(GstElement* sink, SinkTimes* times) {
+    if (times->buffer_time >= 0) {
+        g_object_set(sink, "buffer-time", (gint64)(times->buffer_time / GST_USECOND), NULL);
+    }
+    if (times->latency_time >= 0) {
+        g_object_set(sink, "latency-time", (gint64)(times->latency_time / GST_USECOND), NULL);
+    }
+
+    gint64 buffer_time;
+    gint64 latency_time;
+    g_object_get(sink, "buffer-time", &buffer_time, "latency-time", &latency_time, NULL);
+    g_print("Audio sink %s: buffer-time %.1f ms, latency-time %.1f ms\n", GST_OBJECT_NAME(sink), buffer_time / 1000.0, latency_time / 1000.0);
+}
+
+// autoaudiosink adds the real sink as its child once it goes to READY
+static void sink_added_signal(GstBin* bin, GstElement* element, SinkTimes* times) {
+    if (GST_IS_AUDIO_BASE_SINK(element)) {
+        configure_audio_base_sink(element, times);
+    }
+}
+
+static void sink_times_free(gpointer data, GClosure* closure) {
+    g_free(data);
+}
+
+void latency_configure_sink(GstElement* audio_sink, Settings* settings) {
+    if (!audio_sink || (settings->sink_buffer_time < 0 && settings->sink_latency_time < 0)) {
+        return;
+    }
+
+    SinkTimes* times = g_new(SinkTimes, 1);
+    times->buffer_time = settings->sink_buffer_time;
+    times->latency_time = settings->sink_latency_time;
+    if (GST_IS_AUDIO_BASE_SINK(audio_sink)) {
+        configure_audio_base_sink(audio_sink, times);
+        g_free(times);
+    } else if (GST_IS_BIN(audio_sink)) {
+        g_signal_connect_data(audio_sink, "element-added", G_CALLBACK(sink_added_signal), times, sink_times_free, 0);
+    } else {
+        g_free(times);
+    }
+}
+
+void latency_configure_pipeline(GstElement* pipeline, Settings* settings) {
+    if (settings->pipeline_latency >= 0) {
+        gst_pipeline_set_latency(GST_PIPELINE(pipeline), settings->pipeline_latency);
+    }
+}
+
+static gboolean query_latency(GstElement* pipeline, gboolean* is_live, GstClockTime* min, GstClockTime* max) {
+    GstQuery* query = gst_query_new_latency();
+    gboolean is_ok = gst_element_query(pipeline, query);
+    if (is_ok) {
+        gst_query_parse_latency(query, is_live, min, max);
+    }
+    gst_query_unref(query);
+    return is_ok;
+}
+
+void latency_report(GstElement* pipeline) {
+    gboolean is_live;
+    GstClockTime min;
+    GstClockTime max;
+    if (!query_latency(pipeline, &is_live, &min, &max)) {
+        g_print("Latency: query failed\n");
+        return;
+    }
+
+    g_print("Latency: %s, min %.1f ms, max ", is_live ? "live" : "not live", min / (double)GST_MSECOND);
+    if (GST_CLOCK_TIME_IS_VALID(max)) {
+        g_print("%.1f ms", max / (double)GST_MSECOND);
+    } else {
+        g_print("unlimited");
+    }
+    GstClockTime fixed = gst_pipeline_get_latency(GST_PIPELINE(pipeline));
+    if (GST_CLOCK_TIME_IS_VALID(fixed)) {
+        g_print(", pipeline fixed at %.1f ms", fixed / (double)GST_MSECOND);
+    }
+    g_print("\n");
+}
+
+// ---------------------------------------------------------------------------
+// Measurement
+// ---------------------------------------------------------------------------
+
+static GstClockTime running_time_now(GstElement* element) {
+    GstClock* clock = gst_element_get_clock(element);
+    if (!clock) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    GstClockTime now = gst_clock_get_time(clock) - gst_element_get_base_time(element);
+    gst_object_unref(clock);
+    return now;
+}
+
+static GstClockTime buffer_running_time(GstPad* pad, GstBuffer* buffer) {
+    GstEvent* event = gst_pad_get_sticky_event(pad, GST_EVENT_SEGMENT, 0);
+    if (!event) {
+        return GST_CLOCK_TIME_NONE;
+    }
+    GstSegment segment;
+    gst_event_copy_segment(event, &segment);
+    gst_event_unref(event);
+    return gst_segment_to_running_time(&segment, GST_FORMAT_TIME, GST_BUFFER_PTS(buffer));
+}
+
+// The test source produces F32 stereo at LATENCY_RATE, the burst takes the end of a buffer
+static GstPadProbeReturn inject_probe(GstPad* pad, GstPadProbeInfo* info, Measurement* measurement) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstClockTime time = buffer_running_time(pad, buffer);
+    gsize frames = gst_buffer_get_size(buffer) / (sizeof(gfloat) * LATENCY_CHANNELS);
+    if (!GST_CLOCK_TIME_IS_VALID(time) || frames == 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    g_mutex_lock(&measurement->lock);
+    gboolean is_due = measurement->is_started && !measurement->is_waiting && measurement->count < LATENCY_IMPULSES
+        && time >= measurement->next_impulse;
+    if (is_due) {
+        gsize burst = MIN(frames, LATENCY_BURST_FRAMES);
+        buffer = gst_buffer_make_writable(buffer);
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+
+        GstMapInfo map;
+        if (gst_buffer_map(buffer, &map, GST_MAP_WRITE)) {
+            gfloat* samples = (gfloat*)map.data;
+            for (gsize i = (frames - burst) * LATENCY_CHANNELS; i < frames * LATENCY_CHANNELS; ++i) {
+                samples[i] = 0.9f;
+            }
+            gst_buffer_unmap(buffer, &map);
+            measurement->impulse_time = time + gst_util_uint64_scale(frames - burst, GST_SECOND, LATENCY_RATE);
+            // The live source pushes a buffer once its last sample is captured
+            measurement->impulse_mono = g_get_monotonic_time() - gst_util_uint64_scale(burst, G_USEC_PER_SEC, LATENCY_RATE);
+            measurement->is_waiting = TRUE;
+        }
+    }
+    g_mutex_unlock(&measurement->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// Frame of the first sample above LATENCY_THRESHOLD, -1 if there is none. Any format the chain
+// ends up in is unpacked to S32 or F64 first.
+static gint find_burst(GstBuffer* buffer, const GstAudioInfo* audio_info) {
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return -1;
+    }
+    const GstAudioFormatInfo* finfo = audio_info->finfo;
+    gint channels = GST_AUDIO_INFO_CHANNELS(audio_info);
+    gint samples = (map.size / GST_AUDIO_INFO_BPF(audio_info)) * channels;
+    gint found = -1;
+    if (finfo->unpack_format == GST_AUDIO_FORMAT_F64) {
+        gdouble* unpacked = g_new(gdouble, samples);
+        finfo->unpack_func(finfo, GST_AUDIO_PACK_FLAG_NONE, unpacked, map.data, samples);
+        for (gint i = 0; i < samples; ++i) {
+            if (fabs(unpacked[i]) > LATENCY_THRESHOLD) {
+                found = i / channels;
+                break;
+            }
+        }
+        g_free(unpacked);
+    } else {
+        gint32* unpacked = g_new(gint32, samples);
+        finfo->unpack_func(finfo, GST_AUDIO_PACK_FLAG_NONE, unpacked, map.data, samples);
+        gint64 threshold = LATENCY_THRESHOLD * G_MAXINT32;
+        for (gint i = 0; i < samples; ++i) {
+            if (ABS((gint64)unpacked[i]) > threshold) {
+                found = i / channels;
+                break;
+            }
+        }
+        g_free(unpacked);
+    }
+    gst_buffer_unmap(buffer, &map);
+    return found;
+}
+
+static GstPadProbeReturn detect_probe(GstPad* pad, GstPadProbeInfo* info, Measurement* measurement) {
+    g_mutex_lock(&measurement->lock);
+    // Once the burst is found the rest of it waits for playout like any other sample
+    gboolean is_waiting = measurement->is_waiting && measurement->play_sample == (guint64)-1;
+    g_mutex_unlock(&measurement->lock);
+    if (!is_waiting) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstCaps* caps = gst_pad_get_current_caps(pad);
+    GstAudioInfo audio_info;
+    gboolean has_info = caps && gst_audio_info_from_caps(&audio_info, caps);
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+    GstClockTime time = buffer_running_time(pad, buffer);
+    gint frame = has_info && GST_CLOCK_TIME_IS_VALID(time) ? find_burst(buffer, &audio_info) : -1;
+    if (frame < 0) {
+        return GST_PAD_PROBE_OK;
+    }
+
+    gint64 now = g_get_monotonic_time();
+    g_mutex_lock(&measurement->lock);
+    guint index = measurement->count;
+    measurement->chain_ms[index] = (now - measurement->impulse_mono) / 1000.0;
+    // The probe runs on the streaming thread right before render, so next_sample is where this
+    // buffer goes into the ring buffer. It is -1 until the sink has rendered once.
+    guint64 next_sample = measurement->sink ? measurement->sink->next_sample : (guint64)-1;
+    if (next_sample != (guint64)-1) {
+        measurement->play_sample = next_sample + frame;
+    } else {
+        measurement->total_ms[index] = -1.0;
+        measurement->count++;
+        measurement->next_impulse = measurement->impulse_time + LATENCY_IMPULSE_INTERVAL;
+        measurement->is_waiting = FALSE;
+    }
+    g_mutex_unlock(&measurement->lock);
+
+    if (next_sample == (guint64)-1) {
+        g_print("Impulse %u: %.1f ms to the sink, playout not measured\n", index + 1, measurement->chain_ms[index]);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+// Called from the polling loop. The ring buffer counts the samples it handed to the device in
+// whole segments, the device reports how many of them it has not played yet.
+static void check_playout(Measurement* measurement) {
+    g_mutex_lock(&measurement->lock);
+    if (!measurement->is_waiting || measurement->play_sample == (guint64)-1) {
+        g_mutex_unlock(&measurement->lock);
+        return;
+    }
+    GstAudioRingBuffer* ringbuffer = measurement->sink->ringbuffer;
+    guint64 done = ringbuffer ? gst_audio_ring_buffer_samples_done(ringbuffer) : 0;
+    guint delay = ringbuffer ? gst_audio_ring_buffer_delay(ringbuffer) : 0;
+    guint64 played = done > delay ? done - delay : 0;
+    if (played <= measurement->play_sample) {
+        g_mutex_unlock(&measurement->lock);
+        return;
+    }
+    guint index = measurement->count++;
+    measurement->total_ms[index] = (g_get_monotonic_time() - measurement->impulse_mono) / 1000.0;
+    measurement->play_sample = -1;
+    measurement->next_impulse = measurement->impulse_time + LATENCY_IMPULSE_INTERVAL;
+    measurement->is_waiting = FALSE;
+    g_mutex_unlock(&measurement->lock);
+
+    g_print("Impulse %u: %.1f ms to the sink, %.1f ms until played out\n", index + 1, measurement->chain_ms[index], measurement->total_ms[index]);
+}
+
+// The real sink of autoaudiosink only exists once the pipeline left NULL
+static GstAudioBaseSink* find_audio_base_sink(GstElement* pipeline) {
+    GstIterator* iterator = gst_bin_iterate_recurse(GST_BIN(pipeline));
+    GValue item = G_VALUE_INIT;
+    GstAudioBaseSink* sink = NULL;
+    while (!sink && gst_iterator_next(iterator, &item) == GST_ITERATOR_OK) {
+        GstElement* element = g_value_get_object(&item);
+        if (GST_IS_AUDIO_BASE_SINK(element)) {
+            sink = GST_AUDIO_BASE_SINK(gst_object_ref(element));
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(iterator);
+    return sink;
+}
+
+static GstElement* make_impulse_source(Settings* settings) {
+    // One buffer per sink segment, so the source adds no more delay than the sink asks for
+    GstClockTime buffer_time = settings->sink_latency_time >= 0 ? settings->sink_latency_time : 10 * GST_MSECOND;
+    guint64 samples_per_buffer = MAX(gst_util_uint64_scale(buffer_time, LATENCY_RATE, GST_SECOND), LATENCY_BURST_FRAMES);
+    gchar* description = g_strdup_printf("audiotestsrc is-live=true wave=silence samplesperbuffer=%" G_GUINT64_FORMAT
+                                         " ! audio/x-raw,format=F32LE,layout=interleaved,rate=%d,channels=%d",
+                                         samples_per_buffer, LATENCY_RATE, LATENCY_CHANNELS);
+    GError* err = NULL;
+    GstElement* source = gst_parse_bin_from_description(description, TRUE, &err);
+    g_free(description);
+    if (err) {
+        g_printerr("Could not create impulse source: %s\n", err->message);
+        g_clear_error(&err);
+        if (source) {
+            gst_object_unref(source);
+        }
+        return NULL;
+    }
+    gst_object_set_name(GST_OBJECT(source), "impulse-source");
+    return source;
+}
+
+static void print_measurement(Measurement* measurement) {
+    if (measurement->count == 0) {
+        g_printerr("No impulse reached the audio sink, the chain may filter it out\n");
+        return;
+    }
+    double chain_sum = 0.0;
+    for (guint i = 0; i < measurement->count; ++i) {
+        chain_sum += measurement->chain_ms[i];
+    }
+    if (measurement->total_ms[0] < 0.0) {
+        g_print("To the sink over %u impulses: %.1f ms avg, the sink has no ring buffer to measure playout on\n",
+                measurement->count, chain_sum / measurement->count);
+        return;
+    }
+    double min = measurement->total_ms[0];
+    double max = measurement->total_ms[0];
+    double sum = 0.0;
+    for (guint i = 0; i < measurement->count; ++i) {
+        min = MIN(min, measurement->total_ms[i]);
+        max = MAX(max, measurement->total_ms[i]);
+        sum += measurement->total_ms[i];
+    }
+    g_print("Until played out over %u impulses: min %.1f ms, avg %.1f ms, max %.1f ms (%.1f ms avg to the sink)\n",
+            measurement->count, min, sum / measurement->count, max, chain_sum / measurement->count);
+}
+
+int latency_measure(Settings* settings) {
+    // The chain of the given filters, only the source differs
+    Settings measured = *settings;
+    measured.is_audio_only = TRUE;
+
+    State state = {0};
+    state.is_audio_only = TRUE;
+    if (!state_create_all_elements(&state, &measured)) {
+        return -1;
+    }
+    // uridecodebin is replaced by the impulse source, it was never added anywhere
+    gst_object_ref_sink(state.source);
+    gst_object_unref(state.source);
+    state.source = make_impulse_source(&measured);
+    if (!state.source) {
+        return -1;
+    }
+
+    state.pipeline = gst_pipeline_new("latency-pipeline");
+    latency_configure_pipeline(state.pipeline, &measured);
+    state_setup_filter_values_from_settings(&state, &measured);
+    state_add_elements(&state, &measured);
+    if (!state_link_elements(&state, &measured) || !gst_element_link(state.source, state_audio_head(&state))) {
+        g_printerr("Could not link latency pipeline\n");
+        gst_object_unref(state.pipeline);
+        return -1;
+    }
+
+    Measurement measurement = {0};
+    g_mutex_init(&measurement.lock);
+    measurement.play_sample = -1;
+    GstPad* source_pad = gst_element_get_static_pad(state.source, "src");
+    GstPad* sink_pad = gst_element_get_static_pad(state.audio_sink, "sink");
+    gst_pad_add_probe(source_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)inject_probe, &measurement, NULL);
+    gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)detect_probe, &measurement, NULL);
+
+    int result = 0;
+    GstBus* bus = gst_element_get_bus(state.pipeline);
+    if (gst_element_set_state(state.pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE
+        || gst_element_get_state(state.pipeline, NULL, NULL, LATENCY_STATE_TIMEOUT) == GST_STATE_CHANGE_FAILURE) {
+        g_printerr("Could not start latency pipeline\n");
+        result = -1;
+    } else {
+        // For comparison, the query only adds up what the elements claim
+        latency_report(state.pipeline);
+
+        GstAudioBaseSink* sink = measured.output_mode == OutputPlayback ? find_audio_base_sink(state.pipeline) : NULL;
+        g_mutex_lock(&measurement.lock);
+        measurement.sink = sink;
+        measurement.next_impulse = running_time_now(state.pipeline) + LATENCY_IMPULSE_INTERVAL;
+        measurement.is_started = TRUE;
+        g_mutex_unlock(&measurement.lock);
+
+        // Every impulse gets a second before the measurement gives up
+        gint64 deadline = g_get_monotonic_time() + LATENCY_IMPULSES * (LATENCY_IMPULSE_INTERVAL / GST_USECOND + G_USEC_PER_SEC);
+        while (g_get_monotonic_time() < deadline) {
+            GstMessage* message = gst_bus_timed_pop_filtered(bus, LATENCY_POLL_INTERVAL, GST_MESSAGE_ERROR);
+            if (message) {
+                GError* err;
+                gst_message_parse_error(message, &err, NULL);
+                g_printerr("Error from %s: %s\n", GST_OBJECT_NAME(message->src), err->message);
+                g_clear_error(&err);
+                gst_message_unref(message);
+                result = -1;
+                break;
+            }
+            check_playout(&measurement);
+            g_mutex_lock(&measurement.lock);
+            gboolean is_done = measurement.count == LATENCY_IMPULSES;
+            g_mutex_unlock(&measurement.lock);
+            if (is_done) {
+                break;
+            }
+        }
+    }
+
+    gst_element_set_state(state.pipeline, GST_STATE_NULL);
+    print_measurement(&measurement);
+    if (measurement.count == 0) {
+        result = -1;
+    }
+    if (measurement.sink) {
+        gst_object_unref(measurement.sink);
+    }
+    gst_object_unref(source_pad);
+    gst_object_unref(sink_pad);
+    gst_object_unref(bus);
+    gst_object_unref(state.pipeline);
+    g_mutex_clear(&measurement.lock);
+    return result;
+}
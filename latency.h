@@ -0,0 +1,31 @@
+#ifndef __LATENCY_H
+#define __LATENCY_H
+
+#include "gst/gstelement.h"
+#include "settings.h"
+
+// Audio output latency. The sink autoaudiosink picks gets buffer-time and latency-time from
+// settings, the ring buffer holds buffer-time of audio in segments of latency-time. Smaller
+// values cut the delay to the speakers, too small ones make the device underrun.
+//
+// The measurement (--measure-latency) runs the audio chain of state_link_elements behind a live
+// audiotestsrc. Every LATENCY_IMPULSE_INTERVAL a 1 ms burst goes into the silence, and the
+// first sample above LATENCY_THRESHOLD at the audio sink counts as its arrival. Playout is when
+// the ring buffer, less the delay the device reports, has passed the sample the burst was
+// written to. The ring buffer moves in segments of latency-time, which limits the resolution.
+// Delay the device does not report is not included.
+#define LATENCY_IMPULSES 8
+#define LATENCY_IMPULSE_INTERVAL (250 * GST_MSECOND)
+#define LATENCY_THRESHOLD 0.1
+
+// Call on the audio sink before it goes to READY, does nothing unless a sink time is set
+void latency_configure_sink(GstElement* audio_sink, Settings* settings);
+// Fixed latency from settings->pipeline_latency, the latency query decides otherwise
+void latency_configure_pipeline(GstElement* pipeline, Settings* settings);
+// Prints the result of a latency query on the pipeline, call once it is PLAYING
+void latency_report(GstElement* pipeline);
+
+// Builds the measurement pipeline and prints every impulse, 0 on success
+int latency_measure(Settings* settings);
+
+#endif
@@ -0,0 +1,239 @@
+#include "livefilter.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <stddef.h>
+#include <string.h>
+
+typedef struct LiveFilter {
+    const char* name; // as used in the protocol
+    size_t element_offset; // offset of the GstElement* in State, null while the filter is out
+    const char* factory;
+    const char* element_name; // same as the one State gives it
+    gboolean is_video;
+    gboolean is_fusable; // part of State.fused_audio when that is in use
+    const char* initial_values; // "property=value ..." for a filter created here
+} LiveFilter;
+
+static const LiveFilter filters[] = {
+    {"echo", offsetof(State, audio_echo), "audioecho", "reverb-filter", FALSE, TRUE,
+     "max-delay=1000000000 delay=250000000 feedback=0.3 intensity=0.5"},
+    {"pass", offsetof(State, pass_filter), "audiocheblimit", "passfilter", FALSE, TRUE, "mode=low-pass cutoff=1000"},
+    {"noise", offsetof(State, noise_reduction), "audiornnoise", "noise-reduction-filter", FALSE, FALSE, NULL},
+    {"videobalance", offsetof(State, videobalance_filter), "videobalance", "video-balance", TRUE, FALSE, NULL},
+};
+
+typedef struct Relink {
+    State* state;
+    const LiveFilter* filter;
+    GstElement* element; // filter to put in, owned, null when taking one out
+} Relink;
+
+static GMutex relink_lock;
+static gboolean is_relink_pending = FALSE;
+
+static GstElement** filter_slot(State* state, const LiveFilter* filter) {
+    return (GstElement**)((char*)state + filter->element_offset);
+}
+
+// Object data key on the pipeline holding a filter that was taken out
+static gchar* parked_key(const LiveFilter* filter) {
+    return g_strdup_printf("live-filter-%s", filter->name);
+}
+
+static GstElement* make_filter(State* state, const LiveFilter* filter) {
+    gchar* key = parked_key(filter);
+    GstElement* element = g_object_steal_data(G_OBJECT(state->pipeline), key);
+    g_free(key);
+    if (element) {
+        return element;
+    }
+
+    element = gst_element_factory_make(filter->factory, filter->element_name);
+    if (!element) {
+        return NULL;
+    }
+    gst_object_ref_sink(element);
+    if (filter->initial_values) {
+        gchar** values = g_strsplit(filter->initial_values, " ", -1);
+        for (int i = 0; values[i]; ++i) {
+            gchar** pair = g_strsplit(values[i], "=", 2);
+            gst_util_set_object_arg(G_OBJECT(element), pair[0], pair[1]);
+            g_strfreev(pair);
+        }
+        g_strfreev(values);
+    }
+    return element;
+}
+
+static void insert_filter(Relink* relink, GstPad* prev_src) {
+    GstElement* element = relink->element;
+    GstPad* next_sink = gst_pad_get_peer(prev_src);
+    GstPad* element_sink = gst_element_get_static_pad(element, "sink");
+    GstPad* element_src = gst_element_get_static_pad(element, "src");
+
+    gst_pad_unlink(prev_src, next_sink);
+    gst_bin_add(GST_BIN(relink->state->pipeline), element);
+    // Nothing can reach it before the probe returns, so it gets to PLAYING before its first buffer
+    gst_element_sync_state_with_parent(element);
+
+    // Linking sends a reconfigure upstream, the converters in front adapt to the new caps
+    if (GST_PAD_LINK_FAILED(gst_pad_link(prev_src, element_sink)) || GST_PAD_LINK_FAILED(gst_pad_link(element_src, next_sink))) {
+        g_printerr("Could not link %s, leaving it out\n", relink->filter->name);
+        gst_pad_unlink(prev_src, element_sink);
+        gst_pad_link(prev_src, next_sink);
+        gst_element_set_state(element, GST_STATE_NULL);
+        gst_bin_remove(GST_BIN(relink->state->pipeline), element);
+    } else {
+        g_mutex_lock(&relink_lock);
+        *filter_slot(relink->state, relink->filter) = element;
+        g_mutex_unlock(&relink_lock);
+        g_print("Inserted %s\n", relink->filter->name);
+    }
+
+    gst_object_unref(element_src);
+    gst_object_unref(element_sink);
+    gst_object_unref(next_sink);
+    gst_object_unref(element);
+}
+
+static void remove_filter(Relink* relink, GstPad* prev_src) {
+    GstElement* element = *filter_slot(relink->state, relink->filter);
+    GstPad* element_src = gst_element_get_static_pad(element, "src");
+    GstPad* element_sink = gst_pad_get_peer(prev_src);
+    GstPad* next_sink = gst_pad_get_peer(element_src);
+
+    g_mutex_lock(&relink_lock);
+    *filter_slot(relink->state, relink->filter) = NULL;
+    g_mutex_unlock(&relink_lock);
+    gst_pad_unlink(prev_src, element_sink);
+    gst_pad_unlink(element_src, next_sink);
+    if (GST_PAD_LINK_FAILED(gst_pad_link(prev_src, next_sink))) {
+        g_printerr("Could not link around %s\n", relink->filter->name);
+    }
+
+    // Kept with its parameters, the pipeline drops it when it is disposed
+    gst_object_ref(element);
+    gst_element_set_state(element, GST_STATE_NULL);
+    gst_bin_remove(GST_BIN(relink->state->pipeline), element);
+    gchar* key = parked_key(relink->filter);
+    g_object_set_data_full(G_OBJECT(relink->state->pipeline), key, element, gst_object_unref);
+    g_free(key);
+    g_print("Removed %s\n", relink->filter->name);
+
+    gst_object_unref(next_sink);
+    gst_object_unref(element_sink);
+    gst_object_unref(element_src);
+}
+
+// Runs when no data is on prev_src, either right away or in the streaming thread between two buffers
+static GstPadProbeReturn relink_probe(GstPad* prev_src, GstPadProbeInfo* info, Relink* relink) {
+    // An IDLE probe may be called once more while it is being removed
+    if (!relink->state) {
+        return GST_PAD_PROBE_REMOVE;
+    }
+
+    if (relink->element) {
+        insert_filter(relink, prev_src);
+    } else {
+        remove_filter(relink, prev_src);
+    }
+    relink->state = NULL;
+
+    g_mutex_lock(&relink_lock);
+    is_relink_pending = FALSE;
+    g_mutex_unlock(&relink_lock);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+static const LiveFilter* find_filter(const char* name) {
+    for (int i = 0; i < ARRAY_SIZE(filters); ++i) {
+        if (!strcmp(filters[i].name, name)) {
+            return &filters[i];
+        }
+    }
+    return NULL;
+}
+
+// Element in front of where filter is or would be. element only stands in for the filter in the
+// chain, State is left alone until the probe puts it in.
+static GstElement* find_previous(State* state, const LiveFilter* filter, GstElement* element) {
+    GstElement** slot = filter_slot(state, filter);
+    GPtrArray* chain = filter->is_video ? state_video_chain(state, slot, element) : state_audio_chain(state, slot, element);
+
+    GstElement* previous = NULL;
+    for (guint i = 1; i < chain->len; ++i) {
+        if (g_ptr_array_index(chain, i) == element) {
+            previous = g_ptr_array_index(chain, i - 1);
+            break;
+        }
+    }
+    g_ptr_array_free(chain, TRUE);
+    return previous;
+}
+
+const char* live_filter_set_enabled(State* state, const char* name, gboolean is_enabled) {
+    const LiveFilter* filter = find_filter(name);
+    if (!filter) {
+        return "unknown filter";
+    }
+    if (filter->is_fusable && state->fused_audio) {
+        return "filter is part of the fused element, start with --no-fuse";
+    }
+    if (filter->is_video && state->is_audio_only) {
+        return "there is no video branch";
+    }
+    if (!filter->is_video && state->is_video_only) {
+        return "there is no audio branch";
+    }
+
+    g_mutex_lock(&relink_lock);
+    const char* error = NULL;
+    GstElement* current = *filter_slot(state, filter);
+    if (is_relink_pending) {
+        error = "another filter change is pending";
+    } else if (is_enabled == (current != NULL)) {
+        error = is_enabled ? "filter is already in the pipeline" : "filter is not in the pipeline";
+    }
+    if (error) {
+        g_mutex_unlock(&relink_lock);
+        return error;
+    }
+
+    Relink* relink = g_new0(Relink, 1);
+    relink->state = state;
+    relink->filter = filter;
+    if (is_enabled) {
+        relink->element = make_filter(state, filter);
+        if (!relink->element) {
+            g_mutex_unlock(&relink_lock);
+            g_free(relink);
+            return "could not create filter";
+        }
+    }
+
+    GstElement* previous = find_previous(state, filter, is_enabled ? relink->element : current);
+    GstPad* prev_src = previous ? gst_element_get_static_pad(previous, "src") : NULL;
+    if (!prev_src) {
+        g_mutex_unlock(&relink_lock);
+        if (relink->element) {
+            gst_object_unref(relink->element);
+        }
+        g_free(relink);
+        return "no place for the filter in the chain";
+    }
+
+    is_relink_pending = TRUE;
+    g_mutex_unlock(&relink_lock);
+
+    // The probe may run right here, so the lock is not held
+    gst_pad_add_probe(prev_src, GST_PAD_PROBE_TYPE_IDLE, (GstPadProbeCallback)relink_probe, relink, g_free);
+    gst_object_unref(prev_src);
+    return NULL;
+}
+
+GstElement* live_filter_ref_slot(GstElement** slot) {
+    g_mutex_lock(&relink_lock);
+    GstElement* element = *slot ? gst_object_ref(*slot) : NULL;
+    g_mutex_unlock(&relink_lock);
+    return element;
+}
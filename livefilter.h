@@ -0,0 +1,25 @@
+#ifndef __LIVE_FILTER_H
+#define __LIVE_FILTER_H
+
+#include "state.h"
+
+// Filters that can be put into and taken out of the running pipeline: echo, pass, noise and
+// videobalance. A filter goes to the place it would have when given on the command line. The
+// link in front of that place is changed from an IDLE probe, between two buffers, so nothing is
+// flushed and timestamps and A/V sync stay as they are. A filter taken out is kept with its
+// parameters and comes back with them. A new one starts with audible defaults, which set can change.
+//
+// The switch is hard, there is no ramp or crossfade between the dry and the filtered signal. The
+// first filtered buffer follows the last dry one directly, so pass and noise can click. Echo
+// starts from an empty delay line, only its tail is cut off when it is taken out.
+//
+// One change runs at a time. It is done once data flows, so in PAUSED it waits for PLAYING.
+
+// NULL when the change was scheduled, otherwise why it was not
+const char* live_filter_set_enabled(State* state, const char* name, gboolean is_enabled);
+
+// Element in a filter slot of State with a ref held, or NULL. The probe puts filters in and takes
+// them out from the streaming thread, so other threads read the slots through this.
+GstElement* live_filter_ref_slot(GstElement** slot);
+
+#endif
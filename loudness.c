@@ -0,0 +1,351 @@
+#include "loudness.h"
+#include "state.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <glib/gstdio.h>
+#include <math.h>
+#include <string.h>
+
+#define LOUDNESS_GROUP "loudness"
+#define LOUDNESS_MAX_CHANNELS 8
+#define LOUDNESS_SUB_BLOCKS 4 // 100 ms steps per 400 ms block
+#define TRUE_PEAK_TAPS 12 // per oversampling phase
+#define TRUE_PEAK_MAX_FACTOR 4
+
+typedef struct Biquad {
+    double b0, b1, b2, a1, a2;
+} Biquad;
+
+typedef struct Analyzer {
+    int rate;
+    int channels;
+    double weights[LOUDNESS_MAX_CHANNELS]; // 0 for LFE, 1.41 for surround channels
+    Biquad shelf; // K-weighting, high shelf for the acoustic effect of the head
+    Biquad highpass; // K-weighting, RLB high-pass
+    double shelf_state[LOUDNESS_MAX_CHANNELS][2];
+    double highpass_state[LOUDNESS_MAX_CHANNELS][2];
+
+    guint64 sub_block_size; // frames in 100 ms
+    guint64 sub_block_fill;
+    double sub_block_energy; // weighted sum of squares in the current 100 ms
+    double recent[LOUDNESS_SUB_BLOCKS]; // the last sub-blocks, oldest first
+    int recent_count;
+    GArray* blocks; // of double, mean square of every 400 ms block
+
+    int oversampling; // 1, 2 or 4
+    double fir[TRUE_PEAK_MAX_FACTOR * TRUE_PEAK_TAPS]; // polyphase interpolation filter
+    // Last TRUE_PEAK_TAPS samples per channel twice in a row, newest first from history_pos
+    float history[LOUDNESS_MAX_CHANNELS][2 * TRUE_PEAK_TAPS];
+    int history_pos;
+    double peak; // linear
+
+    guint64 frames;
+} Analyzer;
+
+// ---------------------------------------------------------------------------
+// Measurement
+// ---------------------------------------------------------------------------
+
+// Coefficients of BS.1770 for any rate, the standard only lists them for 48 kHz
+static void setup_k_weighting(Analyzer* analyzer) {
+    double f0 = 1681.974450955533;
+    double gain_db = 3.999843853973347;
+    double q = 0.7071752369554196;
+    double k = tan(G_PI * f0 / analyzer->rate);
+    double vh = pow(10.0, gain_db / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    double a0 = 1.0 + k / q + k * k;
+    analyzer->shelf = (Biquad){(vh + vb * k / q + k * k) / a0, 2.0 * (k * k - vh) / a0, (vh - vb * k / q + k * k) / a0,
+                               2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+
+    f0 = 38.13547087602444;
+    q = 0.5003270373238773;
+    k = tan(G_PI * f0 / analyzer->rate);
+    a0 = 1.0 + k / q + k * k;
+    analyzer->highpass = (Biquad){1.0, -2.0, 1.0, 2.0 * (k * k - 1.0) / a0, (1.0 - k / q + k * k) / a0};
+}
+
+// Windowed sinc low-pass at the original Nyquist frequency, every phase sums to about 1
+static void setup_true_peak(Analyzer* analyzer) {
+    analyzer->oversampling = analyzer->rate < 96000 ? 4 : analyzer->rate < 192000 ? 2 : 1;
+    int length = analyzer->oversampling * TRUE_PEAK_TAPS;
+    for (int n = 0; n < length; ++n) {
+        double x = (n - (length - 1) / 2.0) / analyzer->oversampling;
+        double sinc = x == 0.0 ? 1.0 : sin(G_PI * x) / (G_PI * x);
+        double window = 0.5 - 0.5 * cos(2.0 * G_PI * (n + 0.5) / length);
+        analyzer->fir[n] = sinc * window;
+    }
+}
+
+static gboolean setup_analyzer(Analyzer* analyzer, GstCaps* caps) {
+    GstAudioInfo info;
+    if (!gst_audio_info_from_caps(&info, caps) || GST_AUDIO_INFO_CHANNELS(&info) > LOUDNESS_MAX_CHANNELS) {
+        return FALSE;
+    }
+    analyzer->rate = GST_AUDIO_INFO_RATE(&info);
+    analyzer->channels = GST_AUDIO_INFO_CHANNELS(&info);
+    for (int c = 0; c < analyzer->channels; ++c) {
+        switch (info.position[c]) {
+            case GST_AUDIO_CHANNEL_POSITION_LFE1:
+            case GST_AUDIO_CHANNEL_POSITION_LFE2:
+                analyzer->weights[c] = 0.0;
+                break;
+            case GST_AUDIO_CHANNEL_POSITION_REAR_LEFT:
+            case GST_AUDIO_CHANNEL_POSITION_REAR_RIGHT:
+            case GST_AUDIO_CHANNEL_POSITION_SIDE_LEFT:
+            case GST_AUDIO_CHANNEL_POSITION_SIDE_RIGHT:
+                analyzer->weights[c] = 1.41;
+                break;
+            default:
+                analyzer->weights[c] = 1.0;
+                break;
+        }
+    }
+    analyzer->sub_block_size = MAX(analyzer->rate / 10, 1);
+    setup_k_weighting(analyzer);
+    setup_true_peak(analyzer);
+    return TRUE;
+}
+
+// Transposed direct form II
+static inline double run_biquad(const Biquad* filter, double* state, double x) {
+    double y = filter->b0 * x + state[0];
+    state[0] = filter->b1 * x - filter->a1 * y + state[1];
+    state[1] = filter->b2 * x - filter->a2 * y;
+    return y;
+}
+
+static void end_sub_block(Analyzer* analyzer) {
+    if (analyzer->recent_count == LOUDNESS_SUB_BLOCKS) {
+        memmove(analyzer->recent, analyzer->recent + 1, sizeof(double) * (LOUDNESS_SUB_BLOCKS - 1));
+        analyzer->recent_count--;
+    }
+    analyzer->recent[analyzer->recent_count++] = analyzer->sub_block_energy;
+    analyzer->sub_block_energy = 0.0;
+    analyzer->sub_block_fill = 0;
+
+    if (analyzer->recent_count == LOUDNESS_SUB_BLOCKS) {
+        double energy = 0.0;
+        for (int i = 0; i < LOUDNESS_SUB_BLOCKS; ++i) {
+            energy += analyzer->recent[i];
+        }
+        double mean_square = energy / (LOUDNESS_SUB_BLOCKS * analyzer->sub_block_size);
+        g_array_append_val(analyzer->blocks, mean_square);
+    }
+}
+
+static void analyze(Analyzer* analyzer, const float* samples, gsize frames) {
+    int factor = analyzer->oversampling;
+    for (gsize i = 0; i < frames; ++i) {
+        analyzer->history_pos = analyzer->history_pos == 0 ? TRUE_PEAK_TAPS - 1 : analyzer->history_pos - 1;
+        double energy = 0.0;
+        for (int c = 0; c < analyzer->channels; ++c) {
+            float x = samples[i * analyzer->channels + c];
+
+            float* history = analyzer->history[c];
+            history[analyzer->history_pos] = x;
+            history[analyzer->history_pos + TRUE_PEAK_TAPS] = x;
+            const float* window = history + analyzer->history_pos; // window[k] is the sample k frames back
+            for (int phase = 0; phase < factor; ++phase) {
+                double y = 0.0;
+                for (int k = 0; k < TRUE_PEAK_TAPS; ++k) {
+                    y += analyzer->fir[phase + k * factor] * window[k];
+                }
+                analyzer->peak = MAX(analyzer->peak, fabs(y));
+            }
+            analyzer->peak = MAX(analyzer->peak, fabsf(x));
+
+            double weighted = run_biquad(&analyzer->highpass, analyzer->highpass_state[c],
+                                         run_biquad(&analyzer->shelf, analyzer->shelf_state[c], x));
+            energy += analyzer->weights[c] * weighted * weighted;
+        }
+
+        analyzer->sub_block_energy += energy;
+        if (++analyzer->sub_block_fill == analyzer->sub_block_size) {
+            end_sub_block(analyzer);
+        }
+    }
+    analyzer->frames += frames;
+}
+
+static double block_loudness(double mean_square) {
+    return -0.691 + 10.0 * log10(mean_square);
+}
+
+static double gated_mean(GArray* blocks, double threshold) {
+    double sum = 0.0;
+    guint count = 0;
+    for (guint i = 0; i < blocks->len; ++i) {
+        double mean_square = g_array_index(blocks, double, i);
+        if (mean_square > 0.0 && block_loudness(mean_square) > threshold) {
+            sum += mean_square;
+            count++;
+        }
+    }
+    return count ? sum / count : 0.0;
+}
+
+static double integrated_loudness(Analyzer* analyzer) {
+    double absolute = gated_mean(analyzer->blocks, LOUDNESS_SILENCE);
+    if (absolute <= 0.0) {
+        return LOUDNESS_SILENCE;
+    }
+    double relative = gated_mean(analyzer->blocks, MAX(block_loudness(absolute) - 10.0, LOUDNESS_SILENCE));
+    return relative > 0.0 ? block_loudness(relative) : LOUDNESS_SILENCE;
+}
+
+// Runs in the streaming thread of the sink, the only one touching the analyzer
+static GstPadProbeReturn samples_probe(GstPad* pad, GstPadProbeInfo* info, Analyzer* analyzer) {
+    if (!analyzer->rate) {
+        GstCaps* caps = gst_pad_get_current_caps(pad);
+        gboolean is_ok = caps && setup_analyzer(analyzer, caps);
+        if (caps) {
+            gst_caps_unref(caps);
+        }
+        if (!is_ok) {
+            return GST_PAD_PROBE_OK;
+        }
+    }
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        analyze(analyzer, (const float*)map.data, map.size / (sizeof(float) * analyzer->channels));
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean measure(const char* uri, Loudness* loudness) {
+    Analyzer analyzer = {0};
+    analyzer.blocks = g_array_new(FALSE, FALSE, sizeof(double));
+
+    gboolean is_ok = state_decode_audio(uri, "loudness-pipeline", (GstPadProbeCallback)samples_probe, &analyzer)
+        && analyzer.frames > 0;
+    if (is_ok) {
+        loudness->integrated = integrated_loudness(&analyzer);
+        loudness->true_peak = analyzer.peak > 0.0 ? 20.0 * log10(analyzer.peak) : LOUDNESS_SILENCE;
+        loudness->duration = gst_util_uint64_scale(analyzer.frames, GST_SECOND, analyzer.rate);
+    }
+    g_array_free(analyzer.blocks, TRUE);
+    return is_ok;
+}
+
+// ---------------------------------------------------------------------------
+// Cache
+// ---------------------------------------------------------------------------
+
+static char* make_cache_path(const char* path, const char* dir) {
+    GStatBuf st;
+    if (g_stat(path, &st) != 0) {
+        return NULL;
+    }
+    gchar* identity = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT, path, (gint64)st.st_size, (gint64)st.st_mtime);
+    gchar* key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, identity, -1);
+    gchar* name = g_strconcat(key, ".lufs", NULL);
+    gchar* cache_path = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(key);
+    g_free(identity);
+    return cache_path;
+}
+
+static gboolean load_loudness(const char* cache_path, Loudness* loudness) {
+    GKeyFile* file = g_key_file_new();
+    GError* err = NULL;
+    gboolean is_ok = g_key_file_load_from_file(file, cache_path, G_KEY_FILE_NONE, NULL);
+    if (is_ok) {
+        loudness->integrated = g_key_file_get_double(file, LOUDNESS_GROUP, "integrated", &err);
+        loudness->true_peak = err ? 0.0 : g_key_file_get_double(file, LOUDNESS_GROUP, "true-peak", &err);
+        loudness->duration = err ? 0 : g_key_file_get_int64(file, LOUDNESS_GROUP, "duration", &err);
+        is_ok = err == NULL;
+        g_clear_error(&err);
+    }
+    g_key_file_free(file);
+    return is_ok;
+}
+
+static void save_loudness(const char* cache_path, const Loudness* loudness) {
+    gchar* dir = g_path_get_dirname(cache_path);
+    g_mkdir_with_parents(dir, 0755);
+    g_free(dir);
+
+    GKeyFile* file = g_key_file_new();
+    g_key_file_set_double(file, LOUDNESS_GROUP, "integrated", loudness->integrated);
+    g_key_file_set_double(file, LOUDNESS_GROUP, "true-peak", loudness->true_peak);
+    g_key_file_set_int64(file, LOUDNESS_GROUP, "duration", loudness->duration);
+    GError* err = NULL;
+    if (!g_key_file_save_to_file(file, cache_path, &err)) {
+        g_printerr("Could not write loudness %s: %s\n", cache_path, err->message);
+        g_clear_error(&err);
+    }
+    g_key_file_free(file);
+}
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+gboolean loudness_get(const char* uri, const char* dir, Loudness* loudness, gboolean* is_cached) {
+    gchar* path = g_filename_from_uri(uri, NULL, NULL);
+    gchar* cache_path = path ? make_cache_path(path, dir) : NULL;
+    g_free(path);
+    if (!cache_path) {
+        return FALSE;
+    }
+
+    gboolean is_loaded = load_loudness(cache_path, loudness);
+    if (is_cached) {
+        *is_cached = is_loaded;
+    }
+    gboolean is_ok = is_loaded || measure(uri, loudness);
+    if (is_ok && !is_loaded) {
+        save_loudness(cache_path, loudness);
+    }
+    g_free(cache_path);
+    return is_ok;
+}
+
+double loudness_gain(const Loudness* loudness, double target_lufs) {
+    double gain = target_lufs - loudness->integrated;
+    return MIN(gain, LOUDNESS_PEAK_CEILING - loudness->true_peak);
+}
+
+gchar* loudness_default_dir(void) {
+    return g_build_filename(g_get_user_cache_dir(), "media-player-gst", "loudness", NULL);
+}
+
+void loudness_normalize(Settings* settings, const char* uri) {
+    if (!settings->is_normalized) {
+        return;
+    }
+
+    gchar* default_dir = loudness_default_dir();
+    Loudness loudness;
+    gboolean is_cached = FALSE;
+    gint64 start_time = g_get_monotonic_time();
+    gboolean is_ok = loudness_get(uri, settings->loudness_dir ? settings->loudness_dir : default_dir, &loudness, &is_cached);
+    g_free(default_dir);
+    if (!is_ok) {
+        g_printerr("Loudness of %s is unknown, playing it without normalization\n", uri);
+        return;
+    }
+    if (loudness.integrated <= LOUDNESS_SILENCE) {
+        g_print("Loudness: silent, no normalization\n");
+        return;
+    }
+
+    double gain = loudness_gain(&loudness, settings->loudness_target);
+    // The volume elements go up to 10, +20 dB
+    settings->volume = CLAMP(settings->volume * pow(10.0, gain / 20.0), 0.0, 10.0);
+    settings->has_volume = TRUE;
+
+    double seconds = (g_get_monotonic_time() - start_time) / (double)G_USEC_PER_SEC;
+    g_print("Loudness: %.1f LUFS, true peak %.1f dBTP, gain %+.1f dB (%s)\n", loudness.integrated, loudness.true_peak, gain,
+            is_cached ? "cached" : "measured");
+    if (!is_cached && seconds > 0) {
+        g_print("  measured %.1f s of audio in %.2f s, %.0fx realtime\n", loudness.duration / (double)GST_SECOND, seconds,
+                loudness.duration / (double)GST_SECOND / seconds);
+    }
+}
@@ -0,0 +1,39 @@
+#ifndef __LOUDNESS_H
+#define __LOUDNESS_H
+
+#include "glib.h"
+#include "settings.h"
+
+// EBU R128 / ITU-R BS.1770-4 loudness of a local file, measured by a decode-only pipeline that
+// runs as fast as the decoder goes (no clock, no resampling, video is not decoded):
+//   integrated  K-weighted, over 400 ms blocks with 75% overlap, gated at -70 LUFS and then at
+//               10 LU below the loudness of the blocks that passed the first gate
+//   true peak   highest sample after 4x oversampling (2x from 96 kHz, none from 192 kHz)
+// Results are cached as <dir>/<key>.lufs, the key is a hash of the path, size and modification
+// time, so a changed file is measured again.
+typedef struct Loudness {
+    double integrated; // LUFS, LOUDNESS_SILENCE when no block is above the absolute gate
+    double true_peak; // dBTP
+    gint64 duration; // measured audio in nanoseconds
+} Loudness;
+
+#define LOUDNESS_SILENCE -70.0
+
+// Most a normalization gain may raise the true peak to
+#define LOUDNESS_PEAK_CEILING -1.0
+
+// Cached result or a new measurement that gets cached, FALSE for anything but local files and
+// files without audio. is_cached tells which one it was, may be null.
+gboolean loudness_get(const char* uri, const char* dir, Loudness* loudness, gboolean* is_cached);
+
+// Gain in dB that brings loudness to target_lufs, lowered so the true peak stays at the ceiling
+double loudness_gain(const Loudness* loudness, double target_lufs);
+
+// --normalize: measures or looks up uri and multiplies settings->volume by the gain.
+// Does nothing when normalization is off or the loudness is unknown.
+void loudness_normalize(Settings* settings, const char* uri);
+
+// Default for settings->loudness_dir, g_free it
+gchar* loudness_default_dir(void);
+
+#endif
@@ -13,24 +13,52 @@
 #include <stdio.h>
 #include <gst/gst.h>
 #include <stdlib.h>
+#include <string.h>
 #include <getopt.h>
+#include <glib/gstdio.h>
 #include "gst/gstutils.h"
 #include "settings.h"
 #include "state.h"
+#include "batch.h"
+#include "tracer.h"
+#include "control.h"
+#include "playlist.h"
+#include "analysis.h"
+#include "cache.h"
+#include "seekindex.h"
+#include "rate.h"
+#include "startup.h"
+#include "alloc.h"
+#include "qos.h"
+#include "metrics.h"
+#include "loudness.h"
+#include "extract.h"
+#include "latency.h"
+#include "mmapsrc.h"
 
 
 
 static void handle_message(GstMessage *message, State *state, Settings* settings);
-static void pad_added_signal (GstElement *self, GstPad *new_pad, State* state);
+static void print_render_stats(Settings* settings, gint64 wall_time_us, gint64 media_duration);
+static void prepare_start(State* state, Settings* settings);
 
 
 int main(int argc, char** argv) {
+    gint64 process_start_time = g_get_monotonic_time();
     if (argc < 2) {
         g_print("Usage: ./exec [arguments]\n");
         return -1;
     }
 
+    // The registry is loaded by gst_init, before the settings are parsed
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--fast-start")) {
+            startup_warm_registry();
+            break;
+        }
+    }
     gst_init(&argc, &argv);
+    gint64 registry_time = g_get_monotonic_time();
 
     State state = {0};
     Settings settings = {0};
@@ -42,46 +70,144 @@ int main(int argc, char** argv) {
         g_printerr("Error when parsing arguments encountered\n");
         return -1;
     }
-    state.is_audio_only = settings.is_audio_only;
 
-    if (!state_create_all_elements(&state, &settings)) {
-        return -1;
+    // Every uridecodebin of the process, side pipelines included, picks it for file:// from now on
+    if (settings.is_mmap_source) {
+        mmap_src_register();
     }
 
-    state.pipeline = gst_pipeline_new("tiktok-pipeline");
-    if (!state.pipeline) {
-        g_printerr("Could not create a pipeline\n");
-        return -1;
+    // Needs no media, the audio chain gets test impulses
+    if (settings.is_latency_measured) {
+        int result = latency_measure(&settings);
+        settings_free(&settings);
+        return result;
     }
 
-    // Load a file, use abslute path
-    char* file_uri = settings_get_file_uri(&settings); // it may be a local file or remote one
-    if (!file_uri) {
-        g_object_unref(state.pipeline);
-        return -1;
+    Playlist* playlist = NULL;
+    char* file_uri = NULL;
+    if (settings.is_playlist) {
+        playlist = playlist_new(&settings);
+        if (!playlist) {
+            return -1;
+        }
+        file_uri = strdup(playlist_first_uri(playlist));
+        if (settings.is_normalized) {
+            g_printerr("--normalize applies to single files and batch mode, the playlist plays as is\n");
+        }
+        if (settings.extract_dir) {
+            g_printerr("--extract applies to single files and batch mode, the playlist plays as is\n");
+        }
+    } else if (settings.is_batch) {
+        int result = batch_run(&settings);
+        settings_free(&settings);
+        return result;
+    } else {
+        // Load a file, use abslute path
+        file_uri = settings_get_file_uri(&settings); // it may be a local file or remote one
+        if (!file_uri) {
+            return -1;
+        }
+        if (settings.extract_dir) {
+            ExtractResult extracted;
+            gchar* message = NULL;
+            int result = 0;
+            if (extract_media(&settings, file_uri, &extracted, &message)) {
+                g_print("%s: %s, %s, %" G_GINT64_FORMAT " bytes written\n", settings.extract_dir,
+                        extracted.has_thumbnails ? "thumbnails" : "no video", extracted.has_waveform ? "waveform peaks" : "no audio",
+                        extracted.bytes_written);
+            } else {
+                g_printerr("Could not extract %s: %s\n", file_uri, message);
+                g_free(message);
+                result = -1;
+            }
+            free(file_uri);
+            settings_free(&settings);
+            return result;
+        }
+        // Before the elements are created, the gain goes into the volume element
+        loudness_normalize(&settings, file_uri);
     }
 
-    // Set uri property to uridecodebin which is reponsible for downloading/loading media
-    g_object_set(state.source, "uri", file_uri, NULL);
+    StartupProfile* startup = NULL;
+    if (settings.is_startup_profiled) {
+        startup = startup_profile_new(process_start_time);
+        startup_mark_at(startup, "registry loaded", registry_time);
+        state.startup = startup;
+    }
 
-    // Setup filters
-    state_setup_filter_values_from_settings(&state, &settings);
+    Cache* cache = NULL;
+    if (settings.cache_dir) {
+        cache = cache_open(settings.cache_dir, settings.cache_max_bytes);
+        state.cache = cache;
+    }
 
-    // Add elements to pipeline and link
-    state_add_elements(&state, &settings);
-    if (!state_link_elements(&state, &settings)) {
-        gst_element_set_state(state.pipeline, GST_STATE_NULL);
-        g_object_unref(state.pipeline);
+    // Create, setup, add and link all elements
+    if (!state_build_pipeline(&state, &settings, file_uri)) {
+        if (state.pipeline) {
+            gst_element_set_state(state.pipeline, GST_STATE_NULL);
+            g_object_unref(state.pipeline);
+        }
+        free(file_uri);
+        playlist_free(playlist);
+        cache_close(cache);
+        startup_profile_free(startup);
         return -1;
     }
 
-    // link source to pad added handler
-    g_signal_connect(state.source, "pad-added", G_CALLBACK(pad_added_signal), &state);
+    startup_watch_pipeline(startup, state.pipeline);
+    startup_watch_sink(startup, state.audio_sink, "first audio sample");
+    if (!state.is_audio_only) {
+        startup_watch_sink(startup, state.video_sink, "first video frame");
+    }
+
+    if (playlist) {
+        playlist_attach(playlist, &state);
+    }
+
+    // Audio needs no index, every buffer is a keyframe. A playlist would seek later items with the
+    // index of the first one.
+    SeekIndex* seek_index = NULL;
+    if (settings.has_seek_index && playlist) {
+        g_printerr("--seek-index applies to single files, the playlist seeks without an index\n");
+    } else if (settings.has_seek_index && !state.is_audio_only) {
+        gchar* default_dir = g_build_filename(g_get_user_cache_dir(), "media-player-gst", "index", NULL);
+        seek_index = seek_index_open(file_uri, settings.index_dir ? settings.index_dir : default_dir);
+        state.seek_index = seek_index;
+        g_free(default_dir);
+    }
+
+    AllocStats* alloc_stats = NULL;
+    if (settings.has_alloc_stats) {
+        alloc_stats = alloc_stats_new();
+        alloc_stats_track_bin(alloc_stats, GST_BIN(state.pipeline));
+    }
+
+    if (settings.trace_path) {
+        tracer_enable();
+        tracer_track_bin(GST_BIN(state.pipeline));
+    }
 
     // Start playing
+    gint64 start_time = g_get_monotonic_time();
+    RateControl* rate_control = rate_control_new(&state, start_time);
+    state.rate_control = rate_control;
+    QosMonitor* qos = qos_monitor_new(&state, settings.has_qos_adapt);
+    state.qos = qos;
+    Metrics* metrics = metrics_start(&state, &settings);
+    state.metrics = metrics;
+    // Commands use the objects above, so the control thread only starts once they exist
+    Control* control = NULL;
+    if (settings.control_path) {
+        control = control_start(settings.control_path, &state);
+    }
+    prepare_start(&state, &settings);
     GstStateChangeReturn ret = gst_element_set_state(state.pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE) {
         g_printerr("Was unable to change state\n");
+        control_stop(control);
+        metrics_stop(metrics);
+        qos_monitor_free(qos);
+        rate_control_free(rate_control);
         gst_element_set_state(state.pipeline, GST_STATE_NULL);
         g_object_unref(state.pipeline);
         return -1;
@@ -92,87 +218,96 @@ int main(int argc, char** argv) {
     GstMessage* message = NULL;
     bus = gst_element_get_bus(state.pipeline);
     do {
-        message = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_STATE_CHANGED);
+        message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS | GST_MESSAGE_STATE_CHANGED | GST_MESSAGE_APPLICATION | GST_MESSAGE_ELEMENT | GST_MESSAGE_QOS | GST_MESSAGE_WARNING | GST_MESSAGE_LATENCY);
         if (message) {
             handle_message(message, &state, &settings);
             gst_message_unref(message);
-        } else {
-            if (settings.has_speed && (state.is_playing && !state.is_rate_set)) {
-                gint64 cur = -1;
-                int ret = gst_element_query_position(state.pipeline, GST_FORMAT_TIME, &cur);
-                if (ret) {
-                    GstEvent* seek_event;
-                    seek_event = gst_event_new_seek(
-                    settings.speed,
-                    GST_FORMAT_TIME,
-                    GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE,
-                    GST_SEEK_TYPE_SET, cur, GST_SEEK_TYPE_END, 0);
-
-                    ret = gst_element_send_event(state.pipeline, seek_event);
-                    if (!ret) {
-                        g_printerr("Failed to update speed rate.\n");
-                    }
-                    // If we failed to send the event this time, i think there is no point in retrying
-                    state.is_rate_set = TRUE;
-                }
-            }
         }
     } while (state.is_running);
+
+    gint64 wall_time = g_get_monotonic_time() - start_time;
+    gint64 media_duration = -1;
+    if (settings.output_mode == OutputRender) {
+        gst_element_query_duration(state.pipeline, GST_FORMAT_TIME, &media_duration);
+    }
 exit:
+    control_stop(control);
+    metrics_stop(metrics);
+    // Its thread changes the pipeline, so it stops before the pipeline does
+    qos_print(qos);
+    qos_monitor_free(qos);
+    rate_control_free(rate_control);
     g_object_unref(bus);
     free(file_uri);
-    free(settings.filepath);
     gst_element_set_state(state.pipeline, GST_STATE_NULL);
     g_object_unref(state.pipeline);
-    return 0;
-}
-
-static void pad_added_signal (GstElement *self, GstPad *new_pad, State* state) {
-    GstPad* converter_sink = NULL;
+    playlist_free(playlist);
+    seek_index_free(seek_index);
+    // Sources write their cache entries out when the pipeline is disposed above
+    cache_close(cache);
+    startup_print(startup);
+    startup_profile_free(startup);
+    // Freed after the pipeline, its buffers report back to it
+    alloc_stats_print(alloc_stats);
+    alloc_stats_free(alloc_stats);
 
-    GstCaps* new_pad_caps = gst_pad_get_current_caps(new_pad);
-    GstStructure* new_pad_caps_structure = gst_caps_get_structure(new_pad_caps, 0);
-    const char* new_pad_type = gst_structure_get_name(new_pad_caps_structure);
-
-    if (g_str_has_prefix(new_pad_type, "audio/x-raw")) {
-        converter_sink = gst_element_get_static_pad(state->audio_converter, "sink");
-
-        // do nothing if already linked
-        if (gst_pad_is_linked(converter_sink)) {
-            g_print("Audio pad is already linked\n");
-            goto exit;
-        }
+    // Streaming threads are stopped now, so the rings can be read
+    if (settings.trace_path) {
+        tracer_dump(settings.trace_path);
+    }
 
-        // link new_pad output to audio converter sink
-        GstPadLinkReturn ret = gst_pad_link(new_pad, converter_sink);
-        if (GST_PAD_LINK_FAILED(ret)) {
-            g_printerr("Could not link audio pad\n");
-        }
-    } else if (!state->is_audio_only && g_str_has_prefix(new_pad_type, "video/x-raw")) {
-        converter_sink = gst_element_get_static_pad(state->video_converter, "sink");
+    // Muxer finalizes the file on the state change, so the size is only known now
+    if (settings.output_mode == OutputRender) {
+        print_render_stats(&settings, wall_time, media_duration);
+    }
+    settings_free(&settings);
+    return 0;
+}
 
-        if (gst_pad_is_linked(converter_sink)) {
-            g_print("Video pad is already linked\n");
-            goto exit;
-        }
+// Seeks need a prerolled pipeline, so the start position and speed are applied in PAUSED,
+// before anything is played at the wrong position or rate
+static void prepare_start(State* state, Settings* settings) {
+    gboolean has_rate = settings->has_speed && settings->speed != 1.0f;
+    if (settings->start_position < 0 && !has_rate) {
+        return;
+    }
 
-        // link new_pad output to video converter sink
-        GstPadLinkReturn ret = gst_pad_link(new_pad, converter_sink);
-        if (GST_PAD_LINK_FAILED(ret)) {
-            g_printerr("Could not link video pad\n");
-        }
+    gst_element_set_state(state->pipeline, GST_STATE_PAUSED);
+    if (gst_element_get_state(state->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE) == GST_STATE_CHANGE_FAILURE) {
+        return;
+    }
+    if (settings->start_position >= 0 && !seek_index_seek(state->seek_index, state->pipeline, settings->start_position, state->seek_mode)) {
+        g_printerr("Could not seek to the start position\n");
     }
+    if (has_rate && !rate_control_set(state->rate_control, settings->speed, TRUE)) {
+        g_printerr("Failed to update speed rate.\n");
+    }
+    // Wait for the preroll after a flush, so playback starts at the new position
+    gst_element_get_state(state->pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+}
 
-exit:
-    if (converter_sink) {
-        gst_object_unref(converter_sink);
+static void print_render_stats(Settings* settings, gint64 wall_time_us, gint64 media_duration) {
+    GStatBuf st;
+    gint64 bytes_written = 0;
+    if (g_stat(settings->output_path, &st) == 0) {
+        bytes_written = st.st_size;
     }
-    if (new_pad_caps) {
-        gst_caps_unref(new_pad_caps);
+
+    double wall_seconds = wall_time_us / (double)G_USEC_PER_SEC;
+    g_print("Rendered to %s\n", settings->output_path);
+    g_print("  wall-clock time: %.3f s\n", wall_seconds);
+    if (media_duration > 0 && wall_seconds > 0) {
+        double media_seconds = media_duration / (double)GST_SECOND;
+        g_print("  media duration: %.3f s\n", media_seconds);
+        g_print("  realtime factor: %.2fx\n", media_seconds / wall_seconds);
+    } else {
+        g_print("  realtime factor: unknown (no duration)\n");
     }
+    g_print("  bytes written: %" G_GINT64_FORMAT "\n", bytes_written);
 }
 
 static void handle_message(GstMessage *message, State *state, Settings* settings) {
+    metrics_count_message(state->metrics, message);
     switch (GST_MESSAGE_TYPE(message)) {
         case GST_MESSAGE_ERROR: {
             GError* err;
@@ -186,18 +321,61 @@ static void handle_message(GstMessage *message, State *state, Settings* settings
             state->is_running = FALSE;
             break;
         }
+        case GST_MESSAGE_WARNING: {
+            GError* err;
+            gchar* debug_info;
+
+            gst_message_parse_warning(message, &err, &debug_info);
+            g_printerr("Warning from %s: %s\n", GST_OBJECT_NAME(message->src), err->message);
+
+            g_clear_error(&err);
+            g_free(debug_info);
+            break;
+        }
         case GST_MESSAGE_EOS: {
             state->is_running = FALSE;
             break;
         }
         case GST_MESSAGE_STATE_CHANGED: {
-            // if speed rate wanst updated yet and thats the object we need
+            // Only the pipeline's own state matters, elements change state on their own schedule
             if (GST_MESSAGE_SRC(message) == GST_OBJECT(state->pipeline)) {
                 GstState old_state, new_state, pend_state;
                 // parse the message
                 gst_message_parse_state_changed(message, &old_state, &new_state, &pend_state);
                 state->is_playing = new_state == GST_STATE_PLAYING;
+                if (state->is_playing) {
+                    state_report_passthrough_converters(state);
+                    state_report_audio_links(state);
+                    if (settings->is_low_latency && !state->is_latency_reported) {
+                        latency_report(state->pipeline);
+                        state->is_latency_reported = TRUE;
+                    }
+                }
+            }
+            break;
+        }
+        case GST_MESSAGE_LATENCY: {
+            // Some element changed its latency, e.g. the audio sink after opening the device
+            gst_bin_recalculate_latency(GST_BIN(state->pipeline));
+            if (settings->is_low_latency && state->is_latency_reported) {
+                latency_report(state->pipeline);
+            }
+            break;
+        }
+        case GST_MESSAGE_APPLICATION: {
+            if (state->playlist && playlist_handle_message(state->playlist, message)) {
+                break;
             }
+            g_printerr("Unexpected application message\n");
+            break;
+        }
+        case GST_MESSAGE_ELEMENT: {
+            // Other element messages, like the ones from sinks, are of no interest here
+            audio_analysis_print_message(message);
+            break;
+        }
+        case GST_MESSAGE_QOS: {
+            qos_handle_message(state->qos, message);
             break;
         }
         default: {
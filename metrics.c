@@ -0,0 +1,459 @@
+#include "metrics.h"
+#include "qos.h"
+#include "rate.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#define METRICS_PREFIX "player_"
+#define METRICS_MAX_REQUEST 1024
+
+typedef struct BranchRate {
+    guint64 rendered; // at the last snapshot
+    gint64 time;
+} BranchRate;
+
+struct Metrics {
+    State* state;
+    char* path; // null when only served
+    guint64 interval; // in microseconds
+    int listen_fd; // -1 when only written
+    int wake_pipe[2]; // written by metrics_stop to break out of poll
+    GThread* thread;
+
+    BranchRate audio_rate; // only touched by the thread
+    BranchRate video_rate;
+
+    GMutex lock; // everything below
+    GHashTable* message_counts; // message type name -> guint64*
+    gchar* snapshot; // last Prometheus text
+};
+
+void metrics_count_message(Metrics* metrics, GstMessage* message) {
+    if (!metrics) {
+        return;
+    }
+    const gchar* type = gst_message_type_get_name(GST_MESSAGE_TYPE(message));
+    g_mutex_lock(&metrics->lock);
+    guint64* count = g_hash_table_lookup(metrics->message_counts, type);
+    if (!count) {
+        count = g_new0(guint64, 1);
+        g_hash_table_insert(metrics->message_counts, (gpointer)type, count);
+    }
+    (*count)++;
+    g_mutex_unlock(&metrics->lock);
+}
+
+// Label values may hold any byte, thread names for example come from pad names
+static gchar* escape_label(const char* value) {
+    GString* escaped = g_string_new(NULL);
+    for (const char* c = value; *c; ++c) {
+        if (*c == '\\' || *c == '"') {
+            g_string_append_c(escaped, '\\');
+            g_string_append_c(escaped, *c);
+        } else if (*c == '\n') {
+            g_string_append(escaped, "\\n");
+        } else {
+            g_string_append_c(escaped, *c);
+        }
+    }
+    return g_string_free(escaped, FALSE);
+}
+
+static void append_help(GString* out, const char* name, const char* type, const char* help) {
+    g_string_append_printf(out, "# HELP " METRICS_PREFIX "%s %s\n# TYPE " METRICS_PREFIX "%s %s\n", name, help, name, type);
+}
+
+// The GstBaseSink inside an auto*sink, the encoder bins of render mode have none
+static GstElement* find_base_sink(GstElement* sink) {
+    if (!GST_IS_BIN(sink)) {
+        return g_object_class_find_property(G_OBJECT_GET_CLASS(sink), "stats") ? gst_object_ref(sink) : NULL;
+    }
+    GstElement* found = NULL;
+    GstIterator* it = gst_bin_iterate_sinks(GST_BIN(sink));
+    GValue item = G_VALUE_INIT;
+    while (!found && gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        found = find_base_sink(g_value_get_object(&item));
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    return found;
+}
+
+typedef struct BranchSample {
+    const char* branch;
+    guint64 rendered;
+    guint64 dropped;
+    double per_second;
+} BranchSample;
+
+static gboolean read_branch(GstElement* sink, BranchRate* rate, gint64 now, BranchSample* sample) {
+    GstElement* base_sink = sink ? find_base_sink(sink) : NULL;
+    if (!base_sink) {
+        return FALSE;
+    }
+    GstStructure* stats = NULL;
+    g_object_get(base_sink, "stats", &stats, NULL);
+    gst_object_unref(base_sink);
+    if (!stats) {
+        return FALSE;
+    }
+
+    sample->rendered = 0;
+    sample->dropped = 0;
+    gst_structure_get_uint64(stats, "rendered", &sample->rendered);
+    gst_structure_get_uint64(stats, "dropped", &sample->dropped);
+    gst_structure_free(stats);
+
+    // Over the last interval, the sink's own average-rate only covers its last few buffers
+    sample->per_second = 0.0;
+    if (rate->time && now > rate->time && sample->rendered >= rate->rendered) {
+        sample->per_second = (sample->rendered - rate->rendered) * (double)G_USEC_PER_SEC / (now - rate->time);
+    }
+    rate->rendered = sample->rendered;
+    rate->time = now;
+    return TRUE;
+}
+
+typedef struct QueueSample {
+    const gchar* name;
+    guint level_buffers;
+    guint level_bytes;
+    guint64 level_time;
+    double fill;
+} QueueSample;
+
+static gboolean read_queue(GstElement* queue, QueueSample* sample) {
+    if (!queue) {
+        return FALSE;
+    }
+    guint max_buffers;
+    guint max_bytes;
+    guint64 max_time;
+    g_object_get(queue, "current-level-buffers", &sample->level_buffers, "current-level-bytes", &sample->level_bytes,
+                 "current-level-time", &sample->level_time, "max-size-buffers", &max_buffers, "max-size-bytes", &max_bytes,
+                 "max-size-time", &max_time, NULL);
+
+    // The queue is full at whichever limit is reached first, 0 disables a limit
+    sample->fill = 0.0;
+    if (max_buffers) {
+        sample->fill = MAX(sample->fill, sample->level_buffers / (double)max_buffers);
+    }
+    if (max_bytes) {
+        sample->fill = MAX(sample->fill, sample->level_bytes / (double)max_bytes);
+    }
+    if (max_time) {
+        sample->fill = MAX(sample->fill, sample->level_time / (double)max_time);
+    }
+    sample->name = GST_OBJECT_NAME(queue);
+    return TRUE;
+}
+
+// utime and stime of every thread of the process. Streaming threads are named after the pad
+// their task runs on, cut to 15 characters by the kernel.
+static void append_threads(GString* out) {
+    GDir* dir = g_dir_open("/proc/self/task", 0, NULL);
+    if (!dir) {
+        return;
+    }
+    double ticks_per_second = sysconf(_SC_CLK_TCK);
+    const gchar* tid;
+    while ((tid = g_dir_read_name(dir))) {
+        gchar* stat_path = g_build_filename("/proc/self/task", tid, "stat", NULL);
+        gchar* contents = NULL;
+        if (g_file_get_contents(stat_path, &contents, NULL, NULL)) {
+            // "tid (comm) state ...", comm may contain spaces and parentheses itself
+            char* open = strchr(contents, '(');
+            char* close = strrchr(contents, ')');
+            unsigned long utime;
+            unsigned long stime;
+            // utime and stime are fields 14 and 15, the state after comm is field 3
+            if (open && close && close > open
+                && sscanf(close + 2, "%*c %*d %*d %*d %*d %*d %*u %*lu %*lu %*lu %*lu %lu %lu", &utime, &stime) == 2) {
+                *close = '\0';
+                gchar* name = escape_label(open + 1);
+                g_string_append_printf(out, METRICS_PREFIX "thread_cpu_seconds_total{thread=\"%s\",tid=\"%s\"} %.2f\n",
+                                       name, tid, (utime + stime) / ticks_per_second);
+                g_free(name);
+            }
+        }
+        g_free(contents);
+        g_free(stat_path);
+    }
+    g_dir_close(dir);
+}
+
+static gchar* collect(Metrics* metrics) {
+    State* state = metrics->state;
+    GString* out = g_string_new(NULL);
+    gint64 now = g_get_monotonic_time();
+
+    // Every family is written in one piece, after its HELP and TYPE lines
+    BranchSample branches[2];
+    int branch_count = 0;
+    branches[branch_count].branch = "audio";
+    branch_count += read_branch(state->audio_sink, &metrics->audio_rate, now, &branches[branch_count]);
+    branches[branch_count].branch = "video";
+    branch_count += !state->is_audio_only && read_branch(state->video_sink, &metrics->video_rate, now, &branches[branch_count]);
+
+    append_help(out, "branch_buffers_total", "counter", "Buffers rendered by the sink of each branch.");
+    for (int i = 0; i < branch_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "branch_buffers_total{branch=\"%s\"} %" G_GUINT64_FORMAT "\n", branches[i].branch, branches[i].rendered);
+    }
+    append_help(out, "branch_buffers_per_second", "gauge", "Buffers rendered per second over the last interval.");
+    for (int i = 0; i < branch_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "branch_buffers_per_second{branch=\"%s\"} %.2f\n", branches[i].branch, branches[i].per_second);
+    }
+    append_help(out, "branch_buffers_dropped_total", "counter", "Buffers the sink of each branch dropped.");
+    for (int i = 0; i < branch_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "branch_buffers_dropped_total{branch=\"%s\"} %" G_GUINT64_FORMAT "\n", branches[i].branch, branches[i].dropped);
+    }
+
+    gint64 position = -1;
+    gint64 duration = -1;
+    gst_element_query_position(state->pipeline, GST_FORMAT_TIME, &position);
+    gst_element_query_duration(state->pipeline, GST_FORMAT_TIME, &duration);
+    append_help(out, "position_seconds", "gauge", "Playback position, -1 when unknown.");
+    g_string_append_printf(out, METRICS_PREFIX "position_seconds %.3f\n", position >= 0 ? position / (double)GST_SECOND : -1.0);
+    append_help(out, "duration_seconds", "gauge", "Media duration, -1 when unknown.");
+    g_string_append_printf(out, METRICS_PREFIX "duration_seconds %.3f\n", duration >= 0 ? duration / (double)GST_SECOND : -1.0);
+    append_help(out, "rate", "gauge", "Playback rate at the audio sink.");
+    g_string_append_printf(out, METRICS_PREFIX "rate %.3f\n", state->rate_control ? rate_control_get(state->rate_control) : 1.0);
+    append_help(out, "playing", "gauge", "1 while the pipeline is PLAYING.");
+    g_string_append_printf(out, METRICS_PREFIX "playing %d\n", state->is_playing ? 1 : 0);
+
+    GstElement* queues[] = {state->audio_queue, state->video_queue, state->pitch_queue, state->noise_queue};
+    QueueSample queue_samples[ARRAY_SIZE(queues)];
+    int queue_count = 0;
+    for (int i = 0; i < ARRAY_SIZE(queues); ++i) {
+        queue_count += read_queue(queues[i], &queue_samples[queue_count]);
+    }
+    append_help(out, "queue_level_buffers", "gauge", "Buffers in each thread boundary queue.");
+    for (int i = 0; i < queue_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "queue_level_buffers{queue=\"%s\"} %u\n", queue_samples[i].name, queue_samples[i].level_buffers);
+    }
+    append_help(out, "queue_level_bytes", "gauge", "Bytes in each thread boundary queue.");
+    for (int i = 0; i < queue_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "queue_level_bytes{queue=\"%s\"} %u\n", queue_samples[i].name, queue_samples[i].level_bytes);
+    }
+    append_help(out, "queue_level_seconds", "gauge", "Media time in each thread boundary queue.");
+    for (int i = 0; i < queue_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "queue_level_seconds{queue=\"%s\"} %.3f\n", queue_samples[i].name,
+                               queue_samples[i].level_time / (double)GST_SECOND);
+    }
+    append_help(out, "queue_fill_ratio", "gauge", "Level of each queue relative to the first limit it reaches.");
+    for (int i = 0; i < queue_count; ++i) {
+        g_string_append_printf(out, METRICS_PREFIX "queue_fill_ratio{queue=\"%s\"} %.3f\n", queue_samples[i].name, queue_samples[i].fill);
+    }
+
+    if (state->qos) {
+        QosTotals totals;
+        qos_get_video_totals(state->qos, &totals);
+        append_help(out, "video_frames_processed_total", "counter", "Video frames processed, as of the last QoS message.");
+        g_string_append_printf(out, METRICS_PREFIX "video_frames_processed_total %" G_GUINT64_FORMAT "\n", totals.processed);
+        append_help(out, "video_frames_dropped_total", "counter", "Video frames dropped for being late.");
+        g_string_append_printf(out, METRICS_PREFIX "video_frames_dropped_total %" G_GUINT64_FORMAT "\n", totals.dropped);
+        append_help(out, "video_frames_late_total", "counter", "QoS messages about late video frames.");
+        g_string_append_printf(out, METRICS_PREFIX "video_frames_late_total %" G_GUINT64_FORMAT "\n", totals.late);
+        append_help(out, "qos_level", "gauge", "Video degradation level of --qos-adapt, 0 is full quality.");
+        g_string_append_printf(out, METRICS_PREFIX "qos_level %d\n", totals.level);
+    }
+
+    append_help(out, "bus_messages_total", "counter", "Bus messages handled by the player, by type.");
+    g_mutex_lock(&metrics->lock);
+    GHashTableIter iter;
+    gpointer type;
+    gpointer count;
+    g_hash_table_iter_init(&iter, metrics->message_counts);
+    while (g_hash_table_iter_next(&iter, &type, &count)) {
+        g_string_append_printf(out, METRICS_PREFIX "bus_messages_total{type=\"%s\"} %" G_GUINT64_FORMAT "\n",
+                               (const char*)type, *(guint64*)count);
+    }
+    g_mutex_unlock(&metrics->lock);
+
+    append_help(out, "thread_cpu_seconds_total", "counter", "User and system CPU time of each thread.");
+    append_threads(out);
+    return g_string_free(out, FALSE);
+}
+
+static void refresh(Metrics* metrics) {
+    gchar* snapshot = collect(metrics);
+    if (metrics->path) {
+        // Written next to the file and renamed over it, so readers never see half of it
+        GError* err = NULL;
+        if (!g_file_set_contents(metrics->path, snapshot, -1, &err)) {
+            g_printerr("Could not write metrics: %s\n", err->message);
+            g_error_free(err);
+        }
+    }
+    g_mutex_lock(&metrics->lock);
+    g_free(metrics->snapshot);
+    metrics->snapshot = snapshot;
+    g_mutex_unlock(&metrics->lock);
+}
+
+// Same as the control socket: a large body can take several sends, and a scraper that hung up
+// must not raise SIGPIPE
+static gboolean write_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t n = send(fd, data, length, MSG_NOSIGNAL);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return FALSE;
+        }
+        data += n;
+        length -= n;
+    }
+    return TRUE;
+}
+
+// Any request gets the last snapshot, it is a local scrape endpoint and not a web server
+static void serve(Metrics* metrics, int fd) {
+    struct pollfd request = {fd, POLLIN, 0};
+    char buffer[METRICS_MAX_REQUEST];
+    if (poll(&request, 1, 100) > 0 && read(fd, buffer, sizeof(buffer)) < 0) {
+        return;
+    }
+
+    g_mutex_lock(&metrics->lock);
+    gchar* body = g_strdup(metrics->snapshot ? metrics->snapshot : "");
+    g_mutex_unlock(&metrics->lock);
+    gchar* response = g_strdup_printf("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\n"
+                                      "Content-Length: %zu\r\nConnection: close\r\n\r\n%s", strlen(body), body);
+    if (!write_all(fd, response, strlen(response))) {
+        g_printerr("Could not send metrics: %s\n", g_strerror(errno));
+    }
+    g_free(response);
+    g_free(body);
+}
+
+static gpointer metrics_thread(Metrics* metrics) {
+    struct pollfd fds[2];
+    gint64 next_refresh = 0;
+
+    while (TRUE) {
+        gint64 now = g_get_monotonic_time();
+        if (now >= next_refresh) {
+            refresh(metrics);
+            next_refresh = now + metrics->interval;
+        }
+
+        fds[0].fd = metrics->wake_pipe[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = metrics->listen_fd;
+        fds[1].events = POLLIN;
+        int timeout = (next_refresh - now + 999) / 1000;
+        if (poll(fds, metrics->listen_fd >= 0 ? 2 : 1, timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            g_printerr("Metrics poll failed: %s\n", g_strerror(errno));
+            break;
+        }
+        if (fds[0].revents) {
+            break;
+        }
+        if (metrics->listen_fd >= 0 && fds[1].revents & POLLIN) {
+            int fd = accept(metrics->listen_fd, NULL, NULL);
+            if (fd >= 0) {
+                serve(metrics, fd);
+                close(fd);
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static int listen_local(guint port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        g_printerr("Could not create metrics socket: %s\n", g_strerror(errno));
+        return -1;
+    }
+    int reuse = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+
+    struct sockaddr_in addr = {0};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd, 4) < 0) {
+        g_printerr("Could not listen on 127.0.0.1:%u: %s\n", port, g_strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+Metrics* metrics_start(State* state, Settings* settings) {
+    if (!settings->metrics_path && !settings->metrics_port) {
+        return NULL;
+    }
+
+    int listen_fd = -1;
+    if (settings->metrics_port) {
+        listen_fd = listen_local(settings->metrics_port);
+        if (listen_fd < 0) {
+            return NULL;
+        }
+    }
+
+    Metrics* metrics = g_new0(Metrics, 1);
+    metrics->state = state;
+    metrics->path = g_strdup(settings->metrics_path);
+    metrics->interval = settings->metrics_interval / GST_USECOND;
+    metrics->listen_fd = listen_fd;
+    // Type names are static strings
+    metrics->message_counts = g_hash_table_new_full(g_str_hash, g_str_equal, NULL, g_free);
+    g_mutex_init(&metrics->lock);
+    if (pipe(metrics->wake_pipe) < 0) {
+        g_printerr("Could not create metrics wake pipe\n");
+        if (listen_fd >= 0) {
+            close(listen_fd);
+        }
+        g_hash_table_destroy(metrics->message_counts);
+        g_mutex_clear(&metrics->lock);
+        g_free(metrics->path);
+        g_free(metrics);
+        return NULL;
+    }
+
+    metrics->thread = g_thread_new("metrics", (GThreadFunc)metrics_thread, metrics);
+    return metrics;
+}
+
+void metrics_stop(Metrics* metrics) {
+    if (!metrics) {
+        return;
+    }
+
+    char byte = 0;
+    if (write(metrics->wake_pipe[1], &byte, 1) < 0) {
+        g_printerr("Could not wake metrics thread\n");
+    }
+    g_thread_join(metrics->thread);
+    // The bus loop is done, so the final counts (an error, EOS) make it into the file
+    refresh(metrics);
+
+    if (metrics->listen_fd >= 0) {
+        close(metrics->listen_fd);
+    }
+    close(metrics->wake_pipe[0]);
+    close(metrics->wake_pipe[1]);
+    g_hash_table_destroy(metrics->message_counts);
+    g_mutex_clear(&metrics->lock);
+    g_free(metrics->snapshot);
+    g_free(metrics->path);
+    g_free(metrics);
+}
@@ -0,0 +1,23 @@
+#ifndef __METRICS_H
+#define __METRICS_H
+
+#include "gst/gstmessage.h"
+#include "settings.h"
+#include "state.h"
+
+// Prometheus text format metrics of one player, for fleet monitoring. A thread of its own takes a
+// snapshot every settings->metrics_interval and writes it to settings->metrics_path (replaced
+// atomically) and/or serves it over HTTP on 127.0.0.1:settings->metrics_port. Everything is read
+// from outside the streaming threads: sink "stats", queue levels, the QoS and rate trackers,
+// position queries, the bus loop and /proc/self/task for the CPU time of every thread.
+typedef struct Metrics Metrics;
+
+// Null when neither a path nor a port is set, or the port could not be bound
+Metrics* metrics_start(State* state, Settings* settings);
+// Writes the file one last time
+void metrics_stop(Metrics* metrics);
+
+// Every message the bus loop handles, counted by type
+void metrics_count_message(Metrics* metrics, GstMessage* message);
+
+#endif
@@ -0,0 +1,391 @@
+#include "mmapsrc.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/base/gstbasesrc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// One mapped region of the file, shared by the source and every buffer pointing into it
+typedef struct MmapWindow {
+    gint refcount;
+    guint8* data;
+    guint64 offset; // in the file, page aligned
+    gsize length;
+    gint slot; // in the fault table, -1 if it was full
+} MmapWindow;
+
+// Mapped windows the SIGBUS handler may patch, a slot is free while its start is null. The
+// handler cannot take locks, so the length is written before the start is published.
+static gpointer fault_starts[MMAP_SRC_MAX_WINDOWS];
+static gsize fault_lengths[MMAP_SRC_MAX_WINDOWS];
+static struct sigaction previous_sigbus;
+
+typedef struct MmapSrc {
+    GstBaseSrc parent;
+
+    gchar* location; // guarded by the object lock
+
+    // Streaming thread only, between start and stop
+    int fd;
+    guint64 size;
+    MmapWindow* window; // the one the last read came from, null before the first read
+    guint64 read_end; // end of the last read, any other offset is a seek
+    guint64 advised_end; // WILLNEED was given up to here
+} MmapSrc;
+
+typedef struct MmapSrcClass {
+    GstBaseSrcClass parent_class;
+} MmapSrcClass;
+
+enum {
+    PROP_0,
+    PROP_LOCATION,
+};
+
+#define MMAP_SRC(obj) ((MmapSrc*)(obj))
+
+static GstStaticPadTemplate src_template = GST_STATIC_PAD_TEMPLATE("src", GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static void mmap_src_uri_handler_init(gpointer g_iface, gpointer iface_data);
+
+G_DEFINE_TYPE_WITH_CODE(MmapSrc, mmap_src, GST_TYPE_BASE_SRC,
+                        G_IMPLEMENT_INTERFACE(GST_TYPE_URI_HANDLER, mmap_src_uri_handler_init))
+
+// ---------------------------------------------------------------------------
+// SIGBUS
+// ---------------------------------------------------------------------------
+
+// A page past the end of a truncated file raises SIGBUS wherever it is read, mostly inside the
+// demuxer. A fault inside a window gets an anonymous zero page mapped over the faulting page, so
+// the read returns zeros instead of killing the player, and the size check in create ends the
+// stream with an error. mmap is a plain system call on Linux, though POSIX does not list it as
+// async-signal-safe.
+static void sigbus_handler(int signal, siginfo_t* info, void* context) {
+    guint8* address = info->si_addr;
+    for (gint i = 0; i < MMAP_SRC_MAX_WINDOWS; ++i) {
+        guint8* start = g_atomic_pointer_get(&fault_starts[i]);
+        if (start && address >= start && address < start + fault_lengths[i]) {
+            guintptr page_size = sysconf(_SC_PAGESIZE);
+            void* page = (void*)((guintptr)address - (guintptr)address % page_size);
+            if (mmap(page, page_size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0) != MAP_FAILED) {
+                return;
+            }
+            break;
+        }
+    }
+
+    // Not one of ours, let the previous handler or the default action have it
+    if (previous_sigbus.sa_flags & SA_SIGINFO) {
+        previous_sigbus.sa_sigaction(signal, info, context);
+    } else if (previous_sigbus.sa_handler != SIG_DFL && previous_sigbus.sa_handler != SIG_IGN) {
+        previous_sigbus.sa_handler(signal);
+    } else {
+        // The faulting read runs again and gets the default action
+        sigaction(SIGBUS, &previous_sigbus, NULL);
+    }
+}
+
+static void install_sigbus_handler(void) {
+    struct sigaction action = {0};
+    action.sa_sigaction = sigbus_handler;
+    action.sa_flags = SA_SIGINFO | SA_NODEFER;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGBUS, &action, &previous_sigbus);
+}
+
+static gint fault_slot_claim(guint8* data, gsize length) {
+    for (gint i = 0; i < MMAP_SRC_MAX_WINDOWS; ++i) {
+        if (g_atomic_pointer_get(&fault_starts[i]) == NULL) {
+            fault_lengths[i] = length;
+            if (g_atomic_pointer_compare_and_exchange(&fault_starts[i], NULL, data)) {
+                return i;
+            }
+        }
+    }
+    return -1;
+}
+
+static void fault_slot_release(gint slot) {
+    if (slot >= 0) {
+        g_atomic_pointer_set(&fault_starts[slot], NULL);
+    }
+}
+
+// ---------------------------------------------------------------------------
+// Windows
+// ---------------------------------------------------------------------------
+
+static MmapWindow* window_ref(MmapWindow* window) {
+    g_atomic_int_inc(&window->refcount);
+    return window;
+}
+
+static void window_unref(gpointer data) {
+    MmapWindow* window = data;
+    if (window && g_atomic_int_dec_and_test(&window->refcount)) {
+        fault_slot_release(window->slot);
+        munmap(window->data, window->length);
+        g_free(window);
+    }
+}
+
+// Covers [offset, offset + size), which the caller made sure lies inside the file
+static MmapWindow* window_map(MmapSrc* self, guint64 offset, gsize size) {
+    guint64 page_size = sysconf(_SC_PAGESIZE);
+    guint64 start = offset - offset % page_size;
+    gsize length = MIN(MAX((guint64)MMAP_SRC_WINDOW, offset + size - start), self->size - start);
+
+    void* data = mmap(NULL, length, PROT_READ, MAP_SHARED, self->fd, start);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    madvise(data, length, MADV_SEQUENTIAL);
+
+    MmapWindow* window = g_new(MmapWindow, 1);
+    window->refcount = 1;
+    window->data = data;
+    window->offset = start;
+    window->length = length;
+    window->slot = fault_slot_claim(data, length);
+    if (window->slot < 0) {
+        GST_WARNING_OBJECT(self, "More than %d windows mapped, truncating the file now would SIGBUS", MMAP_SRC_MAX_WINDOWS);
+    }
+    return window;
+}
+
+static gboolean window_covers(MmapWindow* window, guint64 offset, gsize size) {
+    return window && offset >= window->offset && offset + size <= window->offset + window->length;
+}
+
+// ---------------------------------------------------------------------------
+// GstBaseSrc
+// ---------------------------------------------------------------------------
+
+static gboolean mmap_src_start(GstBaseSrc* src) {
+    MmapSrc* self = MMAP_SRC(src);
+
+    GST_OBJECT_LOCK(self);
+    gchar* location = g_strdup(self->location);
+    GST_OBJECT_UNLOCK(self);
+    if (!location) {
+        GST_ELEMENT_ERROR(self, RESOURCE, NOT_FOUND, ("No file name specified for reading."), (NULL));
+        return FALSE;
+    }
+
+    self->fd = open(location, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (self->fd < 0 || fstat(self->fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        GST_ELEMENT_ERROR(self, RESOURCE, OPEN_READ, ("Could not open regular file \"%s\" for reading.", location), ("%s", g_strerror(errno)));
+        if (self->fd >= 0) {
+            close(self->fd);
+            self->fd = -1;
+        }
+        g_free(location);
+        return FALSE;
+    }
+    g_free(location);
+
+    self->size = st.st_size;
+    self->window = NULL;
+    self->read_end = 0;
+    self->advised_end = 0;
+    posix_fadvise(self->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    return TRUE;
+}
+
+static gboolean mmap_src_stop(GstBaseSrc* src) {
+    MmapSrc* self = MMAP_SRC(src);
+    window_unref(self->window);
+    self->window = NULL;
+    if (self->fd >= 0) {
+        close(self->fd);
+        self->fd = -1;
+    }
+    return TRUE;
+}
+
+static gboolean mmap_src_get_size(GstBaseSrc* src, guint64* size) {
+    MmapSrc* self = MMAP_SRC(src);
+    if (self->fd < 0) {
+        return FALSE;
+    }
+    *size = self->size;
+    return TRUE;
+}
+
+static gboolean mmap_src_is_seekable(GstBaseSrc* src) {
+    return TRUE;
+}
+
+// The page cache reads ahead of sequential read() calls by itself, page faults on a mapping
+// only get that with the hints
+static void advise_readahead(MmapSrc* self, guint64 offset, gsize size) {
+    if (offset != self->read_end) {
+        self->advised_end = offset;
+    }
+    self->read_end = offset + size;
+    if (self->advised_end >= MIN(self->read_end + MMAP_SRC_READAHEAD / 2, self->size)) {
+        return;
+    }
+    guint64 end = MIN(self->read_end + MMAP_SRC_READAHEAD, self->size);
+    posix_fadvise(self->fd, self->advised_end, end - self->advised_end, POSIX_FADV_WILLNEED);
+    self->advised_end = end;
+}
+
+static GstFlowReturn mmap_src_create(GstBaseSrc* src, guint64 offset, guint size, GstBuffer** buffer) {
+    MmapSrc* self = MMAP_SRC(src);
+    if (offset >= self->size) {
+        return GST_FLOW_EOS;
+    }
+    gsize length = MIN((guint64)size, self->size - offset);
+
+    // Touching pages past the end of a truncated file raises SIGBUS, so the size is checked first
+    struct stat st;
+    if (fstat(self->fd, &st) != 0 || (guint64)st.st_size < offset + length) {
+        GST_ELEMENT_ERROR(self, RESOURCE, READ, ("File was truncated while it was being read."), (NULL));
+        return GST_FLOW_ERROR;
+    }
+
+    if (!window_covers(self->window, offset, length)) {
+        MmapWindow* window = window_map(self, offset, length);
+        if (!window) {
+            GST_ELEMENT_ERROR(self, RESOURCE, READ, ("Could not map the file at offset %" G_GUINT64_FORMAT ".", offset), ("%s", g_strerror(errno)));
+            return GST_FLOW_ERROR;
+        }
+        window_unref(self->window);
+        self->window = window;
+    }
+    advise_readahead(self, offset, length);
+
+    MmapWindow* window = self->window;
+    GstMemory* memory = gst_memory_new_wrapped(GST_MEMORY_FLAG_READONLY, window->data, window->length,
+                                               offset - window->offset, length, window_ref(window), window_unref);
+    *buffer = gst_buffer_new();
+    gst_buffer_append_memory(*buffer, memory);
+    GST_BUFFER_OFFSET(*buffer) = offset;
+    GST_BUFFER_OFFSET_END(*buffer) = offset + length;
+    return GST_FLOW_OK;
+}
+
+// ---------------------------------------------------------------------------
+// Properties and URI handler
+// ---------------------------------------------------------------------------
+
+static gboolean set_location(MmapSrc* self, const gchar* location, GError** error) {
+    GstState state;
+    GST_OBJECT_LOCK(self);
+    state = GST_STATE(self);
+    if (state != GST_STATE_NULL && state != GST_STATE_READY) {
+        GST_OBJECT_UNLOCK(self);
+        g_set_error(error, GST_URI_ERROR, GST_URI_ERROR_BAD_STATE, "Changing the location of an open file is not supported");
+        return FALSE;
+    }
+    g_free(self->location);
+    self->location = g_strdup(location);
+    GST_OBJECT_UNLOCK(self);
+    return TRUE;
+}
+
+static void mmap_src_set_property(GObject* object, guint prop_id, const GValue* value, GParamSpec* pspec) {
+    switch (prop_id) {
+        case PROP_LOCATION: set_location(MMAP_SRC(object), g_value_get_string(value), NULL); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+}
+
+static void mmap_src_get_property(GObject* object, guint prop_id, GValue* value, GParamSpec* pspec) {
+    MmapSrc* self = MMAP_SRC(object);
+
+    GST_OBJECT_LOCK(self);
+    switch (prop_id) {
+        case PROP_LOCATION: g_value_set_string(value, self->location); break;
+        default: G_OBJECT_WARN_INVALID_PROPERTY_ID(object, prop_id, pspec); break;
+    }
+    GST_OBJECT_UNLOCK(self);
+}
+
+static GstURIType mmap_src_uri_get_type(GType type) {
+    return GST_URI_SRC;
+}
+
+static const gchar* const* mmap_src_uri_get_protocols(GType type) {
+    static const gchar* protocols[] = {"file", NULL};
+    return protocols;
+}
+
+static gchar* mmap_src_uri_get_uri(GstURIHandler* handler) {
+    MmapSrc* self = MMAP_SRC(handler);
+    GST_OBJECT_LOCK(self);
+    gchar* uri = self->location ? g_filename_to_uri(self->location, NULL, NULL) : NULL;
+    GST_OBJECT_UNLOCK(self);
+    return uri;
+}
+
+static gboolean mmap_src_uri_set_uri(GstURIHandler* handler, const gchar* uri, GError** error) {
+    gchar* location = g_filename_from_uri(uri, NULL, NULL);
+    if (!location) {
+        g_set_error(error, GST_URI_ERROR, GST_URI_ERROR_BAD_URI, "Not a local file URI: %s", uri);
+        return FALSE;
+    }
+    gboolean is_set = set_location(MMAP_SRC(handler), location, error);
+    g_free(location);
+    return is_set;
+}
+
+static void mmap_src_uri_handler_init(gpointer g_iface, gpointer iface_data) {
+    GstURIHandlerInterface* iface = g_iface;
+    iface->get_type = mmap_src_uri_get_type;
+    iface->get_protocols = mmap_src_uri_get_protocols;
+    iface->get_uri = mmap_src_uri_get_uri;
+    iface->set_uri = mmap_src_uri_set_uri;
+}
+
+static void mmap_src_finalize(GObject* object) {
+    g_free(MMAP_SRC(object)->location);
+    G_OBJECT_CLASS(mmap_src_parent_class)->finalize(object);
+}
+
+static void mmap_src_class_init(MmapSrcClass* klass) {
+    GObjectClass* gobject_class = G_OBJECT_CLASS(klass);
+    GstElementClass* element_class = GST_ELEMENT_CLASS(klass);
+    GstBaseSrcClass* src_class = GST_BASE_SRC_CLASS(klass);
+
+    gobject_class->set_property = mmap_src_set_property;
+    gobject_class->get_property = mmap_src_get_property;
+    gobject_class->finalize = mmap_src_finalize;
+
+    g_object_class_install_property(gobject_class, PROP_LOCATION,
+        g_param_spec_string("location", "File Location", "Location of the file to read", NULL,
+                            G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS | GST_PARAM_MUTABLE_READY));
+
+    gst_element_class_set_static_metadata(element_class, "Memory-mapped file source", "Source/File",
+        "Reads a local file through mmap, buffers wrap the mapped pages", "media-player-gst");
+    gst_element_class_add_static_pad_template(element_class, &src_template);
+
+    src_class->start = mmap_src_start;
+    src_class->stop = mmap_src_stop;
+    src_class->get_size = mmap_src_get_size;
+    src_class->is_seekable = mmap_src_is_seekable;
+    src_class->create = mmap_src_create;
+}
+
+static void mmap_src_init(MmapSrc* self) {
+    self->location = NULL;
+    self->fd = -1;
+    self->window = NULL;
+    gst_base_src_set_blocksize(GST_BASE_SRC(self), MMAP_SRC_BLOCKSIZE);
+}
+
+void mmap_src_register(void) {
+    static gsize is_registered = 0;
+    if (g_once_init_enter(&is_registered)) {
+        install_sigbus_handler();
+        gst_element_register(NULL, MMAP_SRC_FACTORY, GST_RANK_PRIMARY + 1, mmap_src_get_type());
+        g_once_init_leave(&is_registered, 1);
+    }
+}
@@ -0,0 +1,29 @@
+#ifndef __MMAP_SRC_H
+#define __MMAP_SRC_H
+
+#include "gst/gstelement.h"
+
+// In-tree source reading a local file through mmap instead of read(). Buffers wrap the mapped
+// pages read-only, nothing gets copied on the way to the demuxer. The file is mapped in windows
+// of MMAP_SRC_WINDOW bytes. Buffers keep their window mapped until they are freed, so a seek
+// only maps the new region. The kernel gets MADV_SEQUENTIAL on every window and a WILLNEED
+// hint for the MMAP_SRC_READAHEAD bytes ahead of the last read.
+//
+// A mapped file that gets truncated raises SIGBUS on the pages past its new end, also when a
+// demuxer reads a buffer that was handed out before. Registering installs a SIGBUS handler that
+// maps a zero page over a faulting page of any window, so such reads see zeros, and the size
+// check before every buffer ends the stream with an error. Only the first
+// MMAP_SRC_MAX_WINDOWS windows alive at a time are covered.
+#define MMAP_SRC_FACTORY "mmapsrc"
+#define MMAP_SRC_WINDOW (256 * 1024 * 1024)
+#define MMAP_SRC_MAX_WINDOWS 64
+#define MMAP_SRC_READAHEAD (8 * 1024 * 1024)
+#define MMAP_SRC_BLOCKSIZE (256 * 1024) // push mode buffer size, larger than filesrc since nothing is copied
+
+GType mmap_src_get_type(void);
+
+// Registers MMAP_SRC_FACTORY for file:// URIs, ranked above filesrc so uridecodebin picks it,
+// and installs the SIGBUS handler. Safe to call more than once and from any thread.
+void mmap_src_register(void);
+
+#endif
@@ -0,0 +1,193 @@
+#include "playlist.h"
+#include "cache.h"
+#include "glib.h"
+#include "gst/gstbin.h"
+#include "gst/gstelement.h"
+#include "gst/gstelementfactory.h"
+#include "gst/gstpad.h"
+#include "gst/gststructure.h"
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define SOURCE_READY_MESSAGE "playlist-source-ready"
+#define SWITCHED_MESSAGE "playlist-switched"
+#define PADS_COMPLETE_KEY "playlist-pads-complete"
+
+struct Playlist {
+    State* state;
+    GPtrArray* uris;
+    guint current; // index of the item played by state->source
+    GstElement* next_source; // prerolling item current + 1, null if not added yet
+};
+
+// Streaming thread callbacks only post messages, the pipeline is changed from the bus loop
+static void no_more_pads_signal(GstElement* source, gpointer user_data) {
+    gst_element_post_message(source, gst_message_new_application(GST_OBJECT(source), gst_structure_new_empty(SOURCE_READY_MESSAGE)));
+}
+
+static void active_pad_changed(GObject* concat, GParamSpec* pspec, gpointer user_data) {
+    gst_element_post_message(GST_ELEMENT(concat), gst_message_new_application(GST_OBJECT(concat), gst_structure_new_empty(SWITCHED_MESSAGE)));
+}
+
+Playlist* playlist_new(Settings* settings) {
+    GPtrArray* paths = g_ptr_array_new();
+    if (settings->filepath) {
+        g_ptr_array_add(paths, settings->filepath);
+    }
+    for (guint i = 0; i < settings->inputs->len; ++i) {
+        g_ptr_array_add(paths, g_ptr_array_index(settings->inputs, i));
+    }
+
+    Playlist* playlist = g_new0(Playlist, 1);
+    playlist->uris = g_ptr_array_new_with_free_func(free);
+    for (guint i = 0; i < paths->len; ++i) {
+        Settings item = *settings;
+        item.filepath = g_ptr_array_index(paths, i);
+        char* uri = settings_get_file_uri(&item);
+        if (!uri) {
+            g_printerr("Skipping playlist item %s\n", item.filepath);
+            continue;
+        }
+        g_ptr_array_add(playlist->uris, uri);
+    }
+
+    // Branches are built once, so the first item decides them
+    if (paths->len > 0 && !settings->is_media_forced) {
+        settings->is_audio_only = settings_detect_audio_only(g_ptr_array_index(paths, 0));
+    }
+    g_ptr_array_free(paths, TRUE);
+
+    if (playlist->uris->len == 0) {
+        g_printerr("Playlist is empty\n");
+        playlist_free(playlist);
+        return NULL;
+    }
+    return playlist;
+}
+
+const char* playlist_first_uri(Playlist* playlist) {
+    return g_ptr_array_index(playlist->uris, 0);
+}
+
+void playlist_attach(Playlist* playlist, State* state) {
+    playlist->state = state;
+    state->playlist = playlist;
+
+    g_signal_connect(state->source, "no-more-pads", G_CALLBACK(no_more_pads_signal), NULL);
+    g_signal_connect(state->audio_concat, "notify::active-pad", G_CALLBACK(active_pad_changed), NULL);
+    if (state->video_concat) {
+        g_signal_connect(state->video_concat, "notify::active-pad", G_CALLBACK(active_pad_changed), NULL);
+    }
+}
+
+static void add_next_source(Playlist* playlist) {
+    guint next = playlist->current + 1;
+    if (playlist->next_source || next >= playlist->uris->len) {
+        return;
+    }
+
+    gchar* name = g_strdup_printf("source-%u", next);
+    GstElement* source = gst_element_factory_make("uridecodebin", name);
+    g_free(name);
+    if (!source) {
+        g_printerr("Could not create source for the next playlist item\n");
+        return;
+    }
+
+    gchar* uri = cache_resolve_uri(playlist->state->cache, g_ptr_array_index(playlist->uris, next));
+    g_object_set(source, "uri", uri, NULL);
+    g_free(uri);
+    state_connect_source(playlist->state, source);
+    g_signal_connect(source, "no-more-pads", G_CALLBACK(no_more_pads_signal), NULL);
+
+    gst_bin_add(GST_BIN(playlist->state->pipeline), source);
+    gst_element_sync_state_with_parent(source);
+    playlist->next_source = source;
+}
+
+static gboolean is_pad_active(GstElement* concat, GstElement* source, const char* key) {
+    if (!concat) {
+        return FALSE;
+    }
+    GstPad* pad = g_object_get_data(G_OBJECT(source), key);
+    if (!pad) {
+        return FALSE;
+    }
+
+    GstPad* active = NULL;
+    g_object_get(concat, "active-pad", &active, NULL);
+    gboolean is_active = active == pad;
+    if (active) {
+        gst_object_unref(active);
+    }
+    return is_active;
+}
+
+static void release_concat_pad(GstElement* concat, GstElement* source, const char* key) {
+    GstPad* pad = g_object_steal_data(G_OBJECT(source), key);
+    if (pad) {
+        gst_element_release_request_pad(concat, pad);
+        gst_object_unref(pad);
+    }
+}
+
+// Once every concat moved past the current source, it is dropped and the prerolled one takes its place
+static void retire_current_source(Playlist* playlist) {
+    State* state = playlist->state;
+    GstElement* finished = state->source;
+
+    if (!playlist->next_source) {
+        return;
+    }
+    if (is_pad_active(state->audio_concat, finished, STATE_AUDIO_CONCAT_PAD) ||
+        is_pad_active(state->video_concat, finished, STATE_VIDEO_CONCAT_PAD)) {
+        return;
+    }
+
+    gst_element_set_state(finished, GST_STATE_NULL);
+    release_concat_pad(state->audio_concat, finished, STATE_AUDIO_CONCAT_PAD);
+    if (state->video_concat) {
+        release_concat_pad(state->video_concat, finished, STATE_VIDEO_CONCAT_PAD);
+    }
+    gst_bin_remove(GST_BIN(state->pipeline), finished);
+
+    state->source = playlist->next_source;
+    playlist->next_source = NULL;
+    playlist->current++;
+    g_print("Now playing %s\n", (char*)g_ptr_array_index(playlist->uris, playlist->current));
+
+    if (g_object_get_data(G_OBJECT(state->source), PADS_COMPLETE_KEY)) {
+        add_next_source(playlist);
+    }
+}
+
+gboolean playlist_handle_message(Playlist* playlist, GstMessage* message) {
+    const GstStructure* structure = gst_message_get_structure(message);
+    if (!structure) {
+        return FALSE;
+    }
+
+    if (gst_structure_has_name(structure, SOURCE_READY_MESSAGE)) {
+        GstElement* source = GST_ELEMENT(GST_MESSAGE_SRC(message));
+        g_object_set_data(G_OBJECT(source), PADS_COMPLETE_KEY, GINT_TO_POINTER(TRUE));
+        // The next item may only request concat pads after the current one did, otherwise concat would start with it
+        if (source == playlist->state->source) {
+            add_next_source(playlist);
+        }
+        return TRUE;
+    }
+    if (gst_structure_has_name(structure, SWITCHED_MESSAGE)) {
+        retire_current_source(playlist);
+        return TRUE;
+    }
+    return FALSE;
+}
+
+void playlist_free(Playlist* playlist) {
+    if (!playlist) {
+        return;
+    }
+    g_ptr_array_free(playlist->uris, TRUE);
+    g_free(playlist);
+}
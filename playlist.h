@@ -0,0 +1,24 @@
+#ifndef __PLAYLIST_H
+#define __PLAYLIST_H
+
+#include "gst/gstmessage.h"
+#include "settings.h"
+#include "state.h"
+
+// Gapless playlist on a single pipeline.
+// Every item gets its own uridecodebin linked into the audio/video concat of State. The next
+// item is added (and prerolls, blocked in concat) as soon as the current one exposed its pads,
+// concat switches to it when the current one reaches EOS, and the finished source is removed.
+// The filter chains and sinks behind concat are never rebuilt.
+typedef struct Playlist Playlist;
+
+// Items are --path followed by the positional inputs / manifest entries
+Playlist* playlist_new(Settings* settings);
+const char* playlist_first_uri(Playlist* playlist);
+// Call once state_build_pipeline built the pipeline for playlist_first_uri
+void playlist_attach(Playlist* playlist, State* state);
+// Handles the application messages the playlist posts, returns FALSE for other messages
+gboolean playlist_handle_message(Playlist* playlist, GstMessage* message);
+void playlist_free(Playlist* playlist);
+
+#endif
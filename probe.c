@@ -0,0 +1,53 @@
+#include "probe.h"
+#include "settings.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <gst/pbutils/pbutils.h>
+
+guint probe_media(const char* uri, guint64 timeout) {
+    GError* err = NULL;
+    GstDiscoverer* discoverer = gst_discoverer_new(timeout, &err);
+    if (!discoverer) {
+        g_printerr("Could not create discoverer: %s\n", err->message);
+        g_clear_error(&err);
+        return 0;
+    }
+
+    gint64 start_time = g_get_monotonic_time();
+    GstDiscovererInfo* info = gst_discoverer_discover_uri(discoverer, uri, &err);
+    GstDiscovererResult result = info ? gst_discoverer_info_get_result(info) : GST_DISCOVERER_ERROR;
+
+    guint media = 0;
+    // Missing plugins still leave the stream list, playback reports them itself
+    if (result == GST_DISCOVERER_OK || result == GST_DISCOVERER_MISSING_PLUGINS) {
+        GList* audio_streams = gst_discoverer_info_get_audio_streams(info);
+        GList* video_streams = gst_discoverer_info_get_video_streams(info);
+        if (audio_streams) {
+            media |= MEDIA_AUDIO;
+        }
+        if (video_streams) {
+            media |= MEDIA_VIDEO;
+        }
+        gst_discoverer_stream_info_list_free(audio_streams);
+        gst_discoverer_stream_info_list_free(video_streams);
+
+        if (media) {
+            g_print("Probed media: %s%s%s (%.1f ms)\n", media & MEDIA_AUDIO ? "audio" : "",
+                    media == (MEDIA_AUDIO | MEDIA_VIDEO) ? ", " : "", media & MEDIA_VIDEO ? "video" : "",
+                    (g_get_monotonic_time() - start_time) / 1000.0);
+        } else {
+            g_printerr("%s has no audio or video stream\n", uri);
+        }
+    } else if (result == GST_DISCOVERER_TIMEOUT) {
+        g_printerr("Probing %s timed out, guessing the media type\n", uri);
+    } else {
+        g_printerr("Could not probe %s: %s\n", uri, err ? err->message : "unknown error");
+    }
+
+    g_clear_error(&err);
+    if (info) {
+        g_object_unref(info);
+    }
+    g_object_unref(discoverer);
+    return media;
+}
@@ -0,0 +1,11 @@
+#ifndef __PROBE_H
+#define __PROBE_H
+
+#include "glib.h"
+
+// Streams of uri as MEDIA_AUDIO | MEDIA_VIDEO, found by a discoverer run on the content, so it
+// works for urls and files with a misleading or no extension. 0 when uri could not be probed
+// within timeout (nanoseconds), the caller then keeps its own guess.
+guint probe_media(const char* uri, guint64 timeout);
+
+#endif
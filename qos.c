@@ -0,0 +1,316 @@
+#include "qos.h"
+#include "livefilter.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <string.h>
+
+#define QOS_TICK_US G_USEC_PER_SEC
+#define QOS_BAD_TICKS 2 // seconds with late frames before a step down
+#define QOS_GOOD_TICKS 10 // seconds without before a step up
+#define QOS_LATE_MESSAGES 3 // late buffers in a second that count as falling behind
+
+typedef struct QosElement {
+    gchar* name;
+    gboolean is_video; // stats in buffers, audio sinks count samples
+    guint64 processed; // as last reported, the element counts from its start
+    guint64 dropped;
+    guint64 late; // QoS messages posted
+    gint64 max_jitter; // nanoseconds
+} QosElement;
+
+struct QosMonitor {
+    State* state;
+    gboolean is_adaptive;
+    GThread* thread;
+    gboolean is_stopping;
+    gboolean is_applied[QOS_MAX_LEVEL + 1]; // levels that changed something, only touched by the thread
+    gint decoder_skip_frame; // value before level 3
+
+    GMutex lock; // everything below, messages come from the bus loop, steps from the thread
+    GCond wake;
+    GPtrArray* elements; // of QosElement
+    guint64 tick_dropped; // video buffers dropped and late since the last tick
+    guint64 tick_late;
+    guint bad_ticks;
+    guint good_ticks;
+    int level;
+};
+
+static void qos_element_free(QosElement* element) {
+    g_free(element->name);
+    g_free(element);
+}
+
+static QosElement* find_element(QosMonitor* monitor, const char* name) {
+    for (guint i = 0; i < monitor->elements->len; ++i) {
+        QosElement* element = g_ptr_array_index(monitor->elements, i);
+        if (!strcmp(element->name, name)) {
+            return element;
+        }
+    }
+    QosElement* element = g_new0(QosElement, 1);
+    element->name = g_strdup(name);
+    g_ptr_array_add(monitor->elements, element);
+    return element;
+}
+
+void qos_handle_message(QosMonitor* monitor, GstMessage* message) {
+    GstFormat format;
+    guint64 processed;
+    guint64 dropped;
+    gint64 jitter;
+    gst_message_parse_qos_stats(message, &format, &processed, &dropped);
+    gst_message_parse_qos_values(message, &jitter, NULL, NULL);
+
+    g_mutex_lock(&monitor->lock);
+    QosElement* element = find_element(monitor, GST_OBJECT_NAME(GST_MESSAGE_SRC(message)));
+    element->is_video = format == GST_FORMAT_BUFFERS;
+    // -1 when the element does not know
+    if (processed != (guint64)-1) {
+        element->processed = processed;
+    }
+    if (dropped != (guint64)-1) {
+        if (element->is_video && dropped > element->dropped) {
+            monitor->tick_dropped += dropped - element->dropped;
+        }
+        element->dropped = dropped;
+    }
+    element->late++;
+    element->max_jitter = MAX(element->max_jitter, jitter);
+    if (element->is_video) {
+        monitor->tick_late++;
+    }
+    g_mutex_unlock(&monitor->lock);
+}
+
+static GstElement* find_video_decoder(GstElement* source) {
+    GstElement* decoder = NULL;
+    GstIterator* it = gst_bin_iterate_recurse(GST_BIN(source));
+    GValue item = G_VALUE_INIT;
+    while (!decoder && gst_iterator_next(it, &item) == GST_ITERATOR_OK) {
+        GstElement* element = g_value_get_object(&item);
+        GstElementFactory* factory = gst_element_get_factory(element);
+        const gchar* klass = factory ? gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS) : NULL;
+        if (klass && strstr(klass, "Decoder") && strstr(klass, "Video")
+            && g_object_class_find_property(G_OBJECT_GET_CLASS(element), "skip-frame")) {
+            decoder = gst_object_ref(element);
+        }
+        g_value_reset(&item);
+    }
+    g_value_unset(&item);
+    gst_iterator_free(it);
+    return decoder;
+}
+
+static gboolean set_decoder_skip_frame(QosMonitor* monitor, gboolean is_skipping) {
+    GstElement* decoder = find_video_decoder(monitor->state->source);
+    if (!decoder) {
+        return FALSE;
+    }
+    if (is_skipping) {
+        // Put back later, it may come from --decoder-skip-frame
+        g_object_get(decoder, "skip-frame", &monitor->decoder_skip_frame, NULL);
+        // avdec: 1 skips B-frames, which nothing else references
+        gst_util_set_object_arg(G_OBJECT(decoder), "skip-frame", "1");
+    } else {
+        g_object_set(decoder, "skip-frame", monitor->decoder_skip_frame, NULL);
+    }
+    gst_object_unref(decoder);
+    return TRUE;
+}
+
+static gboolean set_half_size(State* state, gboolean is_half) {
+    if (!state->video_size_filter) {
+        return FALSE;
+    }
+    GstCaps* caps = NULL;
+    if (is_half) {
+        // Decoded size, videoscale comes first in the branch
+        GstPad* pad = gst_element_get_static_pad(state->video_scale, "sink");
+        GstCaps* current = gst_pad_get_current_caps(pad);
+        int width;
+        int height;
+        if (current && gst_structure_get_int(gst_caps_get_structure(current, 0), "width", &width)
+            && gst_structure_get_int(gst_caps_get_structure(current, 0), "height", &height)) {
+            // Even sizes, so chroma subsampled formats stay valid
+            caps = gst_caps_new_simple("video/x-raw", "width", G_TYPE_INT, MAX(width / 4 * 2, 2),
+                                       "height", G_TYPE_INT, MAX(height / 4 * 2, 2), NULL);
+        }
+        if (current) {
+            gst_caps_unref(current);
+        }
+        gst_object_unref(pad);
+        if (!caps) {
+            return FALSE;
+        }
+    }
+    if (!caps) {
+        caps = gst_caps_new_any();
+    }
+    // The capsfilter asks upstream to renegotiate, videoscale does the rest
+    g_object_set(state->video_size_filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    return TRUE;
+}
+
+// Going down, FALSE when the level has nothing to change. Going up only undoes an applied level.
+static gboolean apply_level(QosMonitor* monitor, int level, gboolean is_down) {
+    State* state = monitor->state;
+    if (!is_down && !monitor->is_applied[level]) {
+        return FALSE;
+    }
+    gboolean is_changed = FALSE;
+    switch (level) {
+        case 1:
+            // A pending filter change, or a filter that is not there, leaves the effect as it is
+            is_changed = live_filter_set_enabled(state, "videobalance", !is_down) == NULL;
+            break;
+        case 2:
+            is_changed = set_half_size(state, is_down);
+            break;
+        case 3:
+            is_changed = set_decoder_skip_frame(monitor, is_down);
+            break;
+        default:
+            break;
+    }
+    monitor->is_applied[level] = is_down && is_changed;
+    return is_changed;
+}
+
+static void tick(QosMonitor* monitor) {
+    g_mutex_lock(&monitor->lock);
+    gboolean is_behind = monitor->tick_dropped > 0 || monitor->tick_late >= QOS_LATE_MESSAGES;
+    monitor->tick_dropped = 0;
+    monitor->tick_late = 0;
+    if (is_behind) {
+        monitor->bad_ticks++;
+        monitor->good_ticks = 0;
+    } else {
+        monitor->good_ticks++;
+        monitor->bad_ticks = 0;
+    }
+
+    int step = 0;
+    if (monitor->bad_ticks >= QOS_BAD_TICKS && monitor->level < QOS_MAX_LEVEL) {
+        step = 1;
+        monitor->bad_ticks = 0;
+    } else if (monitor->good_ticks >= QOS_GOOD_TICKS && monitor->level > 0) {
+        step = -1;
+        monitor->good_ticks = 0;
+    }
+    int level = monitor->level;
+    g_mutex_unlock(&monitor->lock);
+    if (!step) {
+        return;
+    }
+
+    // Down applies the next level that changes something, so a step costs QOS_BAD_TICKS once.
+    // Up undoes the current one and falls back to the last level below it that was applied.
+    int new_level = level;
+    if (step > 0) {
+        for (int next = level + 1; next <= QOS_MAX_LEVEL; ++next) {
+            if (apply_level(monitor, next, TRUE)) {
+                new_level = next;
+                break;
+            }
+        }
+    } else {
+        apply_level(monitor, level, FALSE);
+        for (new_level = level - 1; new_level > 0 && !monitor->is_applied[new_level]; --new_level) {
+        }
+    }
+    if (new_level == level) {
+        return;
+    }
+
+    g_mutex_lock(&monitor->lock);
+    monitor->level = new_level;
+    g_mutex_unlock(&monitor->lock);
+    g_print("QoS: video degradation level %d (%s)\n", new_level, step > 0 ? "falling behind" : "keeping up");
+}
+
+static gpointer qos_thread(QosMonitor* monitor) {
+    g_mutex_lock(&monitor->lock);
+    while (!monitor->is_stopping) {
+        gint64 deadline = g_get_monotonic_time() + QOS_TICK_US;
+        while (!monitor->is_stopping && g_cond_wait_until(&monitor->wake, &monitor->lock, deadline)) {
+        }
+        if (monitor->is_stopping) {
+            break;
+        }
+        g_mutex_unlock(&monitor->lock);
+        tick(monitor);
+        g_mutex_lock(&monitor->lock);
+    }
+    g_mutex_unlock(&monitor->lock);
+    return NULL;
+}
+
+QosMonitor* qos_monitor_new(State* state, gboolean is_adaptive) {
+    QosMonitor* monitor = g_new0(QosMonitor, 1);
+    monitor->state = state;
+    monitor->is_adaptive = is_adaptive;
+    monitor->elements = g_ptr_array_new_with_free_func((GDestroyNotify)qos_element_free);
+    g_mutex_init(&monitor->lock);
+    g_cond_init(&monitor->wake);
+    if (is_adaptive) {
+        monitor->thread = g_thread_new("qos", (GThreadFunc)qos_thread, monitor);
+    }
+    return monitor;
+}
+
+void qos_monitor_free(QosMonitor* monitor) {
+    if (!monitor) {
+        return;
+    }
+    if (monitor->thread) {
+        g_mutex_lock(&monitor->lock);
+        monitor->is_stopping = TRUE;
+        g_cond_signal(&monitor->wake);
+        g_mutex_unlock(&monitor->lock);
+        g_thread_join(monitor->thread);
+    }
+    g_ptr_array_free(monitor->elements, TRUE);
+    g_cond_clear(&monitor->wake);
+    g_mutex_clear(&monitor->lock);
+    g_free(monitor);
+}
+
+void qos_get_video_totals(QosMonitor* monitor, QosTotals* totals) {
+    memset(totals, 0, sizeof(*totals));
+    g_mutex_lock(&monitor->lock);
+    for (guint i = 0; i < monitor->elements->len; ++i) {
+        QosElement* element = g_ptr_array_index(monitor->elements, i);
+        if (element->is_video) {
+            totals->processed = MAX(totals->processed, element->processed);
+            totals->dropped += element->dropped;
+            totals->late += element->late;
+        }
+    }
+    totals->level = monitor->level;
+    g_mutex_unlock(&monitor->lock);
+}
+
+gchar* qos_describe(QosMonitor* monitor) {
+    QosTotals totals;
+    qos_get_video_totals(monitor, &totals);
+    return g_strdup_printf("level %d processed %" G_GUINT64_FORMAT " dropped %" G_GUINT64_FORMAT " late %" G_GUINT64_FORMAT,
+                           totals.level, totals.processed, totals.dropped, totals.late);
+}
+
+void qos_print(QosMonitor* monitor) {
+    if (!monitor || monitor->elements->len == 0) {
+        return;
+    }
+    g_mutex_lock(&monitor->lock);
+    g_print("QoS (video degradation level %d at exit):\n", monitor->level);
+    g_print("%-28s %12s %10s %8s %14s\n", "ELEMENT", "PROCESSED", "DROPPED", "LATE", "MAX JITTER MS");
+    for (guint i = 0; i < monitor->elements->len; ++i) {
+        QosElement* element = g_ptr_array_index(monitor->elements, i);
+        g_print("%-28s %12" G_GUINT64_FORMAT " %10" G_GUINT64_FORMAT " %8" G_GUINT64_FORMAT " %14.1f%s\n",
+                element->name, element->processed, element->dropped, element->late, element->max_jitter / 1e6,
+                element->is_video ? "" : "  (samples)");
+    }
+    g_mutex_unlock(&monitor->lock);
+}
@@ -0,0 +1,39 @@
+#ifndef __QOS_H
+#define __QOS_H
+
+#include "gst/gstmessage.h"
+#include "state.h"
+
+// QoS tracking. Every QoS message counts as a late buffer of the element that posted it, and
+// its processed/dropped stats are kept per element.
+//
+// When adaptive, video is stepped down one level after two seconds in a row with dropped or late
+// frames, and back up one level after ten seconds without any:
+//   1  videobalance is taken out (through livefilter)
+//   2  frames are scaled to half size in front of the converter (needs State.video_size_filter)
+//   3  the video decoder skips non-reference frames, where it has skip-frame
+// A level that does not apply, such as 1 without videobalance, is skipped within the same step.
+typedef struct QosMonitor QosMonitor;
+
+#define QOS_MAX_LEVEL 3
+
+QosMonitor* qos_monitor_new(State* state, gboolean is_adaptive);
+void qos_monitor_free(QosMonitor* monitor);
+
+// For GST_MESSAGE_QOS, from the bus loop
+void qos_handle_message(QosMonitor* monitor, GstMessage* message);
+
+typedef struct QosTotals {
+    guint64 processed; // the most any video element reported
+    guint64 dropped; // summed over the video elements
+    guint64 late;
+    int level;
+} QosTotals;
+
+void qos_get_video_totals(QosMonitor* monitor, QosTotals* totals);
+// "level <n> processed <count> dropped <count> late <count>", summed over the video elements
+gchar* qos_describe(QosMonitor* monitor);
+// Per element table, only when anything was late
+void qos_print(QosMonitor* monitor);
+
+#endif
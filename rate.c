@@ -0,0 +1,155 @@
+#include "rate.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <math.h>
+
+struct RateControl {
+    State* state;
+    gint64 origin_time;
+    GstPad* sink_pad; // audio sink pad the probe sits on
+    gulong probe_id;
+
+    GMutex lock; // everything below, the probe runs in the streaming thread
+    double segment_rate; // rate * applied_rate of the last segment at the sink
+    double multiplier; // instant rate multiplier on top of the segment, 1 after a new segment
+    double target_rate; // requested rate that has not arrived yet
+    gint64 request_time; // 0 when no change is pending
+    gint64 flush_time; // when the sink got flushed for the pending change, 0 if it was not
+    gboolean is_instant;
+    gboolean is_startup;
+};
+
+static GstPadProbeReturn sink_probe(GstPad* pad, GstPadProbeInfo* info, RateControl* control) {
+    gint64 now = g_get_monotonic_time();
+
+    g_mutex_lock(&control->lock);
+    if (info->type & GST_PAD_PROBE_TYPE_BUFFER) {
+        double rate = control->segment_rate * control->multiplier;
+        if (control->request_time && fabs(rate - control->target_rate) < 1e-6) {
+            double latency_ms = (now - control->request_time) / 1000.0;
+            double dropout_ms = control->flush_time ? (now - control->flush_time) / 1000.0 : 0.0;
+            g_print("Rate %.2f (%s): %s %.1f ms, audio dropout %.1f ms\n", rate,
+                    control->is_instant ? "instant" : "flushing seek",
+                    control->is_startup ? "at the sink after startup" : "at the sink after", latency_ms, dropout_ms);
+            control->request_time = 0;
+        }
+    } else {
+        GstEvent* event = GST_PAD_PROBE_INFO_EVENT(info);
+        switch (GST_EVENT_TYPE(event)) {
+            case GST_EVENT_FLUSH_START:
+                if (control->request_time && !control->flush_time) {
+                    control->flush_time = now;
+                }
+                break;
+            case GST_EVENT_SEGMENT: {
+                const GstSegment* segment;
+                gst_event_parse_segment(event, &segment);
+                control->segment_rate = segment->rate * segment->applied_rate;
+                control->multiplier = 1.0;
+                break;
+            }
+#if GST_CHECK_VERSION(1, 18, 0)
+            case GST_EVENT_INSTANT_RATE_CHANGE: {
+                gdouble multiplier;
+                gst_event_parse_instant_rate_change(event, &multiplier, NULL);
+                control->multiplier = multiplier;
+                break;
+            }
+#endif
+            default:
+                break;
+        }
+    }
+    g_mutex_unlock(&control->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+RateControl* rate_control_new(State* state, gint64 origin_time) {
+    RateControl* control = g_new0(RateControl, 1);
+    control->state = state;
+    control->origin_time = origin_time;
+    control->segment_rate = 1.0;
+    control->multiplier = 1.0;
+    g_mutex_init(&control->lock);
+
+    control->sink_pad = state->audio_sink ? gst_element_get_static_pad(state->audio_sink, "sink") : NULL;
+    if (control->sink_pad) {
+        control->probe_id = gst_pad_add_probe(control->sink_pad, GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM | GST_PAD_PROBE_TYPE_EVENT_FLUSH,
+                                              (GstPadProbeCallback)sink_probe, control, NULL);
+    }
+    return control;
+}
+
+void rate_control_free(RateControl* control) {
+    if (!control) {
+        return;
+    }
+    if (control->sink_pad) {
+        gst_pad_remove_probe(control->sink_pad, control->probe_id);
+        gst_object_unref(control->sink_pad);
+    }
+    g_mutex_clear(&control->lock);
+    g_free(control);
+}
+
+double rate_control_get(RateControl* control) {
+    g_mutex_lock(&control->lock);
+    double rate = control->segment_rate * control->multiplier;
+    g_mutex_unlock(&control->lock);
+    return rate;
+}
+
+static gboolean send_instant_rate_change(GstElement* pipeline, double rate) {
+#if GST_CHECK_VERSION(1, 18, 0)
+    GstEvent* seek_event = gst_event_new_seek(rate, GST_FORMAT_TIME, GST_SEEK_FLAG_INSTANT_RATE_CHANGE,
+                                              GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE, GST_SEEK_TYPE_NONE, GST_CLOCK_TIME_NONE);
+    return gst_element_send_event(pipeline, seek_event);
+#else
+    return FALSE;
+#endif
+}
+
+static gboolean send_flushing_seek(GstElement* pipeline, double rate) {
+    gint64 position = 0;
+    if (!gst_element_query_position(pipeline, GST_FORMAT_TIME, &position)) {
+        position = 0;
+    }
+    GstSeekFlags flags = GST_SEEK_FLAG_FLUSH | GST_SEEK_FLAG_ACCURATE;
+    GstEvent* seek_event = rate >= 0.0
+        ? gst_event_new_seek(rate, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, position, GST_SEEK_TYPE_END, 0)
+        : gst_event_new_seek(rate, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, position);
+    return gst_element_send_event(pipeline, seek_event);
+}
+
+gboolean rate_control_set(RateControl* control, double rate, gboolean is_startup) {
+    if (rate == 0.0) {
+        return FALSE;
+    }
+
+    g_mutex_lock(&control->lock);
+    // Instant changes only scale the current segment, a new direction needs a new one
+    gboolean can_be_instant = (rate > 0.0) == (control->segment_rate > 0.0);
+    control->target_rate = rate;
+    control->request_time = is_startup ? control->origin_time : g_get_monotonic_time();
+    control->flush_time = 0;
+    control->is_startup = is_startup;
+    control->is_instant = can_be_instant;
+    g_mutex_unlock(&control->lock);
+
+    GstElement* pipeline = control->state->pipeline;
+    if (can_be_instant && send_instant_rate_change(pipeline, rate)) {
+        return TRUE;
+    }
+
+    g_mutex_lock(&control->lock);
+    control->is_instant = FALSE;
+    g_mutex_unlock(&control->lock);
+    if (send_flushing_seek(pipeline, rate)) {
+        return TRUE;
+    }
+
+    g_mutex_lock(&control->lock);
+    control->request_time = 0;
+    g_mutex_unlock(&control->lock);
+    return FALSE;
+}
@@ -0,0 +1,22 @@
+#ifndef __RATE_H
+#define __RATE_H
+
+#include "state.h"
+
+// Playback rate changes. A rate is applied with an instant-rate-change seek when the pipeline
+// supports it (GStreamer 1.18+, no flush, the new rate starts with the next buffer), otherwise
+// with a flushing seek at the current position. A probe on the audio sink measures for every
+// change the time until buffers at the new rate reach the sink and, for flushing changes, how
+// long the sink had no data; both are printed once the change has arrived.
+typedef struct RateControl RateControl;
+
+// origin_time is the g_get_monotonic_time the startup latency is measured from
+RateControl* rate_control_new(State* state, gint64 origin_time);
+void rate_control_free(RateControl* control);
+
+// is_startup measures from origin_time instead of now, for the rate requested on the command line
+gboolean rate_control_set(RateControl* control, double rate, gboolean is_startup);
+// Rate at the audio sink, any thread
+double rate_control_get(RateControl* control);
+
+#endif
@@ -0,0 +1,313 @@
+#include "seekindex.h"
+#include "glib.h"
+#include <gst/gst.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define SEEK_INDEX_MAGIC "KFIX"
+#define SEEK_INDEX_VERSION 2
+
+struct SeekIndex {
+    char* path; // local file
+    char* index_path;
+    GArray* entries; // guint64 timestamps sorted, only read once is_ready is set
+    gint is_ready;
+    gint is_cancelled;
+    GThread* builder;
+};
+
+static char* make_index_path(const char* path, const char* dir) {
+    GStatBuf st;
+    if (g_stat(path, &st) != 0) {
+        return NULL;
+    }
+    gchar* identity = g_strdup_printf("%s\n%" G_GINT64_FORMAT "\n%" G_GINT64_FORMAT, path, (gint64)st.st_size, (gint64)st.st_mtime);
+    gchar* key = g_compute_checksum_for_string(G_CHECKSUM_SHA256, identity, -1);
+    gchar* name = g_strconcat(key, ".idx", NULL);
+    gchar* index_path = g_build_filename(dir, name, NULL);
+    g_free(name);
+    g_free(key);
+    g_free(identity);
+    return index_path;
+}
+
+static gboolean load_index(SeekIndex* index) {
+    gchar* contents;
+    gsize length;
+    if (!g_file_get_contents(index->index_path, &contents, &length, NULL)) {
+        return FALSE;
+    }
+
+    gboolean is_valid = FALSE;
+    guint32 version, count;
+    gsize header_size = 4 + sizeof(version) + sizeof(count);
+    if (length >= header_size && !memcmp(contents, SEEK_INDEX_MAGIC, 4)) {
+        memcpy(&version, contents + 4, sizeof(version));
+        memcpy(&count, contents + 4 + sizeof(version), sizeof(count));
+        is_valid = version == SEEK_INDEX_VERSION && length == header_size + (gsize)count * sizeof(guint64);
+        if (is_valid) {
+            g_array_append_vals(index->entries, contents + header_size, count);
+        }
+    }
+    g_free(contents);
+    return is_valid;
+}
+
+static void save_index(SeekIndex* index) {
+    gchar* dir = g_path_get_dirname(index->index_path);
+    g_mkdir_with_parents(dir, 0755);
+    g_free(dir);
+
+    guint32 version = SEEK_INDEX_VERSION;
+    guint32 count = index->entries->len;
+    GByteArray* bytes = g_byte_array_new();
+    g_byte_array_append(bytes, (const guint8*)SEEK_INDEX_MAGIC, 4);
+    g_byte_array_append(bytes, (const guint8*)&version, sizeof(version));
+    g_byte_array_append(bytes, (const guint8*)&count, sizeof(count));
+    g_byte_array_append(bytes, (const guint8*)index->entries->data, count * sizeof(guint64));
+
+    GError* err = NULL;
+    if (!g_file_set_contents(index->index_path, (const gchar*)bytes->data, bytes->len, &err)) {
+        g_printerr("Could not write seek index %s: %s\n", index->index_path, err->message);
+        g_clear_error(&err);
+    }
+    g_byte_array_free(bytes, TRUE);
+}
+
+// ---------------------------------------------------------------------------
+// Building
+// ---------------------------------------------------------------------------
+
+// Shared by the probes of every video stream, each runs on the streaming thread of its pad
+typedef struct IndexBuild {
+    GMutex lock;
+    GArray* entries;
+} IndexBuild;
+
+static GstPadProbeReturn keyframe_probe(GstPad* pad, GstPadProbeInfo* info, IndexBuild* build) {
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    if (GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT)) {
+        return GST_PAD_PROBE_OK;
+    }
+    GstClockTime timestamp = GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) : GST_BUFFER_DTS(buffer);
+    if (!GST_CLOCK_TIME_IS_VALID(timestamp)) {
+        return GST_PAD_PROBE_OK;
+    }
+    g_mutex_lock(&build->lock);
+    g_array_append_val(build->entries, timestamp);
+    g_mutex_unlock(&build->lock);
+    return GST_PAD_PROBE_OK;
+}
+
+// Every stream goes to a fakesink, so parsebin never fails on an unlinked pad; only video is indexed
+static void parse_pad_added(GstElement* parsebin, GstPad* pad, IndexBuild* build) {
+    GstElement* pipeline = GST_ELEMENT(gst_element_get_parent(parsebin));
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    g_object_set(sink, "sync", FALSE, NULL);
+    gst_bin_add(GST_BIN(pipeline), sink);
+    gst_element_sync_state_with_parent(sink);
+
+    GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+    gst_pad_link(pad, sink_pad);
+    gst_object_unref(sink_pad);
+    gst_object_unref(pipeline);
+
+    GstCaps* caps = gst_pad_query_caps(pad, NULL);
+    if (caps && !gst_caps_is_empty(caps) && g_str_has_prefix(gst_structure_get_name(gst_caps_get_structure(caps, 0)), "video/")) {
+        gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, (GstPadProbeCallback)keyframe_probe, build, NULL);
+    }
+    if (caps) {
+        gst_caps_unref(caps);
+    }
+}
+
+static gint compare_entries(gconstpointer a, gconstpointer b) {
+    guint64 first = *(const guint64*)a;
+    guint64 second = *(const guint64*)b;
+    return first < second ? -1 : first > second;
+}
+
+// Parses the whole file without decoding it, demuxers and parsers mark the keyframes
+static gpointer build_index(SeekIndex* index) {
+    IndexBuild build;
+    g_mutex_init(&build.lock);
+    build.entries = g_array_new(FALSE, FALSE, sizeof(guint64));
+    GstElement* pipeline = gst_pipeline_new("seek-index-pipeline");
+    GstElement* source = gst_element_factory_make("filesrc", NULL);
+    GstElement* parsebin = gst_element_factory_make("parsebin", NULL);
+    if (!source || !parsebin) {
+        g_printerr("Could not create seek index elements\n");
+        gst_object_unref(pipeline);
+        g_array_free(build.entries, TRUE);
+        g_mutex_clear(&build.lock);
+        return NULL;
+    }
+    g_object_set(source, "location", index->path, NULL);
+    gst_bin_add_many(GST_BIN(pipeline), source, parsebin, NULL);
+    gst_element_link(source, parsebin);
+    g_signal_connect(parsebin, "pad-added", G_CALLBACK(parse_pad_added), &build);
+
+    gint64 start_time = g_get_monotonic_time();
+    gboolean is_ok = FALSE;
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    while (!g_atomic_int_get(&index->is_cancelled)) {
+        GstMessage* message = gst_bus_timed_pop_filtered(bus, 100 * GST_MSECOND, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+        if (!message) {
+            continue;
+        }
+        is_ok = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+        gst_message_unref(message);
+        break;
+    }
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+
+    // The pipeline is stopped, no probe runs any more
+    GArray* entries = build.entries;
+    if (is_ok) {
+        g_array_sort(entries, compare_entries);
+        g_array_append_vals(index->entries, entries->data, entries->len);
+        save_index(index);
+        g_atomic_int_set(&index->is_ready, TRUE);
+        g_print("Seek index: %u keyframes in %.2f s\n", index->entries->len, (g_get_monotonic_time() - start_time) / (double)G_USEC_PER_SEC);
+    } else if (!g_atomic_int_get(&index->is_cancelled)) {
+        g_printerr("Could not build seek index for %s\n", index->path);
+    }
+    g_array_free(entries, TRUE);
+    g_mutex_clear(&build.lock);
+    return NULL;
+}
+
+// ---------------------------------------------------------------------------
+// Public
+// ---------------------------------------------------------------------------
+
+SeekIndex* seek_index_open(const char* uri, const char* dir) {
+    gchar* path = g_filename_from_uri(uri, NULL, NULL);
+    if (!path) {
+        return NULL;
+    }
+    gchar* index_path = make_index_path(path, dir);
+    if (!index_path) {
+        g_free(path);
+        return NULL;
+    }
+
+    SeekIndex* index = g_new0(SeekIndex, 1);
+    index->path = path;
+    index->index_path = index_path;
+    index->entries = g_array_new(FALSE, FALSE, sizeof(guint64));
+
+    if (load_index(index)) {
+        index->is_ready = TRUE;
+        g_print("Seek index: loaded %u keyframes from %s\n", index->entries->len, index_path);
+    } else {
+        g_array_set_size(index->entries, 0);
+        index->builder = g_thread_new("seek-index", (GThreadFunc)build_index, index);
+    }
+    return index;
+}
+
+void seek_index_free(SeekIndex* index) {
+    if (!index) {
+        return;
+    }
+    if (index->builder) {
+        g_atomic_int_set(&index->is_cancelled, TRUE);
+        g_thread_join(index->builder);
+    }
+    g_array_free(index->entries, TRUE);
+    g_free(index->index_path);
+    g_free(index->path);
+    g_free(index);
+}
+
+gboolean seek_index_is_ready(SeekIndex* index) {
+    return index && g_atomic_int_get(&index->is_ready);
+}
+
+// Index of the last entry at or before position, -1 if every keyframe is after it
+static gint find_before(SeekIndex* index, GstClockTime position) {
+    gint low = 0;
+    gint high = (gint)index->entries->len - 1;
+    gint found = -1;
+    while (low <= high) {
+        gint middle = low + (high - low) / 2;
+        if (g_array_index(index->entries, guint64, middle) <= position) {
+            found = middle;
+            low = middle + 1;
+        } else {
+            high = middle - 1;
+        }
+    }
+    return found;
+}
+
+gboolean seek_index_lookup(SeekIndex* index, GstClockTime position, GstClockTime* keyframe) {
+    if (!seek_index_is_ready(index)) {
+        return FALSE;
+    }
+    gint found = find_before(index, position);
+    if (found < 0) {
+        return FALSE;
+    }
+    *keyframe = g_array_index(index->entries, guint64, found);
+    return TRUE;
+}
+
+static gboolean find_nearest(SeekIndex* index, GstClockTime position, GstClockTime* keyframe) {
+    if (!seek_index_is_ready(index) || index->entries->len == 0) {
+        return FALSE;
+    }
+    gint before = find_before(index, position);
+    gint after = before + 1;
+    if (before < 0) {
+        *keyframe = g_array_index(index->entries, guint64, 0);
+    } else if ((guint)after >= index->entries->len) {
+        *keyframe = g_array_index(index->entries, guint64, before);
+    } else {
+        GstClockTime before_time = g_array_index(index->entries, guint64, before);
+        GstClockTime after_time = g_array_index(index->entries, guint64, after);
+        *keyframe = position - before_time <= after_time - position ? before_time : after_time;
+    }
+    return TRUE;
+}
+
+gboolean seek_index_seek(SeekIndex* index, GstElement* pipeline, GstClockTime target, SeekMode mode) {
+    // Keep the rate a speed change set up
+    gdouble rate = 1.0;
+    GstQuery* query = gst_query_new_segment(GST_FORMAT_TIME);
+    if (gst_element_query(pipeline, query)) {
+        gst_query_parse_segment(query, &rate, NULL, NULL, NULL);
+    }
+    gst_query_unref(query);
+
+    GstSeekFlags flags = GST_SEEK_FLAG_FLUSH;
+    GstClockTime start = target;
+    switch (mode) {
+        case SeekAccurate:
+            // The demuxer starts decoding at the keyframe before target and drops frames up to it.
+            // Seeks carry no byte position, so the index has nothing to add here.
+            flags |= GST_SEEK_FLAG_ACCURATE;
+            break;
+        case SeekKeyframe:
+            // With the index the demuxer is handed an exact keyframe instead of estimating one
+            if (!find_nearest(index, target, &start)) {
+                flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_NEAREST;
+            } else {
+                flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE;
+            }
+            break;
+        case SeekFast:
+            seek_index_lookup(index, target, &start);
+            flags |= GST_SEEK_FLAG_KEY_UNIT | GST_SEEK_FLAG_SNAP_BEFORE;
+            break;
+    }
+
+    GstEvent* seek_event = rate >= 0.0
+        ? gst_event_new_seek(rate, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, start, GST_SEEK_TYPE_END, 0)
+        : gst_event_new_seek(rate, GST_FORMAT_TIME, flags, GST_SEEK_TYPE_SET, 0, GST_SEEK_TYPE_SET, start);
+    return gst_element_send_event(pipeline, seek_event);
+}
@@ -0,0 +1,38 @@
+#ifndef __SEEK_INDEX_H
+#define __SEEK_INDEX_H
+
+#include "gst/gstelement.h"
+#include "settings.h"
+
+// Keyframe index of a local file: timestamp of every video keyframe. It is built once by a
+// parse-only pipeline on a background thread and persisted as <dir>/<key>.idx, where the key is a
+// hash of the path, size and modification time, so a changed file is indexed again.
+//
+// The index only helps keyframe snapping: seeks get an exact keyframe timestamp, which matters for
+// containers without an index of their own (MPEG-TS, Matroska without cues), where the demuxer
+// would otherwise estimate. Accurate seeks are left to the demuxer.
+// Only single-file playback opens an index. Playlist items change under the pipeline and batch
+// jobs never seek after --start.
+//
+// File layout, native endianness:
+//   char[4] "KFIX", guint32 version, guint32 count, count * guint64 timestamp
+typedef struct SeekIndex SeekIndex;
+
+// Loads the index of uri or starts building it, null for anything but local files
+SeekIndex* seek_index_open(const char* uri, const char* dir);
+void seek_index_free(SeekIndex* index);
+
+gboolean seek_index_is_ready(SeekIndex* index);
+
+// Keyframe at or before position, FALSE if the index is not ready or has none
+gboolean seek_index_lookup(SeekIndex* index, GstClockTime position, GstClockTime* keyframe);
+
+// Flushing seek of pipeline to target keeping the current rate. index may be null or not ready yet,
+// the demuxer then snaps by itself:
+//   SeekAccurate  the demuxer decodes from the keyframe before target and shows target exactly,
+//                 the index is not used
+//   SeekKeyframe  lands on the keyframe nearest to target
+//   SeekFast      lands on the keyframe at or before target
+gboolean seek_index_seek(SeekIndex* index, GstElement* pipeline, GstClockTime target, SeekMode mode);
+
+#endif
@@ -1,6 +1,7 @@
 #include "settings.h"
 #include "glib.h"
 #include "glibconfig.h"
+#include "gst/gstclock.h"
 #include <stdio.h>
 #include <getopt.h>
 #include <stdlib.h>
@@ -20,25 +21,32 @@ static gboolean file_exists(const char* filepath) {
 
 
 static gboolean is_path_web(const char* path) {
-    return (strstr(path, "https://") && strstr(path, "http://"));
+    return g_str_has_prefix(path, "https://") || g_str_has_prefix(path, "http://");
 }
 
-static gboolean is_audio_only_by_filepath(const char* filepath) {
-    const char *video_exts[] = { // That also includes pictures
-        ".mp4", ".mkv", ".mov", ".avi", ".flv",
-        ".webm", ".wmv", ".mpeg", ".mpg", ".m2ts", ".png", ".jpeg",
-        ".jpg"
-    };
-
-    gboolean is_video = FALSE;
-
-    for (int i = 0; i < ARRAY_SIZE(video_exts); ++i) {
-        if (g_str_has_suffix(filepath, video_exts[i])) {
-            is_video = TRUE;
-        }
+static const char *video_exts[] = { // That also includes pictures
+    ".mp4", ".mkv", ".mov", ".avi", ".flv",
+    ".webm", ".wmv", ".mpeg", ".mpg", ".m2ts", ".png", ".jpeg",
+    ".jpg"
+};
+
+static const char *audio_exts[] = {
+    ".mp3", ".wav", ".flac", ".ogg", ".oga", ".opus", ".aac", ".m4a", ".wma"
+};
+
+// The query and fragment of a url are not part of its file name
+static gboolean has_any_extension(const char* filepath, const char** exts, int count) {
+    gchar* name = is_path_web(filepath) ? g_strndup(filepath, strcspn(filepath, "?#")) : g_strdup(filepath);
+    gboolean is_found = FALSE;
+    for (int i = 0; i < count && !is_found; ++i) {
+        is_found = g_str_has_suffix(name, exts[i]);
     }
+    g_free(name);
+    return is_found;
+}
 
-    return (is_video == FALSE);
+static gboolean is_audio_only_by_filepath(const char* filepath) {
+    return !has_any_extension(filepath, video_exts, ARRAY_SIZE(video_exts));
 }
 
 static gboolean parse_double(const char* double_str, double* min, double* max, double* result) {
@@ -125,17 +133,43 @@ static gboolean parse_ul(const char* ul_str, guint64* min, guint64* max, guint64
     return TRUE;
 }
 
+gboolean settings_parse_ul(const char* ul_str, guint64* min, guint64* max, guint64* result) {
+    return parse_ul(ul_str, min, max, result);
+}
+
+// One path per line, empty lines and lines starting with # are skipped
+static void read_manifest(const char* manifest_path, Settings* settings) {
+    gchar* contents = NULL;
+    GError* err = NULL;
+    if (!g_file_get_contents(manifest_path, &contents, NULL, &err)) {
+        g_printerr("Could not read manifest %s: %s\n", manifest_path, err->message);
+        g_error_free(err);
+        return;
+    }
+
+    gchar** lines = g_strsplit(contents, "\n", -1);
+    for (int i = 0; lines[i]; ++i) {
+        gchar* line = g_strstrip(lines[i]);
+        if (*line == '\0' || *line == '#') {
+            continue;
+        }
+        g_ptr_array_add(settings->inputs, strdup(line));
+    }
+    g_strfreev(lines);
+    g_free(contents);
+}
+
 static void parse_long_option(const char* option_name, Settings* settings) {
     if (!strcmp(option_name, "path")) {
+        free(settings->filepath);
         settings->filepath = strdup(optarg);
-        gboolean is_web = is_path_web(settings->filepath);
-        if (!is_web) {
-            settings->is_audio_only = is_audio_only_by_filepath(settings->filepath);
-        }
+        settings->is_audio_only = settings_detect_audio_only(settings->filepath);
     } else if (!strcmp(option_name, "audio")) {
         settings->is_audio_only = TRUE;
+        settings->is_media_forced = TRUE;
     } else if (!strcmp(option_name, "video")) {
         settings->is_audio_only = FALSE;
+        settings->is_media_forced = TRUE;
     } else if (!strcmp(option_name, "volume")) {
         double min = 0.0; double max = 1.0;
         double result;
@@ -205,6 +239,249 @@ static void parse_long_option(const char* option_name, Settings* settings) {
             settings->has_noise_reduction = TRUE;
             settings->noise_reduction = result;
         }
+    } else if (!strcmp(option_name, "output")) {
+        settings->output_mode = OutputRender;
+        free(settings->output_path);
+        settings->output_path = strdup(optarg);
+    } else if (!strcmp(option_name, "audio-encoder")) {
+        free(settings->audio_encoder);
+        settings->audio_encoder = strdup(optarg);
+    } else if (!strcmp(option_name, "video-encoder")) {
+        free(settings->video_encoder);
+        settings->video_encoder = strdup(optarg);
+    } else if (!strcmp(option_name, "muxer")) {
+        free(settings->muxer);
+        settings->muxer = strdup(optarg);
+    } else if (!strcmp(option_name, "batch")) {
+        settings->is_batch = TRUE;
+    } else if (!strcmp(option_name, "playlist")) {
+        settings->is_playlist = TRUE;
+    } else if (!strcmp(option_name, "jobs")) {
+        guint64 min = 1; guint64 max = 1024;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->jobs = result;
+        }
+    } else if (!strcmp(option_name, "trace")) {
+        free(settings->trace_path);
+        settings->trace_path = strdup(optarg);
+    } else if (!strcmp(option_name, "probe")) {
+        settings->probe_mode = ProbeAlways;
+    } else if (!strcmp(option_name, "no-probe")) {
+        settings->probe_mode = ProbeNever;
+    } else if (!strcmp(option_name, "probe-timeout")) {
+        guint64 min = 1; guint64 max = G_MAXUINT64 / GST_MSECOND;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->probe_timeout = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "no-fuse")) {
+        settings->is_fusion_enabled = FALSE;
+    } else if (!strcmp(option_name, "no-elide")) {
+        settings->is_elision_enabled = FALSE;
+    } else if (!strcmp(option_name, "control")) {
+        free(settings->control_path);
+        settings->control_path = strdup(optarg);
+    } else if (!strcmp(option_name, "no-queues")) {
+        settings->has_branch_queues = FALSE;
+    } else if (!strcmp(option_name, "filter-queues")) {
+        settings->has_filter_queues = TRUE;
+    } else if (!strcmp(option_name, "queue-buffers")) {
+        guint64 min = 0; guint64 max = G_MAXUINT;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->queue_max_buffers = result;
+        }
+    } else if (!strcmp(option_name, "queue-bytes")) {
+        guint64 min = 0; guint64 max = G_MAXUINT;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->queue_max_bytes = result;
+        }
+    } else if (!strcmp(option_name, "queue-time")) {
+        guint64 min = 0; guint64 max = G_MAXUINT64 / GST_MSECOND;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->queue_max_time = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "seek-index")) {
+        settings->has_seek_index = TRUE;
+    } else if (!strcmp(option_name, "index-dir")) {
+        free(settings->index_dir);
+        settings->index_dir = strdup(optarg);
+    } else if (!strcmp(option_name, "normalize")) {
+        settings->is_normalized = TRUE;
+    } else if (!strcmp(option_name, "loudness-target")) {
+        double min = -70.0;
+        double max = 0.0;
+        double result;
+        if (parse_double(optarg, &min, &max, &result)) {
+            settings->loudness_target = result;
+        }
+    } else if (!strcmp(option_name, "loudness-dir")) {
+        free(settings->loudness_dir);
+        settings->loudness_dir = strdup(optarg);
+    } else if (!strcmp(option_name, "loudness-scan")) {
+        settings->is_loudness_scan = TRUE;
+        settings->is_batch = TRUE;
+    } else if (!strcmp(option_name, "extract")) {
+        free(settings->extract_dir);
+        settings->extract_dir = strdup(optarg);
+    } else if (!strcmp(option_name, "thumbnail-interval")) {
+        double min = 0.1;
+        double max = 24 * 3600.0;
+        double result;
+        if (parse_double(optarg, &min, &max, &result)) {
+            settings->thumbnail_interval = result * GST_SECOND;
+        }
+    } else if (!strcmp(option_name, "thumbnail-width")) {
+        guint64 min = 16;
+        guint64 max = 1920;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->thumbnail_width = result;
+        }
+    } else if (!strcmp(option_name, "seek-mode")) {
+        if (!settings_parse_seek_mode(optarg, &settings->seek_mode)) {
+            g_printerr("seek mode must be accurate, keyframe or fast (got %s)\n", optarg);
+        }
+    } else if (!strcmp(option_name, "start")) {
+        double min = 0.0;
+        double max = G_MAXINT64 / (double)GST_SECOND;
+        double result;
+        if (parse_double(optarg, &min, &max, &result)) {
+            settings->start_position = result * GST_SECOND;
+        }
+    } else if (!strcmp(option_name, "cache")) {
+        free(settings->cache_dir);
+        settings->cache_dir = strdup(optarg);
+    } else if (!strcmp(option_name, "cache-size")) {
+        guint64 min = 1; guint64 max = G_MAXUINT64 / (1024 * 1024);
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->cache_max_bytes = result * 1024 * 1024;
+        }
+    } else if (!strcmp(option_name, "buffer-size")) {
+        guint64 min = 0; guint64 max = G_MAXINT;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->source_buffer_size = result;
+        }
+    } else if (!strcmp(option_name, "buffer-duration")) {
+        guint64 min = 0; guint64 max = G_MAXINT64 / GST_MSECOND;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->source_buffer_duration = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "mmap")) {
+        settings->is_mmap_source = TRUE;
+    } else if (!strcmp(option_name, "decoder-threads")) {
+        guint64 min = 0; guint64 max = 256;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->decoder_threads = result;
+        }
+    } else if (!strcmp(option_name, "decoder-skip-frame")) {
+        free(settings->decoder_skip_frame);
+        settings->decoder_skip_frame = strdup(optarg);
+    } else if (!strcmp(option_name, "decoder-low-latency")) {
+        settings->is_decoder_low_latency = TRUE;
+    } else if (!strcmp(option_name, "sink-buffer-time")) {
+        guint64 min = 1; guint64 max = 10000;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->sink_buffer_time = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "sink-latency-time")) {
+        guint64 min = 1; guint64 max = 1000;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->sink_latency_time = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "pipeline-latency")) {
+        guint64 min = 0; guint64 max = 10000;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->pipeline_latency = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "low-latency")) {
+        // 4 segments of 5 ms in the sink, explicit values win whatever their position on the command line
+        settings->is_low_latency = TRUE;
+        settings->is_decoder_low_latency = TRUE;
+        if (settings->sink_buffer_time < 0) {
+            settings->sink_buffer_time = 20 * GST_MSECOND;
+        }
+        if (settings->sink_latency_time < 0) {
+            settings->sink_latency_time = 5 * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "measure-latency")) {
+        settings->is_latency_measured = TRUE;
+    } else if (!strcmp(option_name, "convert-threads")) {
+        guint64 min = 0; guint64 max = 256;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->convert_threads = result;
+        }
+    } else if (!strcmp(option_name, "pin-format")) {
+        free(settings->pin_format);
+        settings->pin_format = strdup(optarg);
+    } else if (!strcmp(option_name, "pin-rate")) {
+        guint64 min = 1; guint64 max = 768000;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->pin_rate = result;
+            if (!settings->pin_format) {
+                settings->pin_format = strdup(DEFAULT_PIN_FORMAT);
+            }
+        }
+    } else if (!strcmp(option_name, "analysis")) {
+        settings->has_analysis = TRUE;
+    } else if (!strcmp(option_name, "analysis-fft-size")) {
+        guint64 min = 64; guint64 max = 16384;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->analysis_fft_size = result;
+        }
+    } else if (!strcmp(option_name, "analysis-interval")) {
+        guint64 min = 1; guint64 max = G_MAXUINT64 / GST_MSECOND;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->analysis_interval = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "analysis-bands")) {
+        guint64 min = 1; guint64 max = 64;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->analysis_bands = result;
+        }
+    } else if (!strcmp(option_name, "profile-startup")) {
+        settings->is_startup_profiled = TRUE;
+    } else if (!strcmp(option_name, "fast-start")) {
+        settings->is_fast_start = TRUE;
+    } else if (!strcmp(option_name, "alloc-stats")) {
+        settings->has_alloc_stats = TRUE;
+    } else if (!strcmp(option_name, "no-video-pool")) {
+        settings->has_video_pool = FALSE;
+    } else if (!strcmp(option_name, "metrics-file")) {
+        free(settings->metrics_path);
+        settings->metrics_path = strdup(optarg);
+    } else if (!strcmp(option_name, "metrics-port")) {
+        guint64 min = 1; guint64 max = 65535;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->metrics_port = result;
+        }
+    } else if (!strcmp(option_name, "metrics-interval")) {
+        guint64 min = 10; guint64 max = G_MAXUINT64 / GST_MSECOND;
+        guint64 result;
+        if (parse_ul(optarg, &min, &max, &result)) {
+            settings->metrics_interval = result * GST_MSECOND;
+        }
+    } else if (!strcmp(option_name, "qos-adapt")) {
+        settings->has_qos_adapt = TRUE;
+    } else if (!strcmp(option_name, "manifest")) {
+        settings->is_batch = TRUE;
+        read_manifest(optarg, settings);
     }
 }
 
@@ -236,6 +513,70 @@ void settings_set_default(Settings* settings) {
     settings->has_videobalance = FALSE;
     settings->has_speed = FALSE;
     settings->has_noise_reduction = FALSE;
+
+    settings->output_mode = OutputPlayback;
+    settings->output_path = NULL;
+    settings->audio_encoder = NULL;
+    settings->video_encoder = NULL;
+    settings->muxer = NULL;
+
+    settings->is_media_forced = FALSE;
+    settings->is_batch = FALSE;
+    settings->is_playlist = FALSE;
+    settings->jobs = g_get_num_processors();
+    settings->inputs = g_ptr_array_new_with_free_func(free);
+
+    settings->probe_mode = ProbeAuto;
+    settings->probe_timeout = 2 * GST_SECOND;
+    settings->is_fusion_enabled = TRUE;
+    settings->is_elision_enabled = TRUE;
+    settings->has_seek_index = FALSE;
+    settings->index_dir = NULL;
+    settings->is_normalized = FALSE;
+    settings->loudness_target = -23.0;
+    settings->loudness_dir = NULL;
+    settings->is_loudness_scan = FALSE;
+    settings->extract_dir = NULL;
+    settings->thumbnail_interval = 10 * GST_SECOND;
+    settings->thumbnail_width = 160;
+    settings->seek_mode = SeekAccurate;
+    settings->start_position = -1;
+    settings->cache_dir = NULL;
+    settings->cache_max_bytes = 1024 * 1024 * 1024;
+    settings->source_buffer_size = -1;
+    settings->source_buffer_duration = -1;
+    settings->is_mmap_source = FALSE;
+    settings->decoder_threads = -1;
+    settings->decoder_skip_frame = NULL;
+    settings->is_decoder_low_latency = FALSE;
+    settings->convert_threads = -1;
+    settings->sink_buffer_time = -1;
+    settings->sink_latency_time = -1;
+    settings->pipeline_latency = -1;
+    settings->is_low_latency = FALSE;
+    settings->is_latency_measured = FALSE;
+    settings->pin_format = NULL;
+    settings->pin_rate = 0;
+    settings->has_analysis = FALSE;
+    settings->analysis_fft_size = 2048;
+    settings->analysis_interval = 100 * GST_MSECOND;
+    settings->analysis_bands = 16;
+    settings->is_startup_profiled = FALSE;
+    settings->is_fast_start = FALSE;
+    settings->has_alloc_stats = FALSE;
+    settings->has_video_pool = TRUE;
+    settings->has_qos_adapt = FALSE;
+    settings->trace_path = NULL;
+    settings->control_path = NULL;
+    settings->metrics_path = NULL;
+    settings->metrics_port = 0;
+    settings->metrics_interval = GST_SECOND;
+
+    settings->has_branch_queues = TRUE;
+    settings->has_filter_queues = FALSE;
+    settings->queue_max_buffers = 200;
+    settings->queue_max_bytes = 10 * 1024 * 1024;
+    settings->queue_max_time = GST_SECOND;
 }
 
 char* settings_get_file_uri(Settings* settings) {
@@ -271,6 +612,52 @@ char* settings_get_file_uri(Settings* settings) {
 }
 
 
+void settings_free(Settings* settings) {
+    free(settings->filepath);
+    free(settings->output_path);
+    free(settings->audio_encoder);
+    free(settings->video_encoder);
+    free(settings->muxer);
+    free(settings->trace_path);
+    free(settings->control_path);
+    free(settings->metrics_path);
+    free(settings->pin_format);
+    free(settings->decoder_skip_frame);
+    free(settings->cache_dir);
+    free(settings->index_dir);
+    free(settings->loudness_dir);
+    free(settings->extract_dir);
+    if (settings->inputs) {
+        g_ptr_array_free(settings->inputs, TRUE);
+    }
+}
+
+// A url is only taken as audio when its file name says so, anything else may have video
+gboolean settings_detect_audio_only(const char* filepath) {
+    if (is_path_web(filepath)) {
+        return has_any_extension(filepath, audio_exts, ARRAY_SIZE(audio_exts));
+    }
+    return is_audio_only_by_filepath(filepath);
+}
+
+// Ogg and the like can hold video too, but their extension is a reasonable guess
+gboolean settings_has_media_extension(const char* filepath) {
+    return has_any_extension(filepath, video_exts, ARRAY_SIZE(video_exts))
+        || has_any_extension(filepath, audio_exts, ARRAY_SIZE(audio_exts));
+}
+
+gboolean settings_parse_seek_mode(const char* name, SeekMode* mode) {
+    if (!strcmp(name, "accurate")) {
+        *mode = SeekAccurate;
+    } else if (!strcmp(name, "keyframe")) {
+        *mode = SeekKeyframe;
+    } else if (!strcmp(name, "fast")) {
+        *mode = SeekFast;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
 
 void settings_parse_cli(Settings *settings, int *argc, char ***argv, int *error) {
     settings_set_default(settings);
@@ -292,6 +679,65 @@ void settings_parse_cli(Settings *settings, int *argc, char ***argv, int *error)
     {"grayscale", required_argument, 0, 0},
     {"colorinvert", required_argument, 0, 0},
     {"noisethreshold", required_argument, 0, 0},
+    {"output", required_argument, 0, 0},
+    {"audio-encoder", required_argument, 0, 0},
+    {"video-encoder", required_argument, 0, 0},
+    {"muxer", required_argument, 0, 0},
+    {"batch", no_argument, 0, 0},
+    {"playlist", no_argument, 0, 0},
+    {"jobs", required_argument, 0, 0},
+    {"manifest", required_argument, 0, 0},
+    {"probe", no_argument, 0, 0},
+    {"no-probe", no_argument, 0, 0},
+    {"probe-timeout", required_argument, 0, 0},
+    {"no-fuse", no_argument, 0, 0},
+    {"no-elide", no_argument, 0, 0},
+    {"trace", required_argument, 0, 0},
+    {"seek-index", no_argument, 0, 0},
+    {"index-dir", required_argument, 0, 0},
+    {"normalize", no_argument, 0, 0},
+    {"loudness-target", required_argument, 0, 0},
+    {"loudness-dir", required_argument, 0, 0},
+    {"loudness-scan", no_argument, 0, 0},
+    {"extract", required_argument, 0, 0},
+    {"thumbnail-interval", required_argument, 0, 0},
+    {"thumbnail-width", required_argument, 0, 0},
+    {"seek-mode", required_argument, 0, 0},
+    {"start", required_argument, 0, 0},
+    {"cache", required_argument, 0, 0},
+    {"cache-size", required_argument, 0, 0},
+    {"buffer-size", required_argument, 0, 0},
+    {"buffer-duration", required_argument, 0, 0},
+    {"mmap", no_argument, 0, 0},
+    {"decoder-threads", required_argument, 0, 0},
+    {"decoder-skip-frame", required_argument, 0, 0},
+    {"decoder-low-latency", no_argument, 0, 0},
+    {"convert-threads", required_argument, 0, 0},
+    {"sink-buffer-time", required_argument, 0, 0},
+    {"sink-latency-time", required_argument, 0, 0},
+    {"pipeline-latency", required_argument, 0, 0},
+    {"low-latency", no_argument, 0, 0},
+    {"measure-latency", no_argument, 0, 0},
+    {"pin-format", required_argument, 0, 0},
+    {"pin-rate", required_argument, 0, 0},
+    {"analysis", no_argument, 0, 0},
+    {"analysis-fft-size", required_argument, 0, 0},
+    {"analysis-interval", required_argument, 0, 0},
+    {"analysis-bands", required_argument, 0, 0},
+    {"profile-startup", no_argument, 0, 0},
+    {"fast-start", no_argument, 0, 0},
+    {"alloc-stats", no_argument, 0, 0},
+    {"no-video-pool", no_argument, 0, 0},
+    {"qos-adapt", no_argument, 0, 0},
+    {"control", required_argument, 0, 0},
+    {"metrics-file", required_argument, 0, 0},
+    {"metrics-port", required_argument, 0, 0},
+    {"metrics-interval", required_argument, 0, 0},
+    {"no-queues", no_argument, 0, 0},
+    {"filter-queues", no_argument, 0, 0},
+    {"queue-buffers", required_argument, 0, 0},
+    {"queue-bytes", required_argument, 0, 0},
+    {"queue-time", required_argument, 0, 0},
     {0, 0, 0, 0}
     };
 
@@ -312,19 +758,19 @@ void settings_parse_cli(Settings *settings, int *argc, char ***argv, int *error)
                 break;
             }
             case 'p': {
+                free(settings->filepath);
                 settings->filepath = strdup(optarg);
-                gboolean is_web = is_path_web(settings->filepath);
-                if (!is_web) {
-                    settings->is_audio_only = is_audio_only_by_filepath(settings->filepath);
-                }
+                settings->is_audio_only = settings_detect_audio_only(settings->filepath);
                 break;
             }
             case 'a': {
                 settings->is_audio_only = TRUE;
+                settings->is_media_forced = TRUE;
                 break;
             }
             case 'v': {
                 settings->is_audio_only = FALSE;
+                settings->is_media_forced = TRUE;
                 break;
             }
             default: {
@@ -334,5 +780,10 @@ void settings_parse_cli(Settings *settings, int *argc, char ***argv, int *error)
         }
     }
 
+    // Whatever is left after the options are batch inputs
+    for (int i = optind; i < *argc; ++i) {
+        g_ptr_array_add(settings->inputs, strdup((*argv)[i]));
+    }
+
     *error = 0;
 }
@@ -10,12 +10,35 @@
 #define ARRAY_SIZE(arr) sizeof(arr) / sizeof(*arr)
 
 
+#define DEFAULT_AUDIO_ENCODER "audioconvert ! vorbisenc"
+#define DEFAULT_VIDEO_ENCODER "videoconvert ! vp8enc deadline=1"
+#define DEFAULT_MUXER "matroskamux"
+#define DEFAULT_PIN_FORMAT "F32LE"
+
+typedef enum OutputMode {
+    OutputPlayback, // autoaudiosink/autovideosink
+    OutputRender, // encoders + muxer + filesink, runs faster than realtime
+    OutputNull // fakesink sync=false, processed data is discarded
+} OutputMode;
+
 typedef enum PassType {
     PassLow,
     PassHigh,
     PassNone
 } PassType;
 
+typedef enum SeekMode {
+    SeekAccurate, // exact position, decodes from the keyframe before it
+    SeekKeyframe, // nearest keyframe
+    SeekFast // keyframe at or before the position
+} SeekMode;
+
+typedef enum ProbeMode {
+    ProbeAuto, // only media without a known extension
+    ProbeAlways, // --probe
+    ProbeNever // --no-probe
+} ProbeMode;
+
 typedef struct Settings {
     char* filepath; // default null
     gboolean is_audio_only; // default false
@@ -49,10 +72,92 @@ typedef struct Settings {
     
     gboolean has_noise_reduction; // false by default
     float noise_reduction; // 0.0f by default
+
+    OutputMode output_mode; // OutputPlayback by default
+    char* output_path; // default null, set with --output
+    char* audio_encoder; // gst-launch style description, null means DEFAULT_AUDIO_ENCODER
+    char* video_encoder; // null means DEFAULT_VIDEO_ENCODER
+    char* muxer; // factory name, null means DEFAULT_MUXER
+
+    gboolean is_media_forced; // --audio or --video given, FALSE by default
+    gboolean is_batch; // false by default
+    gboolean is_playlist; // gapless playback of --path and the inputs, false by default
+    guint jobs; // parallel pipelines in batch mode, number of cores by default
+    GPtrArray* inputs; // batch inputs from positional args and --manifest, owns strings
+
+    ProbeMode probe_mode; // when the content decides the media type instead of the extension, ProbeAuto by default
+    guint64 probe_timeout; // in nanoseconds, 2 seconds by default
+
+    gboolean is_fusion_enabled; // volume/balance/pass/echo combinations use the fused element, TRUE by default
+    gboolean is_elision_enabled; // filters with identity parameters are left out, TRUE by default
+
+    gboolean has_seek_index; // build or load the keyframe index of local video files, false by default
+    char* index_dir; // where indexes are kept, the user cache directory if null
+
+    gboolean is_normalized; // EBU R128 gain on top of the volume, false by default
+    double loudness_target; // LUFS, -23 by default
+    char* loudness_dir; // where measured loudness is kept, the user cache directory if null
+    gboolean is_loudness_scan; // batch jobs only measure loudness, false by default
+    char* extract_dir; // thumbnail sheets and waveform peaks go here instead of playing, disabled if null
+    guint64 thumbnail_interval; // in nanoseconds between thumbnails, 10 seconds by default
+    gint thumbnail_width; // in pixels, 160 by default
+    SeekMode seek_mode; // SeekAccurate by default
+    gint64 start_position; // initial seek in nanoseconds, -1 plays from the beginning
+
+    char* cache_dir; // on-disk cache of http(s) media, disabled if null
+    guint64 cache_max_bytes; // 1 GB by default
+    gint source_buffer_size; // uridecodebin buffer-size in bytes, -1 keeps the uridecodebin default
+    gint64 source_buffer_duration; // uridecodebin buffer-duration in nanoseconds, -1 keeps the default
+    gboolean is_mmap_source; // local files are read through mmapsrc instead of filesrc, false by default
+
+    gint decoder_threads; // thread count of each decoder, 0 lets it pick, -1 keeps the decoder default
+    char* decoder_skip_frame; // skip-frame value for decoders that have it, decoder default if null
+    gboolean is_decoder_low_latency; // no frame threading in the decoders, false by default
+    gint convert_threads; // n-threads of videoconvert and videoscale, 0 is one per core, -1 keeps the default
+
+    gint64 sink_buffer_time; // audio sink buffer-time in nanoseconds, -1 keeps the sink default
+    gint64 sink_latency_time; // audio sink latency-time (one segment) in nanoseconds, -1 keeps the sink default
+    gint64 pipeline_latency; // fixed pipeline latency in nanoseconds, -1 uses what the latency query negotiates
+    gboolean is_low_latency; // small sink buffers and the negotiated latency printed, false by default
+    gboolean is_latency_measured; // impulses through the audio chain instead of playing, false by default
+
+    char* pin_format; // audio format the whole chain runs in, not pinned if null
+    guint pin_rate; // with pin_format, 0 means the native rate of the sink (source rate when not playing back)
+
+    gboolean has_analysis; // level and spectrum messages from the end of the audio chain, false by default
+    guint analysis_fft_size; // samples per spectrum, power of two, 2048 by default
+    guint64 analysis_interval; // in nanoseconds, 100 ms by default
+    guint analysis_bands; // spectrum bands, 16 by default
+
+    gboolean is_startup_profiled; // print the time of each startup phase at exit, false by default
+    gboolean is_fast_start; // warm registry, video branch created on its own thread or once video shows up, false by default
+
+    gboolean has_alloc_stats; // print buffer allocations per element at exit, false by default
+    gboolean has_video_pool; // bounded frame pool when the video sink offers none, TRUE by default
+    gboolean has_qos_adapt; // lower video quality step by step while frames are late, false by default
+
+    char* trace_path; // chrome trace output, tracing is off if null
+    char* control_path; // unix control socket, disabled if null
+    char* metrics_path; // Prometheus text file rewritten every metrics_interval, not written if null
+    guint metrics_port; // Prometheus endpoint on 127.0.0.1, disabled if 0
+    guint64 metrics_interval; // in nanoseconds, 1 s by default
+
+    gboolean has_branch_queues; // queue at the head of each branch, TRUE by default
+    gboolean has_filter_queues; // queues in front of pitch and noise reduction, FALSE by default
+    guint queue_max_buffers; // 0 disables the limit, 200 by default
+    guint queue_max_bytes; // 0 disables the limit, 10 MB by default
+    guint64 queue_max_time; // in nanoseconds, 0 disables the limit, 1 second by default
 } Settings;
 
 void settings_parse_cli(Settings *settings, int *argc, char ***argv, int *error);
+void settings_set_default(Settings* settings);
 char* settings_get_file_uri(Settings* settings);
+void settings_free(Settings* settings);
+gboolean settings_detect_audio_only(const char* filepath);
+gboolean settings_has_media_extension(const char* filepath);
+gboolean settings_parse_seek_mode(const char* name, SeekMode* mode);
+// Unsigned decimal as the options take it, errors are printed. min and max may be null
+gboolean settings_parse_ul(const char* ul_str, guint64* min, guint64* max, guint64* result);
 
 // gboolean parse_is_audio_only(int *argc, char*** argv, int *error);
 
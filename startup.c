@@ -0,0 +1,142 @@
+#include "startup.h"
+#include "glib.h"
+#include <gst/gst.h>
+
+typedef struct StartupMark {
+    const char* phase; // static string
+    gint64 time;
+} StartupMark;
+
+struct StartupProfile {
+    gint64 origin_time;
+    GMutex lock; // marks come from the main and the streaming threads
+    GArray* marks; // of StartupMark
+    GstBus* bus; // watched for preroll, null until startup_watch_pipeline
+};
+
+StartupProfile* startup_profile_new(gint64 origin_time) {
+    StartupProfile* profile = g_new0(StartupProfile, 1);
+    profile->origin_time = origin_time;
+    profile->marks = g_array_new(FALSE, FALSE, sizeof(StartupMark));
+    g_mutex_init(&profile->lock);
+    return profile;
+}
+
+void startup_profile_free(StartupProfile* profile) {
+    if (!profile) {
+        return;
+    }
+    if (profile->bus) {
+        g_signal_handlers_disconnect_by_data(profile->bus, profile);
+        gst_bus_disable_sync_message_emission(profile->bus);
+        gst_object_unref(profile->bus);
+    }
+    g_array_free(profile->marks, TRUE);
+    g_mutex_clear(&profile->lock);
+    g_free(profile);
+}
+
+void startup_mark(StartupProfile* profile, const char* phase) {
+    startup_mark_at(profile, phase, g_get_monotonic_time());
+}
+
+void startup_mark_at(StartupProfile* profile, const char* phase, gint64 time) {
+    if (!profile) {
+        return;
+    }
+
+    g_mutex_lock(&profile->lock);
+    gboolean is_marked = FALSE;
+    for (guint i = 0; i < profile->marks->len; ++i) {
+        if (!g_strcmp0(g_array_index(profile->marks, StartupMark, i).phase, phase)) {
+            is_marked = TRUE;
+            break;
+        }
+    }
+    if (!is_marked) {
+        StartupMark mark = {phase, time};
+        g_array_append_val(profile->marks, mark);
+    }
+    g_mutex_unlock(&profile->lock);
+}
+
+static GstPadProbeReturn first_buffer_probe(GstPad* pad, GstPadProbeInfo* info, gpointer user_data) {
+    StartupProfile* profile = g_object_get_data(G_OBJECT(pad), "startup-profile");
+    startup_mark(profile, user_data);
+    return GST_PAD_PROBE_REMOVE;
+}
+
+void startup_watch_sink(StartupProfile* profile, GstElement* sink, const char* phase) {
+    if (!profile || !sink) {
+        return;
+    }
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    if (!pad) {
+        return;
+    }
+    g_object_set_data(G_OBJECT(pad), "startup-profile", profile);
+    gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, first_buffer_probe, (gpointer)phase, NULL);
+    gst_object_unref(pad);
+}
+
+static void sync_message_signal(GstBus* bus, GstMessage* message, StartupProfile* profile) {
+    switch (GST_MESSAGE_TYPE(message)) {
+        case GST_MESSAGE_ASYNC_DONE:
+            startup_mark(profile, "preroll");
+            break;
+        case GST_MESSAGE_STATE_CHANGED: {
+            // Only the pipeline posts on its own bus with no parent
+            if (GST_OBJECT_PARENT(GST_MESSAGE_SRC(message))) {
+                break;
+            }
+            GstState new_state;
+            gst_message_parse_state_changed(message, NULL, &new_state, NULL);
+            if (new_state == GST_STATE_PLAYING) {
+                startup_mark(profile, "playing");
+            }
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+void startup_watch_pipeline(StartupProfile* profile, GstElement* pipeline) {
+    if (!profile) {
+        return;
+    }
+    // The bus loop may be blocked in a get_state while prerolling, the sync handler is not
+    profile->bus = gst_element_get_bus(pipeline);
+    gst_bus_enable_sync_message_emission(profile->bus);
+    g_signal_connect(profile->bus, "sync-message", G_CALLBACK(sync_message_signal), profile);
+}
+
+static gint compare_marks(gconstpointer a, gconstpointer b) {
+    gint64 time_a = ((const StartupMark*)a)->time;
+    gint64 time_b = ((const StartupMark*)b)->time;
+    return time_a < time_b ? -1 : time_a > time_b;
+}
+
+void startup_print(StartupProfile* profile) {
+    if (!profile) {
+        return;
+    }
+    g_mutex_lock(&profile->lock);
+    g_array_sort(profile->marks, compare_marks);
+    g_print("Startup (ms since process start):\n");
+    gint64 previous = profile->origin_time;
+    for (guint i = 0; i < profile->marks->len; ++i) {
+        StartupMark* mark = &g_array_index(profile->marks, StartupMark, i);
+        g_print("  %-20s %9.1f  (+%.1f)\n", mark->phase, (mark->time - profile->origin_time) / 1000.0,
+                (mark->time - previous) / 1000.0);
+        previous = mark->time;
+    }
+    g_mutex_unlock(&profile->lock);
+}
+
+void startup_warm_registry(void) {
+    // GStreamer still scans when there is no cache to read, so the first run builds it as usual.
+    // Plugins installed later show up once a run without this rescans.
+    g_setenv("GST_REGISTRY_UPDATE", "no", FALSE);
+    gst_registry_fork_set_enabled(FALSE);
+}
@@ -0,0 +1,31 @@
+#ifndef __STARTUP_H
+#define __STARTUP_H
+
+#include "gst/gstelement.h"
+
+// Startup profile: named phases are marked once, with the time since process start, and printed
+// in the order they happened. Every function takes a null profile and then does nothing, so the
+// callers don't have to check whether --profile-startup was given.
+typedef struct StartupProfile StartupProfile;
+
+// origin_time is the g_get_monotonic_time everything is measured from
+StartupProfile* startup_profile_new(gint64 origin_time);
+void startup_profile_free(StartupProfile* profile);
+
+// Only the first mark of a phase counts, safe from any thread
+void startup_mark(StartupProfile* profile, const char* phase);
+// For phases that ended before the profile existed
+void startup_mark_at(StartupProfile* profile, const char* phase, gint64 time);
+
+// Marks phase when the first buffer reaches the sink pad of sink
+void startup_watch_sink(StartupProfile* profile, GstElement* sink, const char* phase);
+// Marks "preroll" on the first ASYNC_DONE of pipeline and "playing" once it reaches PLAYING
+void startup_watch_pipeline(StartupProfile* profile, GstElement* pipeline);
+
+void startup_print(StartupProfile* profile);
+
+// Call before gst_init. Skips the plugin scan when a registry cache exists and loads the
+// registry in process instead of forking a scanner.
+void startup_warm_registry(void);
+
+#endif
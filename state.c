@@ -1,123 +1,648 @@
 #include "state.h"
+#include "fusedaudio.h"
+#include "analysis.h"
+#include "cache.h"
+#include "startup.h"
+#include "probe.h"
+#include "alloc.h"
+#include "decoder.h"
+#include "latency.h"
 #include "glib.h"
 #include "gst/gstbin.h"
 #include "gst/gstcaps.h"
 #include "gst/gstelement.h"
 #include "gst/gstelementfactory.h"
 #include "gst/gstutils.h"
+#include <gst/audio/audio.h>
 #include <math.h>
 #include <stdio.h>
+#include <string.h>
+
+// Builds "converter ! encoder" style descriptions into a bin with ghost pads, so it can end a chain like a sink does
+static GstElement* make_encoder_bin(const char* description, const char* name) {
+    GError* err = NULL;
+    GstElement* bin = gst_parse_bin_from_description(description, TRUE, &err);
+    if (err) {
+        g_printerr("Could not create encoder \"%s\": %s\n", description, err->message);
+        g_clear_error(&err);
+        if (bin) {
+            gst_object_unref(bin);
+        }
+        return NULL;
+    }
+    gst_object_set_name(GST_OBJECT(bin), name);
+    return bin;
+}
+
+static GstElement* make_null_sink(const char* name) {
+    GstElement* sink = gst_element_factory_make("fakesink", name);
+    if (sink) {
+        g_object_set(sink, "sync", FALSE, NULL);
+    }
+    return sink;
+}
+
+static GstElement* make_audio_sink(Settings* settings) {
+    if (settings->output_mode == OutputRender) {
+        return make_encoder_bin(settings->audio_encoder ? settings->audio_encoder : DEFAULT_AUDIO_ENCODER, "audio-encoder");
+    }
+    if (settings->output_mode == OutputNull) {
+        return make_null_sink("audio-sink");
+    }
+    GstElement* sink = gst_element_factory_make("autoaudiosink", "audio-sink");
+    latency_configure_sink(sink, settings);
+    return sink;
+}
+
+static GstElement* make_video_sink(Settings* settings) {
+    if (settings->output_mode == OutputRender) {
+        return make_encoder_bin(settings->video_encoder ? settings->video_encoder : DEFAULT_VIDEO_ENCODER, "video-encoder");
+    }
+    if (settings->output_mode == OutputNull) {
+        return make_null_sink("video-sink");
+    }
+    return gst_element_factory_make("autovideosink", "video-sink");
+}
+
+// autoaudiosink only picks its real sink on READY. Of the rates that sink takes, the one closest to 48 kHz counts as native
+static guint detect_sink_rate(GstElement* sink) {
+    if (gst_element_set_state(sink, GST_STATE_READY) == GST_STATE_CHANGE_FAILURE) {
+        return 0;
+    }
+
+    guint rate = 0;
+    GstPad* pad = gst_element_get_static_pad(sink, "sink");
+    GstCaps* caps = gst_pad_query_caps(pad, NULL);
+    if (!gst_caps_is_any(caps) && !gst_caps_is_empty(caps)) {
+        GstStructure* structure = gst_structure_copy(gst_caps_get_structure(caps, 0));
+        int fixed_rate;
+        if (gst_structure_has_field(structure, "rate")
+            && gst_structure_fixate_field_nearest_int(structure, "rate", 48000)
+            && gst_structure_get_int(structure, "rate", &fixed_rate)) {
+            rate = fixed_rate;
+        }
+        gst_structure_free(structure);
+    }
+    gst_caps_unref(caps);
+    gst_object_unref(pad);
+
+    // The pipeline takes it up again from NULL
+    gst_element_set_state(sink, GST_STATE_NULL);
+    return rate;
+}
+
+static GstElement* make_audio_format_filter(State* state, Settings* settings) {
+    if (gst_audio_format_from_string(settings->pin_format) == GST_AUDIO_FORMAT_UNKNOWN) {
+        g_printerr("Unknown audio format %s\n", settings->pin_format);
+        return NULL;
+    }
+
+    GstElement* filter = gst_element_factory_make("capsfilter", "audio-format-filter");
+    if (!filter) {
+        g_printerr("Could not create audio format filter\n");
+        return NULL;
+    }
+
+    GstCaps* caps = gst_caps_new_simple("audio/x-raw", "format", G_TYPE_STRING, settings->pin_format,
+                                        "layout", G_TYPE_STRING, "interleaved", NULL);
+    state->pinned_rate = settings->pin_rate;
+    if (!state->pinned_rate && settings->output_mode == OutputPlayback) {
+        state->pinned_rate = detect_sink_rate(state->audio_sink);
+    }
+    if (state->pinned_rate) {
+        gst_caps_set_simple(caps, "rate", G_TYPE_INT, (int)state->pinned_rate, NULL);
+    }
+
+    gchar* caps_str = gst_caps_to_string(caps);
+    g_print("Pinned audio format: %s\n", caps_str);
+    g_free(caps_str);
+
+    g_object_set(filter, "caps", caps, NULL);
+    gst_caps_unref(caps);
+    return filter;
+}
+
+// The source already has the pinned rate, so the converter feeds the format filter directly
+static void drop_resampler(State* state) {
+    GstElement* resampler = state->audio_resampler;
+    GstPad* resampler_src = gst_element_get_static_pad(resampler, "src");
+    GstPad* next_sink = gst_pad_get_peer(resampler_src);
+    GstPad* converter_src = gst_element_get_static_pad(state->audio_converter, "src");
+
+    gst_element_unlink(state->audio_converter, resampler);
+    gst_pad_unlink(resampler_src, next_sink);
+    if (GST_PAD_LINK_FAILED(gst_pad_link(converter_src, next_sink))) {
+        // Put it back, converting the rate twice is better than no audio
+        g_printerr("Could not drop the audio resampler\n");
+        gst_element_link_many(state->audio_converter, resampler, NULL);
+        gst_pad_link(resampler_src, next_sink);
+    } else {
+        gst_object_ref(resampler);
+        gst_bin_remove(GST_BIN(state->pipeline), resampler);
+        gst_element_set_state(resampler, GST_STATE_NULL);
+        gst_object_unref(resampler);
+        state->audio_resampler = NULL;
+        g_print("Dropped audio resampler: source rate is already %u Hz\n", state->pinned_rate);
+    }
+
+    gst_object_unref(converter_src);
+    gst_object_unref(next_sink);
+    gst_object_unref(resampler_src);
+}
+
+// Volume, balance, pass filter and echo run as one fused element once at least two of them are used
+static gboolean use_fused_audio(Settings* settings) {
+    if (!settings->is_fusion_enabled) {
+        return FALSE;
+    }
+    int count = settings->has_volume + settings->has_panorama + (settings->pass_type != PassNone) + settings->has_echo;
+    return count >= 2;
+}
+
+static GstElement* make_queue(Settings* settings, const char* name) {
+    GstElement* queue = gst_element_factory_make("queue", name);
+    if (!queue) {
+        g_printerr("Could not create %s\n", name);
+        return NULL;
+    }
+    g_object_set(queue,
+        "max-size-buffers", settings->queue_max_buffers,
+        "max-size-bytes", settings->queue_max_bytes,
+        "max-size-time", settings->queue_max_time,
+        NULL);
+    return queue;
+}
+
+static gboolean link_render_tail(State* state) {
+    if (!state->is_video_only && !gst_element_link(state->audio_sink, state->muxer)) {
+        g_printerr("Was unable to link audio encoder to muxer\n");
+        return FALSE;
+    }
+    if (!state->is_audio_only && !gst_element_link(state->video_sink, state->muxer)) {
+        g_printerr("Was unable to link video encoder to muxer\n");
+        return FALSE;
+    }
+    if (!gst_element_link(state->muxer, state->file_sink)) {
+        g_printerr("Was unable to link muxer to file sink\n");
+        return FALSE;
+    }
+    return TRUE;
+}
+
+// Sink pad a decoded pad of source has to be linked to: the branch head, or with a playlist a concat pad of its own
+static GstPad* get_branch_sink_pad(GstElement* source, GstElement* concat, GstElement* head, const char* concat_pad_key) {
+    if (!concat) {
+        return gst_element_get_static_pad(head, "sink");
+    }
+
+    GstPad* pad = g_object_get_data(G_OBJECT(source), concat_pad_key);
+    if (!pad) {
+        pad = gst_element_request_pad_simple(concat, "sink_%u");
+        g_object_set_data_full(G_OBJECT(source), concat_pad_key, pad, gst_object_unref);
+    }
+    return gst_object_ref(pad);
+}
+
+static gboolean build_deferred_video_branch(State* state);
+
+static void pad_added_signal (GstElement *self, GstPad *new_pad, State* state) {
+    GstPad* converter_sink = NULL;
+
+    GstCaps* new_pad_caps = gst_pad_get_current_caps(new_pad);
+    GstStructure* new_pad_caps_structure = gst_caps_get_structure(new_pad_caps, 0);
+    const char* new_pad_type = gst_structure_get_name(new_pad_caps_structure);
+
+    if (!state->is_video_only && g_str_has_prefix(new_pad_type, "audio/x-raw")) {
+        converter_sink = get_branch_sink_pad(self, state->audio_concat, state_audio_head(state), STATE_AUDIO_CONCAT_PAD);
+
+        // do nothing if already linked
+        if (gst_pad_is_linked(converter_sink)) {
+            g_print("Audio pad is already linked\n");
+            goto exit;
+        }
+
+        // The playlist shares the chain between items that may come at other rates
+        int rate;
+        if (state->pinned_rate && !state->audio_concat && state->audio_resampler
+            && gst_structure_get_int(new_pad_caps_structure, "rate", &rate) && (guint)rate == state->pinned_rate) {
+            drop_resampler(state);
+        }
+
+        // link new_pad output to audio converter sink
+        GstPadLinkReturn ret = gst_pad_link(new_pad, converter_sink);
+        if (GST_PAD_LINK_FAILED(ret)) {
+            g_printerr("Could not link audio pad\n");
+        }
+    } else if ((!state->is_audio_only || state->is_video_deferred) && g_str_has_prefix(new_pad_type, "video/x-raw")) {
+        if (state->is_video_deferred && !build_deferred_video_branch(state)) {
+            goto exit;
+        }
+        converter_sink = get_branch_sink_pad(self, state->video_concat, state_video_head(state), STATE_VIDEO_CONCAT_PAD);
+
+        if (gst_pad_is_linked(converter_sink)) {
+            g_print("Video pad is already linked\n");
+            goto exit;
+        }
+
+        // link new_pad output to video converter sink
+        GstPadLinkReturn ret = gst_pad_link(new_pad, converter_sink);
+        if (GST_PAD_LINK_FAILED(ret)) {
+            g_printerr("Could not link video pad\n");
+        }
+    }
+
+exit:
+    if (converter_sink) {
+        gst_object_unref(converter_sink);
+    }
+    if (new_pad_caps) {
+        gst_caps_unref(new_pad_caps);
+    }
+}
+
+// A branch the source has no stream for never gets data. Its sink would never preroll and its
+// encoder would hold back the muxer, so the muxer stops waiting for it or the sink gets an EOS.
+static void end_unlinked_branch(State* state, GstElement* head, GstElement* tail, const char* name) {
+    GstPad* head_sink = gst_element_get_static_pad(head, "sink");
+    if (gst_pad_is_linked(head_sink)) {
+        gst_object_unref(head_sink);
+        return;
+    }
+    g_print("Source has no %s stream, ending the %s branch\n", name, name);
+
+    if (state->muxer) {
+        GstPad* tail_src = gst_element_get_static_pad(tail, "src");
+        GstPad* muxer_sink = gst_pad_get_peer(tail_src);
+        if (muxer_sink) {
+            gst_pad_unlink(tail_src, muxer_sink);
+            gst_element_release_request_pad(state->muxer, muxer_sink);
+            gst_object_unref(muxer_sink);
+        }
+        gst_object_unref(tail_src);
+    } else {
+        GstSegment segment;
+        gst_segment_init(&segment, GST_FORMAT_TIME);
+        gst_pad_send_event(head_sink, gst_event_new_stream_start(name));
+        gst_pad_send_event(head_sink, gst_event_new_segment(&segment));
+        gst_pad_send_event(head_sink, gst_event_new_eos());
+    }
+    gst_object_unref(head_sink);
+}
+
+static void no_more_pads_signal(GstElement* self, State* state) {
+    if (!state->is_video_only) {
+        end_unlinked_branch(state, state_audio_head(state), state->audio_sink, "audio");
+    }
+    if (!state->is_audio_only) {
+        end_unlinked_branch(state, state_video_head(state), state->video_sink, "video");
+    }
+}
+
+GstElement* state_audio_head(State* state) {
+    return state->audio_queue ? state->audio_queue : state->audio_converter;
+}
+
+GstElement* state_video_head(State* state) {
+    return state->video_queue ? state->video_queue : state->video_converter;
+}
+
+static void add_video_elements(State* state) {
+    gst_bin_add_many(GST_BIN(state->pipeline), state->video_converter, state->video_sink, NULL);
+    if (state->videobalance_filter) {
+        gst_bin_add(GST_BIN(state->pipeline), state->videobalance_filter);
+    }
+    if (state->video_size_filter) {
+        gst_bin_add_many(GST_BIN(state->pipeline), state->video_scale, state->video_size_filter, NULL);
+    }
+    if (state->video_queue) {
+        gst_bin_add(GST_BIN(state->pipeline), state->video_queue);
+    }
+}
 
 void state_add_elements(State* state, Settings* settings) {
-    gst_bin_add_many(GST_BIN(state->pipeline), state->source, state->audio_converter, state->audio_resampler, state->audio_sink, NULL);
-    if (settings->has_volume) {
-        gst_bin_add(GST_BIN(state->pipeline), state->volume);
+    gst_bin_add(GST_BIN(state->pipeline), state->source);
+    if (!state->is_video_only) {
+        gst_bin_add_many(GST_BIN(state->pipeline), state->audio_converter, state->audio_resampler, state->audio_sink, NULL);
     }
-    if (settings->has_panorama) {
-        gst_bin_add(GST_BIN(state->pipeline), state->panorama);
+    if (state->audio_format_filter) {
+        gst_bin_add(GST_BIN(state->pipeline), state->audio_format_filter);
     }
-    if (settings->has_echo) {
-        gst_bin_add(GST_BIN(state->pipeline), state->audio_echo);
+    if (state->audio_queue) {
+        gst_bin_add(GST_BIN(state->pipeline), state->audio_queue);
     }
-    if (settings->pass_type != PassNone) {
-        gst_bin_add(GST_BIN(state->pipeline), state->pass_filter);
+    if (state->pitch_queue) {
+        gst_bin_add(GST_BIN(state->pipeline), state->pitch_queue);
     }
-    if (settings->has_pitch) {
+    if (state->noise_queue) {
+        gst_bin_add(GST_BIN(state->pipeline), state->noise_queue);
+    }
+    if (state->fused_audio) {
+        gst_bin_add(GST_BIN(state->pipeline), state->fused_audio);
+        if (state->fused_audio_caps) {
+            gst_bin_add(GST_BIN(state->pipeline), state->fused_audio_caps);
+        }
+    } else {
+        if (state->volume) {
+            gst_bin_add(GST_BIN(state->pipeline), state->volume);
+        }
+        if (state->panorama) {
+            gst_bin_add(GST_BIN(state->pipeline), state->panorama);
+        }
+        if (state->audio_echo) {
+            gst_bin_add(GST_BIN(state->pipeline), state->audio_echo);
+        }
+        if (state->pass_filter) {
+            gst_bin_add(GST_BIN(state->pipeline), state->pass_filter);
+        }
+    }
+    if (state->analysis) {
+        gst_bin_add(GST_BIN(state->pipeline), state->analysis);
+    }
+    if (state->pitch) {
         gst_bin_add(GST_BIN(state->pipeline), state->pitch);
     }
-    if (settings->has_noise_reduction) {
+    if (state->noise_reduction) {
         gst_bin_add(GST_BIN(state->pipeline), state->noise_reduction);
     }
 
-    // video
-    if (settings->has_videobalance || settings->has_colorinvert) {
-        gst_bin_add(GST_BIN(state->pipeline), state->videobalance_filter);
-    }
     if (!state->is_audio_only) {
-        gst_bin_add_many(GST_BIN(state->pipeline), state->video_converter, state->video_sink, NULL);
+        add_video_elements(state);
+    }
+
+    if (settings->output_mode == OutputRender) {
+        gst_bin_add_many(GST_BIN(state->pipeline), state->muxer, state->file_sink, NULL);
+    }
+
+    if (state->audio_concat) {
+        gst_bin_add(GST_BIN(state->pipeline), state->audio_concat);
+    }
+    if (state->video_concat) {
+        gst_bin_add(GST_BIN(state->pipeline), state->video_concat);
     }
 }
 
-gboolean state_link_elements(State* state, Settings* settings) {
-    GPtrArray* audio_elements = g_ptr_array_new();
+// field of state, or candidate when it is the slot a chain is asked about
+static GstElement* chain_element(GstElement** field, GstElement** slot, GstElement* candidate) {
+    return field == slot ? candidate : *field;
+}
 
-    // First add must-have elements for audio
-    g_ptr_array_add(audio_elements, state->audio_converter);
-    g_ptr_array_add(audio_elements, state->audio_resampler);
+GPtrArray* state_video_chain(State* state, GstElement** slot, GstElement* candidate) {
+    GstElement* videobalance_filter = chain_element(&state->videobalance_filter, slot, candidate);
+    GPtrArray* video_elements = g_ptr_array_new();
+    if (state->video_queue) {
+        g_ptr_array_add(video_elements, state->video_queue);
+    }
+    // Downscaling goes first, so the converter only handles the smaller frames
+    if (state->video_size_filter) {
+        g_ptr_array_add(video_elements, state->video_scale);
+        g_ptr_array_add(video_elements, state->video_size_filter);
+    }
+    g_ptr_array_add(video_elements, state->video_converter);
 
-    if (settings->has_volume) {
-        g_ptr_array_add(audio_elements, state->volume);
+    if (videobalance_filter) {
+        g_ptr_array_add(video_elements, videobalance_filter);
     }
-    if (settings->has_panorama) {
-        g_ptr_array_add(audio_elements, state->panorama);
+
+    g_ptr_array_add(video_elements, state->video_sink);
+    return video_elements;
+}
+
+GPtrArray* state_audio_chain(State* state, GstElement** slot, GstElement* candidate) {
+    GstElement* audio_echo = chain_element(&state->audio_echo, slot, candidate);
+    GstElement* pass_filter = chain_element(&state->pass_filter, slot, candidate);
+    GstElement* noise_reduction = chain_element(&state->noise_reduction, slot, candidate);
+    GPtrArray* audio_elements = g_ptr_array_new();
+
+    // First add must-have elements for audio, the queue moves the branch off the decoder thread
+    if (state->audio_queue) {
+        g_ptr_array_add(audio_elements, state->audio_queue);
     }
-    if (settings->has_echo) {
-        g_ptr_array_add(audio_elements, state->audio_echo);
+    g_ptr_array_add(audio_elements, state->audio_converter);
+    if (state->audio_resampler) {
+        g_ptr_array_add(audio_elements, state->audio_resampler);
     }
-    if (settings->pass_type != PassNone) {
-        g_ptr_array_add(audio_elements, state->pass_filter);
+    if (state->audio_format_filter) {
+        g_ptr_array_add(audio_elements, state->audio_format_filter);
     }
-    if (settings->has_pitch) {
+
+    if (state->fused_audio) {
+        if (state->fused_audio_caps) {
+            g_ptr_array_add(audio_elements, state->fused_audio_caps);
+        }
+        g_ptr_array_add(audio_elements, state->fused_audio);
+    } else {
+        if (state->volume) {
+            g_ptr_array_add(audio_elements, state->volume);
+        }
+        if (state->panorama) {
+            g_ptr_array_add(audio_elements, state->panorama);
+        }
+        if (audio_echo) {
+            g_ptr_array_add(audio_elements, audio_echo);
+        }
+        if (pass_filter) {
+            g_ptr_array_add(audio_elements, pass_filter);
+        }
+    }
+    if (state->pitch) {
+        if (state->pitch_queue) {
+            g_ptr_array_add(audio_elements, state->pitch_queue);
+        }
         g_ptr_array_add(audio_elements, state->pitch);
     }
-    if (settings->has_noise_reduction) {
-        g_ptr_array_add(audio_elements, state->noise_reduction);
+    if (noise_reduction) {
+        if (state->noise_queue) {
+            g_ptr_array_add(audio_elements, state->noise_queue);
+        }
+        g_ptr_array_add(audio_elements, noise_reduction);
+    }
+
+    if (state->analysis) {
+        g_ptr_array_add(audio_elements, state->analysis);
     }
 
     g_ptr_array_add(audio_elements, state->audio_sink);
+    return audio_elements;
+}
 
-    for (int i = 0; i < audio_elements->len - 1; ++i) {
-        GstElement* src = g_ptr_array_index(audio_elements, i);
-        GstElement* dst = g_ptr_array_index(audio_elements, i + 1);
+static gboolean link_chain(GPtrArray* elements) {
+    for (int i = 0; i < elements->len - 1; ++i) {
+        GstElement* src = g_ptr_array_index(elements, i);
+        GstElement* dst = g_ptr_array_index(elements, i + 1);
 
         if (!gst_element_link_many(src, dst, NULL)) {
             g_printerr("Was unable to link %s and %s\n", gst_element_get_name(src), gst_element_get_name(dst));
-            g_object_unref(state->pipeline);
-            g_ptr_array_free(audio_elements, FALSE);
+            g_ptr_array_free(elements, TRUE);
             return FALSE;
         }
     }
+    g_ptr_array_free(elements, TRUE);
+    return TRUE;
+}
 
-    g_ptr_array_free(audio_elements, FALSE);
+static gboolean link_video_elements(State* state) {
+    return link_chain(state_video_chain(state, NULL, NULL));
+}
+
+gboolean state_link_elements(State* state, Settings* settings) {
+    if (!state->is_video_only && !link_chain(state_audio_chain(state, NULL, NULL))) {
+        return FALSE;
+    }
 
     // Video stuff
-    if (!state->is_audio_only) {
-        GPtrArray* video_elements = g_ptr_array_new();
-        g_ptr_array_add(video_elements, state->video_converter);
-        
-        if (settings->has_videobalance || settings->has_colorinvert) {
-            g_ptr_array_add(video_elements, state->videobalance_filter);
-        }
-
-        g_ptr_array_add(video_elements, state->video_sink);
-        for (int i = 0; i < video_elements->len - 1; ++i) {
-            GstElement* src = g_ptr_array_index(video_elements, i);
-            GstElement* dst = g_ptr_array_index(video_elements, i + 1);
-
-            if (!gst_element_link_many(src, dst, NULL)) {
-                g_printerr("Was unable to link %s and %s\n", gst_element_get_name(src), gst_element_get_name(dst));
-                g_object_unref(state->pipeline);
-                g_ptr_array_free(video_elements, FALSE);
-                return FALSE;
-            }
-        } 
-        g_ptr_array_free(video_elements, FALSE);
+    if (!state->is_audio_only && !link_video_elements(state)) {
+        return FALSE;
+    }
+
+    if (settings->output_mode == OutputRender && !link_render_tail(state)) {
+        return FALSE;
+    }
+
+    if (state->audio_concat && !gst_element_link(state->audio_concat, state_audio_head(state))) {
+        g_printerr("Was unable to link audio concat\n");
+        return FALSE;
+    }
+    if (state->video_concat && !gst_element_link(state->video_concat, state_video_head(state))) {
+        g_printerr("Was unable to link video concat\n");
+        return FALSE;
     }
 
     return TRUE;
 }
 
-gboolean state_create_all_elements(State* state, Settings* settings) {
+static gboolean create_video_elements(State* state, Settings* settings) {
+    state->video_converter = gst_element_factory_make("videoconvert", "video-converter");
+    state->video_sink = make_video_sink(settings);
+    decoder_setup_converter(state->video_converter, settings);
+
+    if (settings->has_videobalance || settings->has_colorinvert) {
+        state->videobalance_filter = gst_element_factory_make("videobalance", "video-balance");
+        if (!state->videobalance_filter) {
+            g_printerr("Could not create videobalance, skipping...\nn");
+        }
+    }
+
+    if (settings->has_qos_adapt) {
+        state->video_scale = gst_element_factory_make("videoscale", "video-scale");
+        state->video_size_filter = gst_element_factory_make("capsfilter", "video-size-filter");
+        if (!state->video_scale || !state->video_size_filter) {
+            g_printerr("Could not create videoscale, QoS will not downscale\n");
+            g_clear_object(&state->video_scale);
+            g_clear_object(&state->video_size_filter);
+        }
+        decoder_setup_converter(state->video_scale, settings);
+    }
+
+    if (!state->video_converter || !state->video_sink) {
+        g_printerr("Could not create all video elements\n");
+        return FALSE;
+    }
+
+    if (settings->has_branch_queues) {
+        state->video_queue = make_queue(settings, "video-queue");
+        if (!state->video_queue) {
+            return FALSE;
+        }
+    }
+    return TRUE;
+}
+
+typedef struct VideoCreateJob {
+    State* state;
+    Settings* settings;
+    gboolean is_ok;
+} VideoCreateJob;
+
+static gpointer create_video_thread(gpointer data) {
+    VideoCreateJob* job = data;
+    job->is_ok = create_video_elements(job->state, job->settings);
+    return NULL;
+}
+
+// Everything but the video branch
+static gboolean create_audio_elements(State* state, Settings* settings) {
     state->source = gst_element_factory_make("uridecodebin", "source");
+    if (!state->source) {
+        g_printerr("Could not create all elements\n");
+        return FALSE;
+    }
+
+    // Only affects network sources, where uridecodebin puts a queue2 behind the source
+    if (settings->source_buffer_size >= 0) {
+        g_object_set(state->source, "buffer-size", settings->source_buffer_size, NULL);
+    }
+    if (settings->source_buffer_duration >= 0) {
+        g_object_set(state->source, "buffer-duration", settings->source_buffer_duration, NULL);
+    }
+    decoder_setup_attach(state->source, settings);
+
+    if (settings->output_mode == OutputRender) {
+        state->muxer = gst_element_factory_make(settings->muxer ? settings->muxer : DEFAULT_MUXER, "muxer");
+        state->file_sink = gst_element_factory_make("filesink", "file-sink");
+        if (!state->muxer || !state->file_sink) {
+            g_printerr("Could not create render elements\n");
+            return FALSE;
+        }
+        // Nothing waits for the clock, so the chain runs as fast as the cpu allows
+        g_object_set(state->file_sink, "location", settings->output_path, "sync", FALSE, NULL);
+    }
+
+    // Media without an audio stream gets no audio branch at all, nothing would ever reach its sink
+    if (state->is_video_only) {
+        return TRUE;
+    }
+
     state->audio_converter = gst_element_factory_make("audioconvert", "audio-converter");
     state->audio_resampler = gst_element_factory_make("audioresample", "audio-resampler");
-    state->audio_sink = gst_element_factory_make("autoaudiosink", "audio-sink");
-
-    if (!state->source || !state->audio_converter || !state->audio_resampler || !state->audio_sink) {
+    state->audio_sink = make_audio_sink(settings);
+    if (!state->audio_converter || !state->audio_resampler || !state->audio_sink) {
         g_printerr("Could not create all elements\n");
         return FALSE;
     }
 
+    if (settings->pin_format) {
+        state->audio_format_filter = make_audio_format_filter(state, settings);
+        if (!state->audio_format_filter) {
+            return FALSE;
+        }
+    }
+
+    if (settings->has_branch_queues) {
+        state->audio_queue = make_queue(settings, "audio-queue");
+        if (!state->audio_queue) {
+            return FALSE;
+        }
+    }
+    // Heavy filters get their own streaming thread, so they don't stall the ones before them
+    if (settings->has_filter_queues && settings->has_pitch) {
+        state->pitch_queue = make_queue(settings, "pitch-queue");
+        if (!state->pitch_queue) {
+            return FALSE;
+        }
+    }
+    if (settings->has_filter_queues && settings->has_noise_reduction) {
+        state->noise_queue = make_queue(settings, "noise-reduction-queue");
+        if (!state->noise_queue) {
+            return FALSE;
+        }
+    }
+
+    // Playlist sources are joined in front of the branches, the chains behind them live for the whole playlist
+    if (settings->is_playlist) {
+        state->audio_concat = gst_element_factory_make("concat", "audio-concat");
+        if (!state->audio_concat) {
+            g_printerr("Could not create audio concat\n");
+            return FALSE;
+        }
+        if (!state->is_audio_only) {
+            state->video_concat = gst_element_factory_make("concat", "video-concat");
+            if (!state->video_concat) {
+                g_printerr("Could not create video concat\n");
+                return FALSE;
+            }
+        }
+    }
+
     // -------------------------------------------------------------
     // Adding new filter checklist:
     // - [ ] add new element to settings (has_<filter>, <filter>_<value>)
@@ -128,25 +653,45 @@ gboolean state_create_all_elements(State* state, Settings* settings) {
     // - [ ] g_object_set new element
     // -------------------------------------------------------------
 
-    if (settings->has_volume) {
+    if (use_fused_audio(settings)) {
+        fused_audio_register();
+        state->fused_audio = gst_element_factory_make(FUSED_AUDIO_FACTORY, "fused-audio-filter");
+        if (!state->fused_audio) {
+            g_printerr("Could not create fused audio filter\n");
+            return FALSE;
+        }
+        // audiopanorama makes stereo out of anything, the fused element works in place so it needs stereo in
+        if (settings->has_panorama) {
+            state->fused_audio_caps = gst_element_factory_make("capsfilter", "fused-audio-caps");
+            if (!state->fused_audio_caps) {
+                g_printerr("Could not create fused audio capsfilter\n");
+                return FALSE;
+            }
+            GstCaps* caps = gst_caps_from_string("audio/x-raw, channels=(int)2");
+            g_object_set(state->fused_audio_caps, "caps", caps, NULL);
+            gst_caps_unref(caps);
+        }
+    }
+
+    if (settings->has_volume && !state->fused_audio) {
         state->volume = gst_element_factory_make("volume", "volume-controller-filter");
         if (!state->volume) {
             g_printerr("Could not create volume filter, skipping..\n");
         }
     }
-    if (settings->has_panorama) {
+    if (settings->has_panorama && !state->fused_audio) {
         state->panorama = gst_element_factory_make("audiopanorama", "panorama-filter");
         if (!state->panorama) {
             g_printerr("Could not create panorama filter, skipping..\n");
         }
     }
-    if (settings->pass_type != PassNone) {
+    if (settings->pass_type != PassNone && !state->fused_audio) {
         state->pass_filter = gst_element_factory_make("audiocheblimit", "passfilter");
         if (!state->pass_filter) {
             g_printerr("Could not create pass filter, skipping...\n");
         }
     }
-    if (settings->has_echo) {
+    if (settings->has_echo && !state->fused_audio) {
         state->audio_echo = gst_element_factory_make("audioecho", "reverb-filter");
         if (!state->audio_echo) {
             g_printerr("Could not create echo filter, skipping...\n");
@@ -164,61 +709,503 @@ gboolean state_create_all_elements(State* state, Settings* settings) {
             g_printerr("Could not create noise reduction filter, skipping...\n");
         }
     }
-    
+    if (settings->has_analysis) {
+        audio_analysis_register();
+        state->analysis = gst_element_factory_make(ANALYSIS_FACTORY, "audio-analysis");
+        if (!state->analysis) {
+            g_printerr("Could not create audio analysis, skipping...\n");
+        }
+    }
 
-    // Video stuff
-    if (!state->is_audio_only) {
-        state->video_converter = gst_element_factory_make("videoconvert", "video-converter");
-        state->video_sink = gst_element_factory_make("autovideosink", "video-sink");
+    return TRUE;
+}
 
-        if (settings->has_videobalance || settings->has_colorinvert) {
-            state->videobalance_filter = gst_element_factory_make("videobalance", "video-balance");
-            if (!state->videobalance_filter) {
-                g_printerr("Could not create videobalance, skipping...\nn");
-            }
-        }
+gboolean state_create_all_elements(State* state, Settings* settings) {
+    if (state->is_audio_only) {
+        return create_audio_elements(state, settings);
+    }
+    if (!settings->is_fast_start) {
+        return create_audio_elements(state, settings) && create_video_elements(state, settings);
+    }
 
-        if (!state->video_converter || !state->video_sink) {
-            g_printerr("Could not create all video elements\n");
-            return FALSE;
-        }
+    // Creating the first element of a factory loads its plugin, which is most of the cost. The
+    // branches load different plugins (and the video sink may open a display), so they overlap.
+    VideoCreateJob job = {state, settings, FALSE};
+    GThread* thread = g_thread_new("create-video", create_video_thread, &job);
+    gboolean is_ok = create_audio_elements(state, settings);
+    g_thread_join(thread);
+    return is_ok && job.is_ok;
+}
+
+static void setup_video_values(State* state, Settings* settings) {
+    if (!state->videobalance_filter) {
+        return;
     }
+    if (settings->has_videobalance) {
+        g_object_set(state->videobalance_filter, "saturation", settings->video_saturation, NULL);
+    }
+    if (settings->has_colorinvert) {
+        double contrast;
+        double brightness;
 
-    return TRUE;
+        contrast = 0.1;
+        brightness = 0.1;
+
+        g_object_set(state->videobalance_filter, "contrast", contrast, "brightness", brightness, NULL);
+    }
 }
 
 void state_setup_filter_values_from_settings(State* state, Settings* settings) {
+    // The fused element uses the same property names, only the element differs
+    GstElement* volume = state->fused_audio ? state->fused_audio : state->volume;
+    GstElement* panorama = state->fused_audio ? state->fused_audio : state->panorama;
+    GstElement* pass_filter = state->fused_audio ? state->fused_audio : state->pass_filter;
+    GstElement* audio_echo = state->fused_audio ? state->fused_audio : state->audio_echo;
+
+    if (state->is_video_only) {
+        setup_video_values(state, settings);
+        return;
+    }
+
     if (settings->has_volume) {
-        g_object_set(state->volume, "volume", settings->volume, NULL);
+        g_object_set(volume, "volume", settings->volume, NULL);
     }
 
     if (settings->has_panorama) {
-        g_object_set(state->panorama, "panorama", settings->balance, NULL);
+        g_object_set(panorama, "panorama", settings->balance, NULL);
     }
 
     if (settings->pass_type != PassNone) {
-        g_object_set(state->pass_filter, "mode", settings->pass_type, "cutoff", settings->pass_cutoff, NULL);
+        g_object_set(pass_filter, "mode", settings->pass_type, "cutoff", settings->pass_cutoff, NULL);
     }
 
     if (settings->has_echo) {
-        g_object_set(state->audio_echo, "delay", settings->echo_delay, "feedback", settings->echo_feedback, "intensity", settings->echo_intensity, NULL);
+        if (state->fused_audio) {
+            g_object_set(audio_echo, "max-delay", settings->echo_delay, NULL);
+        }
+        g_object_set(audio_echo, "delay", settings->echo_delay, "feedback", settings->echo_feedback, "intensity", settings->echo_intensity, NULL);
     }
     if (settings->has_pitch) {
         g_object_set(state->pitch, "pitch", settings->pitch_pitch, NULL);
     }
-    if (settings->has_videobalance) {
-        g_object_set(state->videobalance_filter, "saturation", settings->video_saturation, NULL);
+    setup_video_values(state, settings);
+    if (settings->has_noise_reduction) {
+        g_object_set(state->noise_reduction, "voice-activity-threshold", settings->noise_reduction, NULL);
     }
-    if (settings->has_colorinvert) {
-        double contrast;
-        double brightness;
+    if (state->analysis) {
+        g_object_set(state->analysis, "fft-size", settings->analysis_fft_size, "interval", settings->analysis_interval,
+                     "bands", settings->analysis_bands, NULL);
+    }
+}
 
-        contrast = 0.1;
-        brightness = 0.1;
+// Filters whose parameters make them a no-op are not built at all. The control socket can set
+// them to something else later, so with --control every filter is kept.
+static void elide_identity_filters(Settings* settings) {
+    if (settings->control_path) {
+        return;
+    }
+    if (settings->has_volume && settings->volume == 1.0) {
+        g_print("Elided volume: volume is 1.0\n");
+        settings->has_volume = FALSE;
+    }
+    if (settings->has_panorama && settings->balance == 0.0f) {
+        g_print("Elided audiopanorama: balance is 0.0\n");
+        settings->has_panorama = FALSE;
+    }
+    if (settings->pass_type == PassHigh && settings->pass_cutoff <= 0.0f) {
+        g_print("Elided audiocheblimit: high-pass cutoff is 0 Hz\n");
+        settings->pass_type = PassNone;
+    }
+    if (settings->has_echo && settings->echo_intensity == 0.0f) {
+        g_print("Elided audioecho: intensity is 0.0\n");
+        settings->has_echo = FALSE;
+    }
+    if (settings->has_pitch && settings->pitch_pitch == 1.0f) {
+        g_print("Elided pitch: pitch is 1.0\n");
+        settings->has_pitch = FALSE;
+    }
+    if (settings->has_videobalance && !settings->has_colorinvert && settings->video_saturation == 1.0) {
+        g_print("Elided videobalance: saturation is 1.0\n");
+        settings->has_videobalance = FALSE;
+    }
+}
 
-        g_object_set(state->videobalance_filter, "contrast", contrast, "brightness", brightness, NULL);
-    }  
-    if (settings->has_noise_reduction) {
-        g_object_set(state->noise_reduction, "voice-activity-threshold", settings->noise_reduction, NULL);
+static void report_converter(GstElement* converter) {
+    if (!converter) {
+        return;
+    }
+
+    GstPad* sink = gst_element_get_static_pad(converter, "sink");
+    GstPad* src = gst_element_get_static_pad(converter, "src");
+    GstCaps* sink_caps = gst_pad_get_current_caps(sink);
+    GstCaps* src_caps = gst_pad_get_current_caps(src);
+
+    if (sink_caps && src_caps && gst_caps_is_equal(sink_caps, src_caps)) {
+        gchar* caps_str = gst_caps_to_string(sink_caps);
+        g_print("Passthrough %s: same caps on both sides, %s\n", GST_OBJECT_NAME(converter), caps_str);
+        g_free(caps_str);
+    }
+
+    if (sink_caps) {
+        gst_caps_unref(sink_caps);
+    }
+    if (src_caps) {
+        gst_caps_unref(src_caps);
+    }
+    gst_object_unref(sink);
+    gst_object_unref(src);
+}
+
+void state_report_passthrough_converters(State* state) {
+    if (state->is_passthrough_reported) {
+        return;
+    }
+    state->is_passthrough_reported = TRUE;
+
+    report_converter(state->audio_converter);
+    report_converter(state->audio_resampler);
+    report_converter(state->video_converter);
+}
+
+void state_report_audio_links(State* state) {
+    if (!state->audio_format_filter || state->is_links_reported) {
+        return;
+    }
+    state->is_links_reported = TRUE;
+
+    g_print("Audio links:\n");
+    GstCaps* pinned_caps = NULL;
+    GstElement* element = gst_object_ref(state_audio_head(state));
+    while (element && element != state->audio_sink) {
+        GstPad* src = gst_element_get_static_pad(element, "src");
+        GstPad* peer = src ? gst_pad_get_peer(src) : NULL;
+        GstElement* next = peer ? gst_pad_get_parent_element(peer) : NULL;
+
+        if (next) {
+            GstCaps* caps = gst_pad_get_current_caps(src);
+            gchar* caps_str = caps ? gst_caps_to_string(caps) : g_strdup("not negotiated");
+            // Everything after the format filter has to keep the caps it let through
+            gboolean is_converted = pinned_caps && (!caps || !gst_caps_is_equal(caps, pinned_caps));
+            g_print("  %s -> %s: %s%s\n", GST_OBJECT_NAME(element), GST_OBJECT_NAME(next), caps_str,
+                    is_converted ? " (CONVERTED after the format filter)" : "");
+            g_free(caps_str);
+
+            if (element == state->audio_format_filter && caps) {
+                pinned_caps = gst_caps_ref(caps);
+            }
+            if (caps) {
+                gst_caps_unref(caps);
+            }
+        }
+
+        if (peer) {
+            gst_object_unref(peer);
+        }
+        if (src) {
+            gst_object_unref(src);
+        }
+        gst_object_unref(element);
+        element = next;
+    }
+
+    if (element) {
+        gst_object_unref(element);
+    }
+    if (pinned_caps) {
+        gst_caps_unref(pinned_caps);
+    }
+}
+
+// The media turned out to have video, the branch joins the pipeline while it prerolls
+static gboolean build_deferred_video_branch(State* state) {
+    Settings* settings = state->deferred_settings;
+    state->is_video_deferred = FALSE;
+
+    if (!create_video_elements(state, settings)) {
+        g_printerr("Could not build the video branch, playing audio only\n");
+        return FALSE;
+    }
+    setup_video_values(state, settings);
+    add_video_elements(state);
+    if (!link_video_elements(state)) {
+        return FALSE;
+    }
+
+    // Sink first, so no element pushes into one that is still in NULL
+    gst_element_sync_state_with_parent(state->video_sink);
+    if (state->videobalance_filter) {
+        gst_element_sync_state_with_parent(state->videobalance_filter);
+    }
+    gst_element_sync_state_with_parent(state->video_converter);
+    if (state->video_size_filter) {
+        gst_element_sync_state_with_parent(state->video_size_filter);
+        gst_element_sync_state_with_parent(state->video_scale);
+    }
+    if (state->video_queue) {
+        gst_element_sync_state_with_parent(state->video_queue);
+    }
+
+    if (settings->has_video_pool) {
+        alloc_provide_video_pool(state->video_sink);
+    }
+    startup_watch_sink(state->startup, state->video_sink, "first video frame");
+    state->is_audio_only = FALSE;
+    g_print("Built the video branch for the video stream of the source\n");
+    return TRUE;
+}
+
+// Only remote media is deferred: local files are typed well by their extension, and building the
+// branch up front overlaps with the audio branch, while a deferred one delays the first frame.
+// Render mode needs the muxer pads before data flows, a playlist needs the video concat.
+static gboolean should_defer_video(State* state, Settings* settings) {
+    return settings->is_fast_start && !state->is_audio_only && !settings->is_media_forced && !state->is_media_probed
+        && !settings->is_playlist && settings->output_mode != OutputRender
+        && settings->filepath && strstr(settings->filepath, "://");
+}
+
+// The probe is a second connection or file open and takes up to probe_timeout, so by default it
+// is only skipped for a local file with an audio extension. A url or a video container may hold
+// anything. Remote media with --fast-start is never probed, the deferred video branch finds out
+// from uridecodebin instead.
+static gboolean should_probe(Settings* settings, const char* uri) {
+    if (settings->probe_mode == ProbeNever || settings->is_media_forced) {
+        return FALSE;
+    }
+    gboolean is_remote = strstr(uri, "://") && !g_str_has_prefix(uri, "file://");
+    if (settings->is_fast_start && is_remote) {
+        return FALSE;
+    }
+    return settings->probe_mode == ProbeAlways || is_remote || !settings->is_audio_only
+        || !settings_has_media_extension(uri);
+}
+
+// Elements created but never added to the pipeline are still floating, nothing else frees them
+void state_release_unadded_elements(State* state) {
+    GstElement** elements[] = {
+        &state->source, &state->audio_converter, &state->video_converter, &state->audio_resampler,
+        &state->audio_format_filter, &state->audio_sink, &state->video_sink, &state->audio_queue,
+        &state->video_queue, &state->pitch_queue, &state->noise_queue, &state->audio_concat,
+        &state->video_concat, &state->muxer, &state->file_sink, &state->volume, &state->panorama,
+        &state->pass_filter, &state->audio_echo, &state->pitch, &state->noise_reduction,
+        &state->fused_audio, &state->fused_audio_caps, &state->analysis, &state->videobalance_filter,
+        &state->video_scale, &state->video_size_filter,
+    };
+    for (int i = 0; i < ARRAY_SIZE(elements); ++i) {
+        GstElement* element = *elements[i];
+        if (element && !GST_OBJECT_PARENT(element)) {
+            gst_object_ref_sink(element);
+            gst_object_unref(element);
+            *elements[i] = NULL;
+        }
+    }
+}
+
+gboolean state_build_pipeline(State* state, Settings* settings, const char* uri) {
+    // Elision changes the copy, the caller's settings may be shared by batch jobs
+    state->built_settings = *settings;
+    settings = &state->built_settings;
+    state->is_audio_only = settings->is_audio_only;
+    state->seek_mode = settings->seek_mode;
+
+    // Remote media that is completely cached is played from disk
+    gchar* source_uri = cache_resolve_uri(state->cache, uri);
+
+    // Without a known extension the content decides which branches get built
+    if (should_probe(settings, source_uri)) {
+        guint media = probe_media(source_uri, settings->probe_timeout);
+        if (media) {
+            state->is_audio_only = !(media & MEDIA_VIDEO);
+            // A playlist item further on may still have audio
+            state->is_video_only = !(media & MEDIA_AUDIO) && !settings->is_playlist;
+            state->is_media_probed = TRUE;
+        }
+        startup_mark(state->startup, "media probed");
+    }
+
+    if (should_defer_video(state, settings)) {
+        state->is_video_deferred = TRUE;
+        state->deferred_settings = settings;
+        state->is_audio_only = TRUE;
+    }
+
+    if (settings->is_elision_enabled) {
+        elide_identity_filters(settings);
+    }
+
+    if (!state_create_all_elements(state, settings)) {
+        state_release_unadded_elements(state);
+        g_free(source_uri);
+        return FALSE;
+    }
+    startup_mark(state->startup, "elements created");
+
+    state->pipeline = gst_pipeline_new("tiktok-pipeline");
+    if (!state->pipeline) {
+        g_printerr("Could not create a pipeline\n");
+        state_release_unadded_elements(state);
+        g_free(source_uri);
+        return FALSE;
+    }
+
+    cache_watch_bus(state->cache, state->pipeline);
+    latency_configure_pipeline(state->pipeline, settings);
+
+    // Set uri property to uridecodebin which is reponsible for downloading/loading media
+    g_object_set(state->source, "uri", source_uri, NULL);
+    g_free(source_uri);
+
+    // Setup filters
+    state_setup_filter_values_from_settings(state, settings);
+
+    // Add elements to pipeline and link
+    state_add_elements(state, settings);
+    startup_mark(state->startup, "elements added");
+    if (!state_link_elements(state, settings)) {
+        // The added ones go with the pipeline the caller unrefs
+        state_release_unadded_elements(state);
+        return FALSE;
+    }
+    startup_mark(state->startup, "elements linked");
+
+    if (settings->has_video_pool && !state->is_audio_only) {
+        alloc_provide_video_pool(state->video_sink);
+    }
+
+    state_connect_source(state, state->source);
+    return TRUE;
+}
+
+// Return values of autoplug-select, the playback plugin that defines them has no public header
+typedef enum AutoplugSelectResult {
+    AutoplugTry,
+    AutoplugExpose,
+    AutoplugSkip
+} AutoplugSelectResult;
+
+// Demuxers are kept, they carry the wanted stream too. user_data is the klass words to skip.
+static AutoplugSelectResult autoplug_select_signal(GstElement* bin, GstPad* pad, GstCaps* caps, GstElementFactory* factory, gpointer user_data) {
+    const gchar* klass = gst_element_factory_get_metadata(factory, GST_ELEMENT_METADATA_KLASS);
+    if (!klass || strstr(klass, "Demux")) {
+        return AutoplugTry;
+    }
+    for (const char* const* skipped = user_data; *skipped; ++skipped) {
+        if (strstr(klass, *skipped)) {
+            return AutoplugSkip;
+        }
+    }
+    return AutoplugTry;
+}
+
+static void restrict_source(GstElement* uridecodebin, const char* media_type, const char* const* skipped) {
+    GstCaps* caps = gst_caps_new_empty_simple(media_type);
+    g_object_set(uridecodebin, "caps", caps, "expose-all-streams", FALSE, NULL);
+    gst_caps_unref(caps);
+    g_signal_connect(uridecodebin, "autoplug-select", G_CALLBACK(autoplug_select_signal), (gpointer)skipped);
+}
+
+void state_restrict_to_audio(GstElement* uridecodebin) {
+    static const char* const skipped[] = {"Video", "Image", "Subtitle", NULL};
+    restrict_source(uridecodebin, "audio/x-raw", skipped);
+}
+
+void state_restrict_to_video(GstElement* uridecodebin) {
+    static const char* const skipped[] = {"Audio", "Subtitle", NULL};
+    restrict_source(uridecodebin, "video/x-raw", skipped);
+}
+
+typedef struct AudioDecode {
+    GstPadProbeCallback probe;
+    gpointer user_data;
+    gint is_linked; // only the first audio stream is decoded for the probe, atomic
+} AudioDecode;
+
+static GstElement* add_decode_sink(GstElement* pipeline) {
+    GstElement* sink = gst_element_factory_make("fakesink", NULL);
+    // No clock, the pipeline runs as fast as it decodes
+    g_object_set(sink, "sync", FALSE, NULL);
+    gst_bin_add(GST_BIN(pipeline), sink);
+    gst_element_sync_state_with_parent(sink);
+    return sink;
+}
+
+// Demuxers expose their pads from their own streaming threads, so two audio pads can arrive at
+// the same time and only one of them may claim the probe
+static void decode_pad_added_signal(GstElement* source, GstPad* pad, AudioDecode* decode) {
+    GstElement* pipeline = GST_ELEMENT(gst_element_get_parent(source));
+    GstElement* head;
+    if (!g_atomic_int_compare_and_exchange(&decode->is_linked, FALSE, TRUE)) {
+        // Further audio streams are discarded, an unlinked pad would stop the demuxer
+        head = add_decode_sink(pipeline);
+    } else {
+        head = gst_element_factory_make("audioconvert", NULL);
+        GstElement* format_filter = gst_element_factory_make("capsfilter", NULL);
+        GstCaps* caps = gst_caps_new_simple("audio/x-raw", "format", G_TYPE_STRING, GST_AUDIO_NE(F32),
+                                            "layout", G_TYPE_STRING, "interleaved", NULL);
+        g_object_set(format_filter, "caps", caps, NULL);
+        gst_caps_unref(caps);
+        gst_bin_add_many(GST_BIN(pipeline), head, format_filter, NULL);
+        GstElement* sink = add_decode_sink(pipeline);
+        gst_element_link_many(head, format_filter, sink, NULL);
+        gst_element_sync_state_with_parent(format_filter);
+        gst_element_sync_state_with_parent(head);
+
+        GstPad* sink_pad = gst_element_get_static_pad(sink, "sink");
+        gst_pad_add_probe(sink_pad, GST_PAD_PROBE_TYPE_BUFFER, decode->probe, decode->user_data, NULL);
+        gst_object_unref(sink_pad);
+    }
+
+    GstPad* head_pad = gst_element_get_static_pad(head, "sink");
+    gst_pad_link(pad, head_pad);
+    gst_object_unref(head_pad);
+    gst_object_unref(pipeline);
+}
+
+gboolean state_decode_audio(const char* uri, const char* pipeline_name, GstPadProbeCallback probe, gpointer user_data) {
+    AudioDecode decode = {probe, user_data, FALSE};
+    GstElement* pipeline = gst_pipeline_new(pipeline_name);
+    GstElement* source = gst_element_factory_make("uridecodebin", NULL);
+    if (!source) {
+        g_printerr("Could not create the source of %s\n", pipeline_name);
+        gst_object_unref(pipeline);
+        return FALSE;
+    }
+    g_object_set(source, "uri", uri, NULL);
+    state_restrict_to_audio(source);
+    gst_bin_add(GST_BIN(pipeline), source);
+    g_signal_connect(source, "pad-added", G_CALLBACK(decode_pad_added_signal), &decode);
+
+    GstBus* bus = gst_element_get_bus(pipeline);
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    GstMessage* message = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, GST_MESSAGE_ERROR | GST_MESSAGE_EOS);
+    gboolean is_ok = GST_MESSAGE_TYPE(message) == GST_MESSAGE_EOS;
+    gst_message_unref(message);
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    gst_object_unref(bus);
+    gst_object_unref(pipeline);
+    return is_ok;
+}
+
+void state_connect_source(State* state, GstElement* source) {
+    // Later sources (playlist items) get the same network buffering as the first one
+    if (source != state->source) {
+        gint buffer_size;
+        gint64 buffer_duration;
+        g_object_get(state->source, "buffer-size", &buffer_size, "buffer-duration", &buffer_duration, NULL);
+        g_object_set(source, "buffer-size", buffer_size, "buffer-duration", buffer_duration, NULL);
+        decoder_setup_attach_like(source, state->source);
+    }
+    cache_attach_source(state->cache, source);
+
+    if (state->is_audio_only && !state->is_video_deferred) {
+        state_restrict_to_audio(source);
+    } else if (state->is_video_only) {
+        state_restrict_to_video(source);
+    }
+
+    // link source to pad added handler
+    g_signal_connect(source, "pad-added", G_CALLBACK(pad_added_signal), state);
+    // With a playlist the concats decide when a branch ends, a later item may still have the stream
+    if (!state->audio_concat) {
+        g_signal_connect(source, "no-more-pads", G_CALLBACK(no_more_pads_signal), state);
     }
 }
@@ -5,6 +5,18 @@
 #include "gst/gstelement.h"
 #include "settings.h"
 
+// Object data keys on a playlist source holding its concat sink pads
+#define STATE_AUDIO_CONCAT_PAD "audio-concat-pad"
+#define STATE_VIDEO_CONCAT_PAD "video-concat-pad"
+
+struct Playlist;
+struct Cache;
+struct SeekIndex;
+struct RateControl;
+struct StartupProfile;
+struct QosMonitor;
+struct Metrics;
+
 typedef struct State {
     GstElement* pipeline;
     GstElement* source;
@@ -13,10 +25,36 @@ typedef struct State {
 
     GstElement* video_converter;
     
-    GstElement* audio_resampler;
+    GstElement* audio_resampler; // null once dropped because the source already has the pinned rate
+
+    GstElement* audio_format_filter; // pins the chain format after the resampler, null when not pinned
+    guint pinned_rate; // rate in audio_format_filter, 0 when the rate is not pinned
+
+    GstElement* audio_sink; // encoder bin in render mode
+    GstElement* video_sink; // encoder bin in render mode
+
+    // Thread boundaries, null when disabled
+    GstElement* audio_queue; // head of the audio branch
+    GstElement* video_queue; // head of the video branch
+    GstElement* pitch_queue; // in front of pitch
+    GstElement* noise_queue; // in front of noise reduction
 
-    GstElement* audio_sink;
-    GstElement* video_sink;
+    // Playlist only, every source gets a sink pad on these
+    GstElement* audio_concat;
+    GstElement* video_concat;
+    struct Playlist* playlist;
+
+    struct Cache* cache; // on-disk http cache, not owned, null when disabled
+    struct SeekIndex* seek_index; // keyframe index, not owned, null when disabled
+    SeekMode seek_mode; // for seeks that don't name a mode
+    struct RateControl* rate_control; // playback rate changes, not owned
+    struct StartupProfile* startup; // startup phase times, not owned, null when not profiled
+    struct QosMonitor* qos; // late and dropped frames, not owned
+    struct Metrics* metrics; // Prometheus export, not owned, null when disabled
+
+    // render mode only
+    GstElement* muxer;
+    GstElement* file_sink;
 
     // Filters, effects
     GstElement* volume;
@@ -25,23 +63,67 @@ typedef struct State {
     GstElement* audio_echo; // for echo | reverb
     GstElement* pitch; // for audio speed (aspeed) && pitch
     GstElement* noise_reduction;
+    GstElement* fused_audio; // replaces volume, panorama, pass_filter and audio_echo when set
+    GstElement* fused_audio_caps; // forces stereo into fused_audio when balance is used
+    GstElement* analysis; // level and spectrum tap in front of the audio sink
 
-    gboolean is_rate_set; // for speed filter, FALSE by default
 
     // video
     GstElement* videobalance_filter;
+    // Downscaling under load, both null unless QoS adaptation is on
+    GstElement* video_scale;
+    GstElement* video_size_filter; // ANY caps until QoS asks for a smaller size
     //
 
     gboolean is_audio_only;
+    gboolean is_media_probed; // is_audio_only comes from the content, not the extension
+    gboolean is_video_only; // probed media has no audio stream, the audio branch is not built
+    // Video branch is built once the source shows a video pad, is_audio_only stays TRUE until then
+    gboolean is_video_deferred;
+    Settings* deferred_settings; // for building the deferred branch, has to outlive the pipeline
+    Settings built_settings; // shallow copy of the caller's settings with identity filters left out, not owned
     gboolean is_playing; // set in MESSAGE_STATE_CHANGED
+    gboolean is_links_reported; // audio link caps were printed, only with a pinned format
+    gboolean is_passthrough_reported; // converters were checked once caps got negotiated
+    gboolean is_latency_reported; // negotiated latency was printed, only with --low-latency
     gboolean is_running;
 } State;
 
 
 gboolean state_link_elements(State* state, Settings* settings);
+// Elements of each branch that are in the pipeline, in link order from the head to the sink.
+// Free with g_ptr_array_free(chain, TRUE), the elements are not referenced. slot, when not null,
+// is one of the filter fields of state, and the chain has candidate in its place instead.
+GPtrArray* state_audio_chain(State* state, GstElement** slot, GstElement* candidate);
+GPtrArray* state_video_chain(State* state, GstElement** slot, GstElement* candidate);
+// First element of each branch, decoded pads are linked to it
+GstElement* state_audio_head(State* state);
+GstElement* state_video_head(State* state);
 void state_add_elements(State* state, Settings* Settings);
 
 gboolean state_create_all_elements(State* state, Settings* settings);
+// Unrefs the elements of state that were created but never added to a bin, and clears their fields
+void state_release_unadded_elements(State* state);
 void state_setup_filter_values_from_settings(State* state, Settings* settings);
 
+// Creates the pipeline for uri and runs all of the above, on failure state->pipeline (if set) is owned by the caller
+gboolean state_build_pipeline(State* state, Settings* settings, const char* uri);
+// Converters never copy when their input and output caps match, this logs which ones ended up
+// that way, call once the pipeline is PLAYING
+void state_report_passthrough_converters(State* state);
+
+// Prints the caps of every link of the audio branch and flags links after the format filter
+// whose caps differ from the pinned ones
+void state_report_audio_links(State* state);
+// Video and subtitle streams of uridecodebin are neither parsed nor decoded, and only raw audio
+// pads get exposed. Used without a video branch and by the audio-only side pipelines.
+void state_restrict_to_audio(GstElement* uridecodebin);
+// The same for video only, audio streams are neither parsed nor decoded
+void state_restrict_to_video(GstElement* uridecodebin);
+// Side pipeline that decodes the first audio stream of uri as interleaved native float as fast as
+// it can, probe sees every buffer of it. Blocks until the end, FALSE on an error.
+gboolean state_decode_audio(const char* uri, const char* pipeline_name, GstPadProbeCallback probe, gpointer user_data);
+// Links the decoded pads of a uridecodebin into the branches once they appear
+void state_connect_source(State* state, GstElement* source);
+
 #endif
\ No newline at end of file
@@ -0,0 +1,189 @@
+#include "tracer.h"
+#include "glib.h"
+#include "gst/gstpad.h"
+#include <gst/gst.h>
+#include <gst/gsttracer.h>
+#include <stdio.h>
+#ifdef __linux__
+#include <sys/prctl.h>
+#endif
+
+#define TRACER_RING_SIZE (1 << 16) // events per thread, oldest ones are overwritten
+
+typedef enum TracePhase {
+    TraceBegin,
+    TraceEnd
+} TracePhase;
+
+typedef struct TraceEvent {
+    GstClockTime ts;
+    const char* name; // owned by tracked
+    TracePhase phase;
+} TraceEvent;
+
+// Written only by its own streaming thread, read after streaming stopped, so no locking is needed
+typedef struct TraceRing {
+    guint tid;
+    char thread_name[17];
+    guint64 head; // events written so far
+    TraceEvent events[TRACER_RING_SIZE];
+} TraceRing;
+
+typedef struct PlayerTracer {
+    GstTracer parent;
+} PlayerTracer;
+
+typedef struct PlayerTracerClass {
+    GstTracerClass parent_class;
+} PlayerTracerClass;
+
+G_DEFINE_TYPE(PlayerTracer, player_tracer, GST_TYPE_TRACER)
+
+static GstTracer* tracer = NULL;
+static GHashTable* tracked = NULL; // GstElement* -> name, filled before streaming starts
+static GPrivate thread_ring = G_PRIVATE_INIT(NULL);
+static GMutex rings_lock; // only taken once per thread, when its ring is created
+static GPtrArray* rings = NULL;
+
+static void player_tracer_class_init(PlayerTracerClass* klass) {
+}
+
+static void player_tracer_init(PlayerTracer* self) {
+}
+
+static TraceRing* get_thread_ring(void) {
+    TraceRing* ring = g_private_get(&thread_ring);
+    if (G_LIKELY(ring)) {
+        return ring;
+    }
+
+    ring = g_new0(TraceRing, 1);
+#ifdef __linux__
+    prctl(PR_GET_NAME, ring->thread_name, 0, 0, 0); // GstTask names its threads after the pad
+#endif
+    g_mutex_lock(&rings_lock);
+    ring->tid = rings->len + 1;
+    g_ptr_array_add(rings, ring);
+    g_mutex_unlock(&rings_lock);
+
+    g_private_set(&thread_ring, ring);
+    return ring;
+}
+
+// The element a push on pad goes into, ghost pads belong to the bin we tracked
+static const char* receiving_element_name(GstPad* pad) {
+    GstPad* peer = GST_PAD_PEER(pad);
+    if (!peer) {
+        return NULL;
+    }
+    GstObject* parent = GST_OBJECT_PARENT(peer);
+    if (!parent || !GST_IS_ELEMENT(parent)) {
+        return NULL;
+    }
+    return g_hash_table_lookup(tracked, parent);
+}
+
+static inline void record(GstClockTime ts, GstPad* pad, TracePhase phase) {
+    const char* name = receiving_element_name(pad);
+    if (!name) {
+        return;
+    }
+
+    TraceRing* ring = get_thread_ring();
+    TraceEvent* event = &ring->events[ring->head & (TRACER_RING_SIZE - 1)];
+    event->ts = ts;
+    event->name = name;
+    event->phase = phase;
+    ring->head++;
+}
+
+static void on_pad_push_pre(GObject* self, GstClockTime ts, GstPad* pad, GstBuffer* buffer) {
+    record(ts, pad, TraceBegin);
+}
+
+static void on_pad_push_list_pre(GObject* self, GstClockTime ts, GstPad* pad, GstBufferList* list) {
+    record(ts, pad, TraceBegin);
+}
+
+static void on_pad_push_post(GObject* self, GstClockTime ts, GstPad* pad, GstFlowReturn res) {
+    record(ts, pad, TraceEnd);
+}
+
+gboolean tracer_enable(void) {
+    if (tracer) {
+        return TRUE;
+    }
+
+    tracked = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, g_free);
+    rings = g_ptr_array_new_with_free_func(g_free);
+
+    // Until a hook is registered GStreamer only checks a single flag per push, so a disabled tracer costs nothing
+    tracer = g_object_new(player_tracer_get_type(), NULL);
+    gst_object_ref_sink(tracer);
+    gst_tracing_register_hook(tracer, "pad-push-pre", G_CALLBACK(on_pad_push_pre));
+    gst_tracing_register_hook(tracer, "pad-push-list-pre", G_CALLBACK(on_pad_push_list_pre));
+    gst_tracing_register_hook(tracer, "pad-push-post", G_CALLBACK(on_pad_push_post));
+    gst_tracing_register_hook(tracer, "pad-push-list-post", G_CALLBACK(on_pad_push_post));
+    return TRUE;
+}
+
+void tracer_track_element(GstElement* element) {
+    if (!tracer) {
+        return;
+    }
+    g_hash_table_insert(tracked, element, g_strdup(GST_OBJECT_NAME(element)));
+}
+
+static void track_child(const GValue* value, gpointer user_data) {
+    tracer_track_element(GST_ELEMENT(g_value_get_object(value)));
+}
+
+void tracer_track_bin(GstBin* bin) {
+    GstIterator* it = gst_bin_iterate_elements(bin);
+    gst_iterator_foreach(it, track_child, NULL);
+    gst_iterator_free(it);
+}
+
+static void dump_ring(FILE* f, TraceRing* ring, gboolean* is_first) {
+    fprintf(f, "%s\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"%s\"}}",
+            *is_first ? "" : ",", ring->tid, ring->thread_name);
+    *is_first = FALSE;
+
+    guint64 start = ring->head > TRACER_RING_SIZE ? ring->head - TRACER_RING_SIZE : 0;
+    int depth = 0;
+    for (guint64 i = start; i < ring->head; ++i) {
+        TraceEvent* event = &ring->events[i & (TRACER_RING_SIZE - 1)];
+        // Begin events of a wrapped ring may be gone, their ends would close unrelated spans
+        if (event->phase == TraceEnd && depth == 0) {
+            continue;
+        }
+        depth += event->phase == TraceBegin ? 1 : -1;
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"buffer\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%u}",
+                event->name, event->phase == TraceBegin ? 'B' : 'E', event->ts / 1000.0, ring->tid);
+    }
+}
+
+gboolean tracer_dump(const char* path) {
+    if (!tracer) {
+        return FALSE;
+    }
+
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        g_printerr("Could not open trace file %s\n", path);
+        return FALSE;
+    }
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+    gboolean is_first = TRUE;
+    g_mutex_lock(&rings_lock);
+    for (guint i = 0; i < rings->len; ++i) {
+        dump_ring(f, g_ptr_array_index(rings, i), &is_first);
+    }
+    g_mutex_unlock(&rings_lock);
+    fprintf(f, "\n]}\n");
+    fclose(f);
+
+    g_print("Trace written to %s\n", path);
+    return TRUE;
+}
@@ -0,0 +1,20 @@
+#ifndef __TRACER_H
+#define __TRACER_H
+
+#include "gst/gstbin.h"
+#include "gst/gstelement.h"
+
+// In-tree buffer tracer: every buffer pushed into a tracked element is recorded as a begin/end
+// pair (time spent in the element and everything it pushes downstream in the same thread) into a
+// per-thread ring buffer. Nothing is hooked into GStreamer until tracer_enable is called.
+
+gboolean tracer_enable(void);
+
+// Must be called before the pipeline starts streaming
+void tracer_track_element(GstElement* element);
+void tracer_track_bin(GstBin* bin); // every direct child of bin
+
+// Writes Chrome trace JSON (chrome://tracing, Perfetto), streaming threads must be stopped
+gboolean tracer_dump(const char* path);
+
+#endif
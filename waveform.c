@@ -0,0 +1,241 @@
+#include "waveform.h"
+#include "state.h"
+#include <gst/gst.h>
+#include <gst/audio/audio.h>
+#include <glib/gstdio.h>
+#include <string.h>
+
+#define WAVEFORM_MAGIC "WPKS"
+#define WAVEFORM_VERSION 1
+
+typedef struct WaveformHeader {
+    char magic[4];
+    guint32 version;
+    guint32 rate;
+    guint32 level_count;
+    guint64 source_size;
+    gint64 source_mtime;
+} WaveformHeader;
+
+typedef struct WaveformLevel {
+    guint32 samples_per_bin;
+    guint32 bin_count;
+    guint64 offset;
+} WaveformLevel;
+
+struct WaveformPeaks {
+    GMappedFile* file;
+    const WaveformHeader* header;
+    const WaveformLevel* levels;
+};
+
+typedef struct WaveformBuilder {
+    int rate;
+    int channels;
+    float bin_min;
+    float bin_max;
+    guint32 bin_fill;
+    GArray* bins; // of gint16 {min, max}, level 0
+    guint64 frames;
+} WaveformBuilder;
+
+// ---------------------------------------------------------------------------
+// Building
+// ---------------------------------------------------------------------------
+
+static gint16 to_sample(float value) {
+    return (gint16)CLAMP(value * 32767.0f, -32768.0f, 32767.0f);
+}
+
+static void end_bin(WaveformBuilder* builder) {
+    gint16 bin[2] = {to_sample(builder->bin_min), to_sample(builder->bin_max)};
+    g_array_append_vals(builder->bins, bin, 2);
+    builder->bin_min = G_MAXFLOAT;
+    builder->bin_max = -G_MAXFLOAT;
+    builder->bin_fill = 0;
+}
+
+// Streaming thread of the sink, the only one touching the builder
+static GstPadProbeReturn samples_probe(GstPad* pad, GstPadProbeInfo* info, WaveformBuilder* builder) {
+    if (!builder->rate) {
+        GstCaps* caps = gst_pad_get_current_caps(pad);
+        GstAudioInfo audio_info;
+        if (caps && gst_audio_info_from_caps(&audio_info, caps)) {
+            builder->rate = GST_AUDIO_INFO_RATE(&audio_info);
+            builder->channels = GST_AUDIO_INFO_CHANNELS(&audio_info);
+        }
+        if (caps) {
+            gst_caps_unref(caps);
+        }
+        if (!builder->rate) {
+            return GST_PAD_PROBE_OK;
+        }
+    }
+
+    GstBuffer* buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    GstMapInfo map;
+    if (!gst_buffer_map(buffer, &map, GST_MAP_READ)) {
+        return GST_PAD_PROBE_OK;
+    }
+    const float* samples = (const float*)map.data;
+    gsize frames = map.size / (sizeof(float) * builder->channels);
+    for (gsize i = 0; i < frames; ++i) {
+        for (int c = 0; c < builder->channels; ++c) {
+            float x = samples[i * builder->channels + c];
+            builder->bin_min = MIN(builder->bin_min, x);
+            builder->bin_max = MAX(builder->bin_max, x);
+        }
+        if (++builder->bin_fill == WAVEFORM_BASE_BIN) {
+            end_bin(builder);
+        }
+    }
+    builder->frames += frames;
+    gst_buffer_unmap(buffer, &map);
+    return GST_PAD_PROBE_OK;
+}
+
+static gboolean decode_peaks(const char* uri, WaveformBuilder* builder) {
+    return state_decode_audio(uri, "waveform-pipeline", (GstPadProbeCallback)samples_probe, builder) && builder->frames > 0;
+}
+
+// Every bin of the next level covers WAVEFORM_LEVEL_FACTOR bins of this one
+static GArray* reduce_level(GArray* bins) {
+    guint count = bins->len / 2;
+    GArray* reduced = g_array_sized_new(FALSE, FALSE, sizeof(gint16), 2 * (count / WAVEFORM_LEVEL_FACTOR + 1));
+    for (guint i = 0; i < count; i += WAVEFORM_LEVEL_FACTOR) {
+        gint16 bin[2] = {G_MAXINT16, G_MININT16};
+        for (guint j = i; j < MIN(i + WAVEFORM_LEVEL_FACTOR, count); ++j) {
+            bin[0] = MIN(bin[0], g_array_index(bins, gint16, 2 * j));
+            bin[1] = MAX(bin[1], g_array_index(bins, gint16, 2 * j + 1));
+        }
+        g_array_append_vals(reduced, bin, 2);
+    }
+    return reduced;
+}
+
+static gboolean write_peaks(const char* peaks_path, const char* media_path, WaveformBuilder* builder) {
+    GStatBuf st;
+    if (g_stat(media_path, &st) != 0) {
+        return FALSE;
+    }
+
+    GArray* levels[WAVEFORM_LEVELS];
+    levels[0] = builder->bins;
+    for (int i = 1; i < WAVEFORM_LEVELS; ++i) {
+        levels[i] = reduce_level(levels[i - 1]);
+    }
+
+    WaveformHeader header = {{0}, WAVEFORM_VERSION, builder->rate, WAVEFORM_LEVELS, st.st_size, st.st_mtime};
+    memcpy(header.magic, WAVEFORM_MAGIC, 4);
+    GByteArray* bytes = g_byte_array_new();
+    g_byte_array_append(bytes, (const guint8*)&header, sizeof(header));
+    guint64 offset = sizeof(header) + WAVEFORM_LEVELS * sizeof(WaveformLevel);
+    guint32 samples_per_bin = WAVEFORM_BASE_BIN;
+    for (int i = 0; i < WAVEFORM_LEVELS; ++i) {
+        WaveformLevel level = {samples_per_bin, levels[i]->len / 2, offset};
+        g_byte_array_append(bytes, (const guint8*)&level, sizeof(level));
+        offset += levels[i]->len * sizeof(gint16);
+        samples_per_bin *= WAVEFORM_LEVEL_FACTOR;
+    }
+    for (int i = 0; i < WAVEFORM_LEVELS; ++i) {
+        g_byte_array_append(bytes, (const guint8*)levels[i]->data, levels[i]->len * sizeof(gint16));
+    }
+    for (int i = 1; i < WAVEFORM_LEVELS; ++i) {
+        g_array_free(levels[i], TRUE);
+    }
+
+    GError* err = NULL;
+    gboolean is_ok = g_file_set_contents(peaks_path, (const gchar*)bytes->data, bytes->len, &err);
+    if (!is_ok) {
+        g_printerr("Could not write waveform %s: %s\n", peaks_path, err->message);
+        g_clear_error(&err);
+    }
+    g_byte_array_free(bytes, TRUE);
+    return is_ok;
+}
+
+gboolean waveform_build(const char* uri, const char* peaks_path, gint64* duration) {
+    gchar* media_path = g_filename_from_uri(uri, NULL, NULL);
+    if (!media_path) {
+        return FALSE;
+    }
+
+    WaveformBuilder builder = {0};
+    builder.bin_min = G_MAXFLOAT;
+    builder.bin_max = -G_MAXFLOAT;
+    builder.bins = g_array_new(FALSE, FALSE, sizeof(gint16));
+    gboolean is_ok = decode_peaks(uri, &builder);
+    if (is_ok) {
+        if (builder.bin_fill) {
+            end_bin(&builder);
+        }
+        *duration = gst_util_uint64_scale(builder.frames, GST_SECOND, builder.rate);
+        is_ok = write_peaks(peaks_path, media_path, &builder);
+    }
+    g_array_free(builder.bins, TRUE);
+    g_free(media_path);
+    return is_ok;
+}
+
+// ---------------------------------------------------------------------------
+// Reading
+// ---------------------------------------------------------------------------
+
+WaveformPeaks* waveform_peaks_open(const char* peaks_path, const char* media_path) {
+    GStatBuf st;
+    if (g_stat(media_path, &st) != 0) {
+        return NULL;
+    }
+    GMappedFile* file = g_mapped_file_new(peaks_path, FALSE, NULL);
+    if (!file) {
+        return NULL;
+    }
+
+    gsize length = g_mapped_file_get_length(file);
+    const char* contents = g_mapped_file_get_contents(file);
+    const WaveformHeader* header = (const WaveformHeader*)contents;
+    gboolean is_valid = length >= sizeof(WaveformHeader) && !memcmp(header->magic, WAVEFORM_MAGIC, 4)
+        && header->version == WAVEFORM_VERSION && header->source_size == (guint64)st.st_size
+        && header->source_mtime == (gint64)st.st_mtime
+        && length >= sizeof(WaveformHeader) + header->level_count * sizeof(WaveformLevel);
+    const WaveformLevel* levels = (const WaveformLevel*)(contents + sizeof(WaveformHeader));
+    for (guint32 i = 0; is_valid && i < header->level_count; ++i) {
+        // Subtracting first, a huge offset or bin count must not wrap around the sum
+        is_valid = levels[i].offset <= length && levels[i].bin_count <= (length - levels[i].offset) / (2 * sizeof(gint16));
+    }
+    if (!is_valid) {
+        g_mapped_file_unref(file);
+        return NULL;
+    }
+
+    WaveformPeaks* peaks = g_new0(WaveformPeaks, 1);
+    peaks->file = file;
+    peaks->header = header;
+    peaks->levels = levels;
+    return peaks;
+}
+
+void waveform_peaks_free(WaveformPeaks* peaks) {
+    if (!peaks) {
+        return;
+    }
+    g_mapped_file_unref(peaks->file);
+    g_free(peaks);
+}
+
+guint32 waveform_peaks_rate(WaveformPeaks* peaks) {
+    return peaks->header->rate;
+}
+
+guint32 waveform_peaks_level_count(WaveformPeaks* peaks) {
+    return peaks->header->level_count;
+}
+
+const gint16* waveform_peaks_level(WaveformPeaks* peaks, guint32 level, guint32* samples_per_bin, guint32* bin_count) {
+    if (level >= peaks->header->level_count) {
+        return NULL;
+    }
+    *samples_per_bin = peaks->levels[level].samples_per_bin;
+    *bin_count = peaks->levels[level].bin_count;
+    return (const gint16*)(g_mapped_file_get_contents(peaks->file) + peaks->levels[level].offset);
+}
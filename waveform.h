@@ -0,0 +1,35 @@
+#ifndef __WAVEFORM_H
+#define __WAVEFORM_H
+
+#include "glib.h"
+
+// Min/max waveform peaks of a local file at WAVEFORM_LEVELS zoom levels, for drawing. Every bin
+// holds the lowest and highest sample of all channels over its samples as gint16 {min, max}.
+// Level 0 has WAVEFORM_BASE_BIN samples per bin, every further level WAVEFORM_LEVEL_FACTOR times
+// as many.
+//
+// File layout, native endianness, memory-mapped for reading:
+//   char[4] "WPKS", guint32 version, guint32 rate, guint32 level_count,
+//   guint64 source size, gint64 source modification time,
+//   level_count * {guint32 samples_per_bin, guint32 bin_count, guint64 offset of the bins in the file},
+//   the bins of every level
+// The source size and time tell whether the file still matches its media.
+typedef struct WaveformPeaks WaveformPeaks;
+
+#define WAVEFORM_BASE_BIN 256
+#define WAVEFORM_LEVEL_FACTOR 4
+#define WAVEFORM_LEVELS 4
+
+// Decodes the audio of uri and writes peaks_path, FALSE for files without audio
+gboolean waveform_build(const char* uri, const char* peaks_path, gint64* duration);
+
+// Maps peaks_path, null when it is missing, invalid or made from another version of media_path
+WaveformPeaks* waveform_peaks_open(const char* peaks_path, const char* media_path);
+void waveform_peaks_free(WaveformPeaks* peaks);
+
+guint32 waveform_peaks_rate(WaveformPeaks* peaks);
+guint32 waveform_peaks_level_count(WaveformPeaks* peaks);
+// {min, max} pairs of level, straight from the mapping, valid until the peaks are freed
+const gint16* waveform_peaks_level(WaveformPeaks* peaks, guint32 level, guint32* samples_per_bin, guint32* bin_count);
+
+#endif